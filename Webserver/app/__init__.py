@@ -1,7 +1,13 @@
+import os
 from flask import Flask
 from flask_sqlalchemy import SQLAlchemy
+from werkzeug.serving import WSGIRequestHandler
 from config import Config
 
+# Scanners keep one connection open across reports; the development
+# server only supports that when it speaks HTTP/1.1.
+WSGIRequestHandler.protocol_version = "HTTP/1.1"
+
 db = SQLAlchemy()
 
 def create_app(config_class=Config):
@@ -17,5 +23,13 @@ def create_app(config_class=Config):
 
         # Create database tables for our models if they don't exist
         db.create_all()
+
+        # Scanners report over the stream and MQTT from the moment the server
+        # is up, not only after its first HTTP request. In debug mode the
+        # reloader's watcher process builds the app too but never serves, so
+        # only the child it starts (WERKZEUG_RUN_MAIN) takes the port and the
+        # MQTT subscription.
+        if not app.debug or os.environ.get("WERKZEUG_RUN_MAIN") == "true":
+            routes.start_scanner_transports(app)
         
         return app 
\ No newline at end of file
@@ -0,0 +1,180 @@
+"""
+Firmware images for the scanners' over-the-air updates
+(firmware/Scanner/OtaManager.h). Images are kept as <dir>/<version>.bin,
+where the version is the build's FIRMWARE_VERSION. A scanner running an
+older version that is also stored here can download a patch against it
+instead of the whole image; patches are built once and cached in
+<dir>/patches/.
+
+Patch format (all integers little endian):
+    header  "HD" format:u8 size:u32 (of the new image)
+    ops     OP_COPY offset:u32 length:u32   bytes from the old image
+            OP_INSERT length:u32 bytes      new bytes
+"""
+import hashlib
+import os
+import struct
+
+PATCH_MAGIC = b"HD"
+PATCH_FORMAT = 1
+OP_COPY = 1
+OP_INSERT = 2
+# ESP32 application images start with this byte
+IMAGE_MAGIC = 0xE9
+# Matches are looked up by blocks of this many bytes of the old image,
+# indexed every BLOCK_STRIDE bytes. A copy shorter than a block costs more
+# than inserting the bytes.
+BLOCK = 32
+BLOCK_STRIDE = 4
+
+_info_cache = {}
+
+
+def image_path(directory, version):
+    return os.path.join(directory, f"{version}.bin")
+
+
+def patch_path(directory, old, new):
+    return os.path.join(directory, "patches", f"{old}-{new}.patch")
+
+
+def list_versions(directory):
+    """Versions of the stored images, oldest first."""
+    if not os.path.isdir(directory):
+        return []
+    names = (name[:-4] for name in os.listdir(directory) if name.endswith(".bin"))
+    return sorted(int(name) for name in names if name.isdigit())
+
+
+def save_image(directory, version, image):
+    """Stores an image; raises ValueError if it is not an ESP32 application image."""
+    if not image or image[0] != IMAGE_MAGIC:
+        raise ValueError("Not an ESP32 application image")
+    os.makedirs(directory, exist_ok=True)
+    _write_atomically(image_path(directory, version), image)
+    # Patches to and from the replaced image are stale
+    patches = os.path.join(directory, "patches")
+    if os.path.isdir(patches):
+        for name in os.listdir(patches):
+            if str(version) in name[:-len(".patch")].split("-"):
+                os.remove(os.path.join(patches, name))
+
+
+def image_info(directory, version):
+    """{"version", "size", "sha256"} of a stored image, or None if there is none."""
+    path = image_path(directory, version)
+    try:
+        mtime = os.stat(path).st_mtime_ns
+    except OSError:
+        return None
+    cached = _info_cache.get(path)
+    if cached is None or cached[0] != mtime:
+        with open(path, "rb") as f:
+            image = f.read()
+        cached = (mtime, {"version": version, "size": len(image),
+                          "sha256": hashlib.sha256(image).hexdigest()})
+        _info_cache[path] = cached
+    return cached[1]
+
+
+def build_patch(directory, old, new):
+    """
+    Size of the patch from image `old` to image `new`, building it if it is
+    not cached yet. None if either image is missing, or if the patch does
+    not reproduce `new`; the scanner then downloads the whole image.
+    """
+    path = patch_path(directory, old, new)
+    if os.path.exists(path):
+        return os.path.getsize(path)
+    try:
+        with open(image_path(directory, old), "rb") as f:
+            old_image = f.read()
+        with open(image_path(directory, new), "rb") as f:
+            new_image = f.read()
+    except OSError:
+        return None
+    patch = make_patch(old_image, new_image)
+    if apply_patch(old_image, patch) != new_image:
+        return None
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    _write_atomically(path, patch)
+    return len(patch)
+
+
+def make_patch(old, new):
+    """
+    Patch that turns `old` into `new`. Blocks of `new` found in `old` become
+    copies, extended forward and backward as far as the bytes keep matching;
+    everything else is inserted.
+    """
+    index = {}
+    for offset in range(0, len(old) - BLOCK + 1, BLOCK_STRIDE):
+        index.setdefault(old[offset:offset + BLOCK], offset)
+
+    patch = bytearray(PATCH_MAGIC + bytes([PATCH_FORMAT]) + struct.pack("<I", len(new)))
+    literal_start = 0
+    pos = 0
+    while pos + BLOCK <= len(new):
+        source = index.get(new[pos:pos + BLOCK])
+        if source is None:
+            pos += 1
+            continue
+        end = pos + BLOCK + _match_length(old, source + BLOCK, new, pos + BLOCK)
+        start = pos
+        while start > literal_start and source > 0 and new[start - 1] == old[source - 1]:
+            start -= 1
+            source -= 1
+        _insert(patch, new[literal_start:start])
+        patch += struct.pack("<BII", OP_COPY, source, end - start)
+        literal_start = pos = end
+    _insert(patch, new[literal_start:])
+    return bytes(patch)
+
+
+def apply_patch(old, patch):
+    """Reference for the scanner's side of make_patch(); build_patch() checks each patch with it."""
+    magic, fmt, size = struct.unpack_from("<2sBI", patch)
+    if magic != PATCH_MAGIC or fmt != PATCH_FORMAT:
+        raise ValueError("Not a patch")
+    new = bytearray()
+    pos = 7
+    while pos < len(patch):
+        op = patch[pos]
+        if op == OP_COPY:
+            offset, length = struct.unpack_from("<II", patch, pos + 1)
+            new += old[offset:offset + length]
+            pos += 9
+        elif op == OP_INSERT:
+            length = struct.unpack_from("<I", patch, pos + 1)[0]
+            new += patch[pos + 5:pos + 5 + length]
+            pos += 5 + length
+        else:
+            raise ValueError(f"Bad op {op}")
+    if len(new) != size:
+        raise ValueError("Patch does not produce the stated size")
+    return bytes(new)
+
+
+def _match_length(a, a_pos, b, b_pos):
+    """Number of equal bytes from a[a_pos] and b[b_pos] on."""
+    length = 0
+    step = 256
+    while step:
+        while a_pos + length + step <= len(a) and b_pos + length + step <= len(b) \
+                and a[a_pos + length:a_pos + length + step] == b[b_pos + length:b_pos + length + step]:
+            length += step
+        step //= 4
+    return length
+
+
+def _insert(patch, data):
+    if data:
+        patch += struct.pack("<BI", OP_INSERT, len(data))
+        patch += data
+
+
+def _write_atomically(path, data):
+    temp = path + ".tmp"
+    with open(temp, "wb") as f:
+        f.write(data)
+    os.replace(temp, path)
@@ -25,4 +25,17 @@ class ScannerMovement(db.Model):
     avg_angle_yz = db.Column(db.Float, nullable=False)
     total_movement = db.Column(db.Float, nullable=False)
     timestamp = db.Column(db.DateTime, nullable=False, default=datetime.utcnow)
-    scanner_id = db.Column(db.Integer, db.ForeignKey('scanner.id'), nullable=False) 
\ No newline at end of file
+    scanner_id = db.Column(db.Integer, db.ForeignKey('scanner.id'), nullable=False) 
+
+class ReportKeyframe(db.Model):
+    """A report that listed every beacon the scanner saw (not a delta report)."""
+    id = db.Column(db.Integer, primary_key=True)
+    timestamp = db.Column(db.DateTime, nullable=False, index=True)
+    scanner_id = db.Column(db.Integer, db.ForeignKey('scanner.id'), nullable=False)
+
+class BeaconGone(db.Model):
+    """A beacon a delta report listed as no longer seen."""
+    id = db.Column(db.Integer, primary_key=True)
+    timestamp = db.Column(db.DateTime, nullable=False)
+    scanner_id = db.Column(db.Integer, db.ForeignKey('scanner.id'), nullable=False)
+    beacon_id = db.Column(db.Integer, db.ForeignKey('beacon.id'), nullable=False)
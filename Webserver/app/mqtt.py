@@ -0,0 +1,87 @@
+"""
+MQTT transport for scanners. Scanners built with UPLINK_MQTT publish their
+reports to a broker instead of POSTing them; any number of server processes
+can consume them through a shared subscription, so ingest scales beyond one
+Flask process.
+
+    hitloop/<scanner>/report  scanner -> server  format:u8 captured_at:i64 body,
+                                                 the payload of a stream REPORT frame
+    hitloop/<scanner>/cmd     server -> scanner  JSON: the answer to a live report
+                                                 (QoS 0) or a pushed command (QoS 1)
+"""
+import json
+import os
+import struct
+import threading
+
+try:
+    import paho.mqtt.client as paho
+except ImportError:  # MQTT is optional
+    paho = None
+
+REPORT_TOPIC = "hitloop/+/report"
+COMMAND_TOPIC = "hitloop/{}/cmd"
+
+_REPORT = struct.Struct("<Bq")
+
+_client = None
+_client_lock = threading.Lock()
+
+
+def start(app, host, port, share_group, on_report):
+    """
+    Connects to the broker once per process and consumes scanner reports.
+    on_report(format, body, captured_at_ms) returns (response dict, status),
+    like the stream. With share_group set, the broker hands each report to
+    one member of the group.
+    """
+    global _client
+    with _client_lock:
+        if _client is not None or not host:
+            return
+        if paho is None:
+            print("MQTT_HOST is set but paho-mqtt is not installed; MQTT ingest disabled.")
+            return
+
+        topic = f"$share/{share_group}/{REPORT_TOPIC}" if share_group else REPORT_TOPIC
+        client = paho.Client(paho.CallbackAPIVersion.VERSION2, client_id=f"hitloop-server-{os.getpid()}")
+
+        def on_connect(client, userdata, flags, reason_code, properties):
+            if reason_code.is_failure:
+                print(f"MQTT connection refused: {reason_code}")
+                return
+            # Subscribed on every connect: the session is not kept across reconnects
+            client.subscribe(topic, qos=1)
+            print(f"MQTT consuming {topic} on {host}:{port}")
+
+        def on_message(client, userdata, message):
+            scanner_id = message.topic.split("/")[1]
+            try:
+                fmt, captured_at = _REPORT.unpack_from(message.payload)
+            except struct.error:
+                print(f"Malformed MQTT report from {scanner_id}")
+                return
+            with app.app_context():
+                response, status = on_report(fmt, message.payload[_REPORT.size:], captured_at or None)
+            # Only live reports are answered; a stored report's answer would
+            # carry stale clock samples and commands
+            if status == 200 and not captured_at:
+                client.publish(COMMAND_TOPIC.format(scanner_id), json.dumps(response), qos=0)
+            elif status != 200:
+                print(f"MQTT report from {scanner_id} rejected: {response.get('message')}")
+
+        client.on_connect = on_connect
+        client.on_message = on_message
+        client.reconnect_delay_set(min_delay=1, max_delay=60)
+        client.connect_async(host, port, keepalive=30)
+        client.loop_start()
+        _client = client
+
+
+def push_command(scanner_id, command):
+    """Publishes a command to the scanner's cmd topic. Returns False without a broker connection."""
+    client = _client
+    if client is None or not client.is_connected():
+        return False
+    info = client.publish(COMMAND_TOPIC.format(scanner_id), json.dumps(command), qos=1)
+    return info.rc == paho.MQTT_ERR_SUCCESS
@@ -0,0 +1,187 @@
+"""
+Decoder for the scanners' binary report format (Content-Type
+application/x-hitloop-report) and for batches of such reports
+(application/x-hitloop-batch). The layouts are described in
+firmware/Scanner/ReportWriter.h and ReportBatch.h; decode_report() turns a
+report into the same dict the JSON report would have produced.
+"""
+import struct
+
+BINARY_REPORT_MIMETYPE = "application/x-hitloop-report"
+BINARY_BATCH_MIMETYPE = "application/x-hitloop-batch"
+BEACON_NAME_PREFIX = "HitloopBeacon"
+
+SECTION_BEACONS = 1
+SECTION_MOTION = 2
+SECTION_PRESETS = 3
+SECTION_RULES = 4
+SECTION_LINK = 5
+SECTION_NAME = 6
+SECTION_ACK = 7
+SECTION_DELTA = 8
+SECTION_WIFI = 9
+SECTION_URGENT = 10
+SECTION_PARAMS = 11
+SECTION_BOOT = 12
+SECTION_FIRMWARE = 13
+
+_HEADER = struct.Struct("<2sB6sI")
+_BATCH_HEADER = struct.Struct("<2sBBI")
+_SECTION = struct.Struct("<BH")
+_MOTION = struct.Struct("<fffII")
+_LINK = struct.Struct("<6I")
+_LINK_KEYS = ("ms", "avg_ms", "requests", "reused", "reconnects", "failures")
+_WIFI = struct.Struct("<4IBbB")
+_URGENT = struct.Struct("<BhIq")
+URGENT_KINDS = {1: "beacon", 2: "impact"}
+_WIFI_KEYS = ("boot_ms", "reconnect_ms", "reconnects", "roams", "fast", "rssi", "channel")
+# Firmware BootPhase order; phases added later are simply not named here
+_BOOT_KEYS = ("config", "wifi_start", "leds", "imu", "ble", "ready", "wifi", "scan", "report")
+_FIRMWARE = struct.Struct("<IBIB")
+OTA_STATES = ("idle", "downloading", "failed", "trial")
+
+
+class ReportDecodeError(ValueError):
+    pass
+
+
+def _read_string(payload, pos):
+    length = payload[pos]
+    prefixed = bool(length & 0x80)
+    length &= 0x7F
+    name = payload[pos + 1:pos + 1 + length].decode("utf-8", "replace")
+    if prefixed:
+        name = BEACON_NAME_PREFIX + name
+    return name, pos + 1 + length
+
+
+def _decode_beacons(payload):
+    beacons = []
+    pos = 1
+    for _ in range(payload[0]):
+        name, pos = _read_string(payload, pos)
+        rssi = struct.unpack_from("<b", payload, pos)[0]
+        pos += 1
+        beacons.append({"name": name, "rssi": rssi})
+    return beacons
+
+
+def _decode_names(payload):
+    names = []
+    pos = 1
+    for _ in range(payload[0]):
+        name, pos = _read_string(payload, pos)
+        names.append(name)
+    return names
+
+
+def _decode_urgent(payload):
+    events = []
+    pos = 0
+    while pos < len(payload):
+        kind, value, ago, at = _URGENT.unpack_from(payload, pos)
+        name, pos = _read_string(payload, pos + _URGENT.size)
+        event = {"kind": URGENT_KINDS.get(kind, kind), "value": value, "ago": ago}
+        if name:
+            event["name"] = name
+        if at:
+            event["at"] = at
+        events.append(event)
+    return events
+
+
+def _decode_rules(payload, report):
+    report["rv"] = struct.unpack_from("<H", payload, 0)[0]
+    fired = []
+    pos = 2
+    while pos < len(payload):
+        rule, preset, rssi, ago = struct.unpack_from("<BBbI", payload, pos)
+        beacon, pos = _read_string(payload, pos + 7)
+        fired.append({"rule": rule, "preset": preset, "beacon": beacon, "rssi": rssi, "ago": ago})
+    if fired:
+        report["fired"] = fired
+
+
+def decode_report(data):
+    """Decodes a binary report. Raises ReportDecodeError if it is malformed."""
+    try:
+        magic, version, mac, t0 = _HEADER.unpack_from(data, 0)
+        if magic != b"HL" or version != 1:
+            raise ReportDecodeError(f"Not a version 1 report (magic {magic!r}, version {version})")
+
+        report = {"scanner_id": ":".join(f"{b:02X}" for b in mac), "t0": t0}
+        pos = _HEADER.size
+        while pos < len(data):
+            section, length = _SECTION.unpack_from(data, pos)
+            pos += _SECTION.size
+            payload = data[pos:pos + length]
+            if len(payload) != length:
+                raise ReportDecodeError("Truncated section")
+            pos += length
+
+            if section == SECTION_BEACONS:
+                report["beacons"] = _decode_beacons(payload)
+            elif section == SECTION_MOTION:
+                axz, ayz, move, interval_ms, samples = _MOTION.unpack(payload)
+                report["movement"] = {
+                    "avgAngleXZ": axz,
+                    "avgAngleYZ": ayz,
+                    "totalMovement": move,
+                    "intervalMs": interval_ms,
+                    "samples": samples,
+                }
+            elif section == SECTION_PRESETS:
+                report["pv"] = [list(struct.unpack_from("<BH", payload, i)) for i in range(0, length, 3)]
+            elif section == SECTION_RULES:
+                _decode_rules(payload, report)
+            elif section == SECTION_LINK:
+                report["link"] = dict(zip(_LINK_KEYS, _LINK.unpack(payload)))
+            elif section == SECTION_NAME:
+                report["scanner_name"] = payload.decode("utf-8", "replace")
+            elif section == SECTION_ACK:
+                report["ack"] = struct.unpack("<I", payload)[0]
+            elif section == SECTION_DELTA:
+                report["delta"] = True
+                report["gone"] = _decode_names(payload)
+            elif section == SECTION_WIFI:
+                wifi = dict(zip(_WIFI_KEYS, _WIFI.unpack(payload)))
+                wifi["fast"] = bool(wifi["fast"])
+                report["wifi"] = wifi
+            elif section == SECTION_URGENT:
+                report["urgent"] = _decode_urgent(payload)
+            elif section == SECTION_PARAMS:
+                report["cv"] = struct.unpack("<H", payload)[0]
+            elif section == SECTION_BOOT:
+                times = struct.unpack_from(f"<{length // 4}I", payload)
+                report["boot"] = {key: ms for key, ms in zip(_BOOT_KEYS, times) if ms}
+            elif section == SECTION_FIRMWARE:
+                fw, state, version, done = _FIRMWARE.unpack(payload)
+                report["fw"] = fw
+                if state:
+                    report["ota"] = {"version": version, "done": done,
+                                     "state": OTA_STATES[state] if state < len(OTA_STATES) else state}
+            # Unknown sections are skipped
+        return report
+    except (struct.error, IndexError) as e:
+        raise ReportDecodeError(f"Malformed report: {e}") from e
+
+
+def decode_batch(data):
+    """Decodes a batch into {"batch": [report, ...], "t0": send time}, like the JSON batch."""
+    try:
+        magic, version, count, t0 = _BATCH_HEADER.unpack_from(data, 0)
+        if magic != b"HB" or version != 1:
+            raise ReportDecodeError(f"Not a version 1 batch (magic {magic!r}, version {version})")
+
+        reports = []
+        pos = _BATCH_HEADER.size
+        for _ in range(count):
+            length = struct.unpack_from("<H", data, pos)[0]
+            pos += 2
+            if pos + length > len(data):
+                raise ReportDecodeError("Truncated batch")
+            reports.append(decode_report(data[pos:pos + length]))
+            pos += length
+        return {"batch": reports, "t0": t0}
+    except struct.error as e:
+        raise ReportDecodeError(f"Malformed batch: {e}") from e
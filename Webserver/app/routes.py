@@ -1,21 +1,75 @@
-from flask import Blueprint, request, jsonify, render_template
+from flask import Blueprint, current_app, request, jsonify, render_template, send_file
 from datetime import datetime, timedelta
+from collections import deque
+import hashlib
+import json
+import os
 import time
-from threading import Lock
-from . import db
-from .models import Scanner, Beacon, RssiValue, ScannerMovement
+from threading import Lock, Thread
+from . import db, firmware, mqtt, stream
+from .models import Scanner, Beacon, RssiValue, ScannerMovement, ReportKeyframe, BeaconGone
+from .report_codec import (BINARY_BATCH_MIMETYPE, BINARY_REPORT_MIMETYPE, ReportDecodeError,
+                           decode_batch, decode_report)
 from sqlalchemy import func
 
 main_bp = Blueprint('main', __name__)
 
 # --- In-memory data store & synchronization ---
 devices_data = {}
+# Pending commands per scanner. Each carries a cmd_seq and stays queued until
+# the scanner acknowledges it (in its next report, or right away over the
+# stream), so a lost response does not lose the command.
 device_configs = {}
+config_lock = Lock()
+# Scanners ignore a cmd_seq they have already applied; starting from the
+# time keeps the sequence increasing across server restarts.
+next_command_seq = int(time.time())
 SCAN_INTERVAL_SECONDS = 8
+# Lead time for synchronized effects: long enough for every scanner to pick
+# up its command on the next report (scan interval plus scan and margin).
+SYNC_LEAD_MS = 12000
+# Behavior presets: {preset_id: {"version": int, "body": {...}}}. Scanners
+# cache them, after which a command only needs the preset id.
+presets = {}
+MAX_PRESET_UPLOADS_PER_RESPONSE = 2
+# Proximity rules, compiled to the scanners' bytecode and evaluated on the
+# device every scan. Version 0 means no rule set has been defined yet.
+rule_set = {"version": 0, "beacons": [], "code": "", "rules": []}
+RULE_OPS = {"rssi_above": 1, "rssi_below": 2, "absent": 3}
+RULE_ANY_BEACON = 0xFF
+MAX_RULES = 16
+MAX_RULE_BEACONS = 8
+MAX_RULE_EVENTS_KEPT = 20
+MAX_URGENT_EVENTS_KEPT = 20
+# Limits of the scanners' haptic waveforms (firmware HapticSequencer.h)
+HAPTIC_MAX_STEPS = 16
+HAPTIC_MAX_STEP_MS = 65535
+# Runtime parameters for every scanner (firmware Params.h), sent to a scanner
+# whose reported version ("cv") differs. Values left out keep the scanner's own.
+param_set = {"version": 0, "values": {}}
+PARAM_NAMES = (
+    "scan_interval_ms", "scan_duration_s", "ble_scan_interval", "ble_scan_window",
+    "imu_interval_ms", "urgent_impact_mg", "led_brightness", "led_count",
+    "report_batch_size", "report_keyframe_interval", "report_delta_hysteresis_db",
+    "report_urgent_rssi", "wifi_roam_rssi", "wifi_roam_margin_db",
+)
+# Firmware offered to every scanner that reports another version ("fw").
+# Patches from the other stored versions are built in the background and
+# offered as they become ready: {old version: patch size}.
+firmware_target = {"version": 0, "offer": None, "patches": {}}
 next_slot_time_ms = int(time.time() * 1000)
 time_lock = Lock()
+# Digests of each scanner's last reports. A scanner sends a report again when
+# the answer to it was lost (a stream or HTTP timeout, a replay after an
+# outage), though the server may have stored it already.
+recent_reports = {}
+RECENT_REPORTS_KEPT = 16
 
 
+def now_ms():
+    """Server clock in milliseconds since the epoch."""
+    return int(time.time() * 1000)
+
 def RSSI_to_distance(RSSI):
     """Converts RSSI value to a qualitative distance."""
     distance = ""
@@ -32,64 +86,142 @@ def RSSI_to_distance(RSSI):
 def index():
     return render_template('index.html', devices=devices_data)
 
+def start_scanner_transports(app):
+    """Starts the scanner stream listener and MQTT consumer, once per process."""
+    stream.start(app, app.config.get("STREAM_PORT"), on_transport_report, acknowledge_command)
+    mqtt.start(app, app.config.get("MQTT_HOST"), app.config.get("MQTT_PORT"),
+               app.config.get("MQTT_SHARE_GROUP"), on_transport_report)
+
+@main_bp.before_app_request
+def ensure_scanner_transports():
+    """For a debug server without the reloader, where create_app() leaves them (see there)."""
+    start_scanner_transports(current_app._get_current_object())
+
+def decode_body(mimetype, body):
+    """Scanners send either JSON or the compact binary formats."""
+    if mimetype == BINARY_REPORT_MIMETYPE:
+        return decode_report(body)
+    if mimetype == BINARY_BATCH_MIMETYPE:
+        return decode_batch(body)
+    return json.loads(body)
+
+STREAM_FORMATS = {0: "application/json", 1: BINARY_REPORT_MIMETYPE, 2: BINARY_BATCH_MIMETYPE}
+
+def on_transport_report(fmt, body, captured_ms):
+    """A report that arrived over a scanner's stream or MQTT instead of POST /data."""
+    received_ms = now_ms()
+    try:
+        data = decode_body(STREAM_FORMATS.get(fmt), body)
+    except ValueError as e:
+        return {"status": "error", "message": str(e)}, 400
+    return process_report(data, received_ms, captured_ms)
+
 @main_bp.route('/data', methods=['POST'])
 def receive_data():
+    received_ms = now_ms()
+    try:
+        data = decode_body(request.mimetype, request.get_data())
+    except ValueError as e:
+        return jsonify({"status": "error", "message": str(e)}), 400
+
+    # Reports a scanner stored during an outage carry their capture time
+    # (server clock, ms since the epoch) and may arrive out of order.
+    captured_ms = None
+    if request.headers.get("X-Captured-At"):
+        try:
+            captured_ms = int(request.headers["X-Captured-At"])
+        except ValueError:
+            return jsonify({"status": "error", "message": "Invalid X-Captured-At"}), 400
+
+    payload, status = process_report(data, received_ms, captured_ms)
+    return jsonify(payload), status
+
+def process_report(data, received_ms, captured_ms=None):
+    """
+    Stores a report (or batch) and builds the response for the scanner.
+    Returns (response dict, HTTP status).
+    """
     global next_slot_time_ms
-    data = request.json
-    
+    if not isinstance(data, dict):
+        return {"status": "error", "message": "Expected a JSON object"}, 400
+    try:
+        if captured_ms is not None:
+            datetime.utcfromtimestamp(captured_ms / 1000)
+    except (ValueError, OverflowError, OSError):
+        return {"status": "error", "message": "Invalid capture time"}, 400
+
+    # Urgent events come between reports and are handled on their own
+    if data.get("urgent") is not None:
+        return process_urgent(data, received_ms, captured_ms)
+
+    # A batch holds several consecutive reports: {"batch": [...], "t0": send time}
+    reports = data.get("batch") if isinstance(data.get("batch"), list) else [data]
+    if not reports:
+        return {"status": "error", "message": "Empty batch"}, 400
+    send_t0 = data.get("t0")
+
     # Standardize scanner ID lookup
+    for report in reports:
+        if not (report.get("scanner_id") or report.get("Scanner name")):
+            print(f"Received invalid data payload: {report}")
+            return {"status": "error", "message": "Missing scanner identifier in payload"}, 400
+
+    # A report seen before is answered again but not stored twice
+    duplicate = seen_before(reports[-1].get("scanner_id") or reports[-1].get("Scanner name"), data)
+
+    # Each report is dated from its own t0 relative to the request's send
+    # time. Everything is stored in one transaction.
+    base_ms = captured_ms if captured_ms is not None else received_ms
+    for report in reports if not duplicate else []:
+        report_ms = base_ms
+        if send_t0 is not None and report.get("t0") is not None:
+            report_ms -= max(0, send_t0 - report["t0"])
+        if not report.get("simulated"):
+            store_report(report, datetime.utcfromtimestamp(report_ms / 1000))
+    db.session.commit()
+
+    # Historical reports only go to the database; the live view, timing and
+    # pending commands are for the scanner's live reports.
+    if captured_ms is not None:
+        return {"status": "stored", "reports": len(reports)}, 200
+
+    # The newest report of a batch is the live one
+    data = {**reports[-1], "t0": send_t0,
+            "fired": [event for report in reports for event in report.get("fired") or []]}
     scanner_id = data.get("scanner_id") or data.get("Scanner name")
-
-    beacons_payload = data.get("beacons")
     movement_payload = data.get("movement")
 
-    if not scanner_id:
-        print(f"Received invalid data payload: {data}")
-        return jsonify({"status": "error", "message": "Missing scanner identifier in payload"}), 400
-
-    if not data.get("simulated"):
-        scanner = Scanner.query.filter_by(name=scanner_id).first()
-        if not scanner:
-            scanner = Scanner(name=scanner_id)
-            db.session.add(scanner)
-            db.session.commit()
-
-        # Only store dict-based movement payloads in the DB
-        if isinstance(movement_payload, dict):
-            avg_angle_xz = movement_payload.get('avgAngleXZ')
-            avg_angle_yz = movement_payload.get('avgAngleYZ')
-            total_movement = movement_payload.get('totalMovement')
-            if avg_angle_xz is not None and avg_angle_yz is not None and total_movement is not None:
-                movement_record = ScannerMovement(
-                    avg_angle_xz=avg_angle_xz,
-                    avg_angle_yz=avg_angle_yz,
-                    total_movement=total_movement,
-                    scanner_id=scanner.id
-                )
-                db.session.add(movement_record)
-
-        # Only store list-based beacon payloads in the DB
-        if isinstance(beacons_payload, list):
-            for beacon_info in beacons_payload:
-                rssi = beacon_info.get("rssi")
-                beacon_name = beacon_info.get("name")
-                if rssi is not None and beacon_name is not None:
-                    beacon = Beacon.query.filter_by(name=beacon_name).first()
-                    if not beacon:
-                        beacon = Beacon(name=beacon_name)
-                        db.session.add(beacon)
-                        db.session.commit()
-                    
-                    rssi_record = RssiValue(rssi=rssi, scanner_id=scanner.id, beacon_id=beacon.id)
-                    db.session.add(rssi_record)
-        
-        db.session.commit()
-
     # --- Standardize and update in-memory data for live view ---
     if scanner_id not in devices_data:
         devices_data[scanner_id] = {"beacons_observed": {}, "movement": {}}
     
     devices_data[scanner_id]["timestamp"] = datetime.utcnow().isoformat() + "Z"
+
+    # Uplink connection reuse and round-trip times as measured by the scanner
+    if isinstance(data.get("link"), dict):
+        devices_data[scanner_id]["link"] = data["link"]
+
+    # WiFi connect times, outages and roams
+    if isinstance(data.get("wifi"), dict):
+        devices_data[scanner_id]["wifi"] = data["wifi"]
+
+    # When each boot phase finished; sent until the server has seen it once
+    if isinstance(data.get("boot"), dict):
+        devices_data[scanner_id]["boot"] = data["boot"]
+
+    # Firmware version, and the progress of an update while there is one
+    if data.get("fw") is not None:
+        devices_data[scanner_id]["fw"] = data["fw"]
+        devices_data[scanner_id]["ota"] = data.get("ota")
+
+    # Rules that fired on the scanner since its last report
+    fired = data.get("fired")
+    if isinstance(fired, list) and fired and not duplicate:
+        events = devices_data[scanner_id].setdefault("rule_events", [])
+        for event in fired:
+            event["received"] = devices_data[scanner_id]["timestamp"]
+        events.extend(fired)
+        del events[:-MAX_RULE_EVENTS_KEPT]
     
     # Standardize movement payload
     if isinstance(movement_payload, dict):
@@ -102,13 +234,155 @@ def receive_data():
             "totalMovement": movement_payload
         }
 
+    # Every report of a batch is applied in order, since delta reports
+    # build on the ones before them
+    for report in reports:
+        apply_beacons(devices_data[scanner_id]["beacons_observed"], report)
+
+    with time_lock:
+        current_time_ms = int(time.time() * 1000)
+        
+        if next_slot_time_ms < current_time_ms:
+            slots_passed = current_time_ms // (SCAN_INTERVAL_SECONDS * 1000)
+            next_slot_time_ms = (slots_passed + 1) * (SCAN_INTERVAL_SECONDS * 1000)
+
+        wait_ms = next_slot_time_ms - current_time_ms
+        next_slot_time_ms += SCAN_INTERVAL_SECONDS * 1000
+
+    control_payload = {
+        "wait_ms": wait_ms
+    }
+    add_commands(control_payload, scanner_id, data, received_ms)
+    record_latency(devices_data[scanner_id], data.get("link"), received_ms)
+    return control_payload, 200
+
+def seen_before(scanner_id, data):
+    """
+    True if this scanner sent the same report (or batch) recently. Reports
+    carry their send time t0, so a real repeat is byte for byte the same;
+    ones without t0 (simulated) are never taken for repeats.
+    """
+    if data.get("t0") is None:
+        return False
+    digest = hashlib.sha1(json.dumps(data, sort_keys=True).encode()).digest()
+    recent = recent_reports.setdefault(scanner_id, deque(maxlen=RECENT_REPORTS_KEPT))
+    if digest in recent:
+        return True
+    recent.append(digest)
+    return False
+
+def record_latency(device, link, received_ms):
+    """
+    Per-report latency as the server measures it: the time it took to
+    handle the report (storage included), and the network share of the
+    scanner's previous POST, i.e. the round trip it reports in "link" minus
+    the server's time for that report.
+    """
+    latency = device.setdefault("latency", {})
+    previous_ms = latency.get("server_ms")
+    server_ms = now_ms() - received_ms
+    average = latency.get("avg_server_ms", server_ms)
+    latency["server_ms"] = server_ms
+    latency["avg_server_ms"] = average + (server_ms - average) // 8  # Like the scanner's, alpha 1/8
+
+    # Only a new POST changes link; reports sent over the stream or MQTT
+    # carry the counters of the last one again
+    if not isinstance(link, dict) or not isinstance(link.get("ms"), int):
+        return
+    if link.get("requests") != latency.get("requests"):
+        latency["requests"] = link.get("requests")
+        if previous_ms is not None:
+            latency["network_ms"] = max(0, link["ms"] - previous_ms)
+
+def add_commands(control_payload, scanner_id, data, received_ms):
+    """
+    Adds what a scanner's answer carries besides the scan timing: its
+    pending command, rule and preset updates, and the clock sample.
+    """
+    # A pending command goes out with every response until the scanner
+    # acknowledges its cmd_seq.
+    required_preset = None
+    if data.get("ack") is not None:
+        acknowledge_command(scanner_id, data["ack"])
+    with config_lock:
+        config_to_send = dict(device_configs.get(scanner_id, {}))
+    if config_to_send:
+        control_payload.update(config_to_send)
+        if 'preset' in config_to_send:
+            required_preset = config_to_send['preset'].get('id')
+
+    if data.get("rv") is not None and rule_set["version"] and data["rv"] != rule_set["version"]:
+        control_payload['rules'] = {key: rule_set[key] for key in ("version", "beacons", "code")}
+
+    if data.get("cv") is not None and param_set["version"] and data["cv"] != param_set["version"]:
+        control_payload['params'] = param_set
+
+    offer = firmware_offer(data.get("fw"))
+    if offer:
+        control_payload['ota'] = offer
+
+    uploads = presets_to_upload(data.get("pv"), required_preset)
+    if uploads:
+        control_payload['presets'] = uploads
+
+    # Echo the scanner's send time with our receive and send times, so it can
+    # estimate its clock offset (NTP style) for synchronized effects.
+    if data.get("t0") is not None:
+        control_payload['clock'] = {"t0": data["t0"], "t1": received_ms, "t2": now_ms()}
+
+def process_urgent(data, received_ms, captured_ms):
+    """
+    Handles urgent events (a beacon close by, an impact) that a scanner sends
+    as soon as it detects them instead of with its next report. They go to
+    the live view with their end-to-end latency, taken from the detection
+    time on the server clock when the scanner has a clock estimate. The
+    answer carries commands and a clock sample but no scan timing, since
+    the message was not a scheduled report.
+    """
+    scanner_id = data.get("scanner_id")
+    events = data.get("urgent")
+    if not scanner_id or not isinstance(events, list):
+        return {"status": "error", "message": "Malformed urgent events"}, 400
+    if captured_ms is not None:
+        return {"status": "stored", "reports": 0}, 200  # Stale by now; nothing to store
+
+    if scanner_id not in devices_data:
+        devices_data[scanner_id] = {"beacons_observed": {}, "movement": {}}
+    received = datetime.utcnow().isoformat() + "Z"
+    kept = devices_data[scanner_id].setdefault("urgent_events", [])
+    for event in events:
+        if not isinstance(event, dict):
+            continue
+        event["received"] = received
+        if isinstance(event.get("at"), int):
+            event["latency_ms"] = received_ms - event["at"]
+        print(f"Urgent {event.get('kind')} on {scanner_id}: {event.get('name') or ''} {event.get('value')}, "
+              f"latency {event.get('latency_ms', 'unknown')} ms ({event.get('ago')} ms queued on the scanner)")
+        kept.append(event)
+    del kept[:-MAX_URGENT_EVENTS_KEPT]
+
+    control_payload = {}
+    add_commands(control_payload, scanner_id, data, received_ms)
+    return control_payload, 200
+
+def apply_beacons(observed, report):
+    """
+    Updates a scanner's live beacon list from one report. A full report
+    (keyframe) replaces the list. A delta report only carries the beacons
+    that appeared or changed, and the names of those that are gone.
+    """
+    beacons_payload = report.get("beacons")
+    if not report.get("delta"):
+        observed.clear()
+    for beacon_name in report.get("gone") or []:
+        observed.pop(beacon_name, None)
+
     # Standardize beacons payload
-    devices_data[scanner_id]["beacons_observed"].clear()
     if isinstance(beacons_payload, dict): # From simulation
         for beacon_key, beacon_info in beacons_payload.items():
             rssi = beacon_info.get("RSSI")
             if rssi is not None:
-                devices_data[scanner_id]["beacons_observed"][beacon_key] = {
+                observed[beacon_key] = {
                     "rssi": rssi,
                     "beacon_name": beacon_info.get("Beacon name", beacon_key),
                     "distance": RSSI_to_distance(rssi)
@@ -118,37 +392,329 @@ def receive_data():
             rssi = beacon_info.get("rssi")
             beacon_name = beacon_info.get("name")
             if rssi is not None and beacon_name is not None:
-                devices_data[scanner_id]["beacons_observed"][beacon_name] = {
+                observed[beacon_name] = {
                     "rssi": rssi,
                     "beacon_name": beacon_name,
                     "distance": RSSI_to_distance(rssi)
                 }
 
-    with time_lock:
-        current_time_ms = int(time.time() * 1000)
-        
-        if next_slot_time_ms < current_time_ms:
-            slots_passed = current_time_ms // (SCAN_INTERVAL_SECONDS * 1000)
-            next_slot_time_ms = (slots_passed + 1) * (SCAN_INTERVAL_SECONDS * 1000)
-
-        wait_ms = next_slot_time_ms - current_time_ms
-        next_slot_time_ms += SCAN_INTERVAL_SECONDS * 1000
+def acknowledge_command(scanner_id, seq):
+    """Drops the scanner's pending command once it has applied it."""
+    with config_lock:
+        pending = device_configs.get(scanner_id)
+        if pending and seq >= pending['cmd_seq']:
+            del device_configs[scanner_id]
 
-    control_payload = {
-        "wait_ms": wait_ms
-    }
 
-    # If a configuration exists for this device, send it once and then remove it.
-    if scanner_id in device_configs:
-        config_to_send = device_configs.pop(scanner_id)
-        if 'led_behavior' in config_to_send:
-            control_payload['led_behavior'] = config_to_send['led_behavior']
-        if 'vibration_behavior' in config_to_send:
-            control_payload['vibration_behavior'] = config_to_send['vibration_behavior']
 
-    return jsonify(control_payload), 200
+def store_report(data, timestamp):
+    """
+    Adds a report's movement and RSSI rows to the session, without
+    committing. A delta report only has rows for the beacons that changed;
+    the others keep their last stored value.
+    """
+    scanner_id = data.get("scanner_id") or data.get("Scanner name")
+    beacons_payload = data.get("beacons")
+    movement_payload = data.get("movement")
 
+    scanner = Scanner.query.filter_by(name=scanner_id).first()
+    if not scanner:
+        scanner = Scanner(name=scanner_id)
+        db.session.add(scanner)
+        db.session.flush()
 
+    # Only store dict-based movement payloads in the DB
+    if isinstance(movement_payload, dict):
+        avg_angle_xz = movement_payload.get('avgAngleXZ')
+        avg_angle_yz = movement_payload.get('avgAngleYZ')
+        total_movement = movement_payload.get('totalMovement')
+        if avg_angle_xz is not None and avg_angle_yz is not None and total_movement is not None:
+            movement_record = ScannerMovement(
+                avg_angle_xz=avg_angle_xz,
+                avg_angle_yz=avg_angle_yz,
+                total_movement=total_movement,
+                timestamp=timestamp,
+                scanner_id=scanner.id
+            )
+            db.session.add(movement_record)
+
+    # Only store list-based beacon payloads in the DB
+    if isinstance(beacons_payload, list):
+        for beacon_info in beacons_payload:
+            rssi = beacon_info.get("rssi")
+            beacon_name = beacon_info.get("name")
+            if rssi is not None and beacon_name is not None:
+                beacon = get_or_create_beacon(beacon_name)
+                rssi_record = RssiValue(rssi=rssi, timestamp=timestamp, scanner_id=scanner.id, beacon_id=beacon.id)
+                db.session.add(rssi_record)
+
+        # latest_beacons() rebuilds the full list from the last keyframe on
+        if data.get("delta"):
+            for beacon_name in data.get("gone") or []:
+                beacon = get_or_create_beacon(beacon_name)
+                db.session.add(BeaconGone(timestamp=timestamp, scanner_id=scanner.id, beacon_id=beacon.id))
+        else:
+            db.session.add(ReportKeyframe(timestamp=timestamp, scanner_id=scanner.id))
+
+def get_or_create_beacon(beacon_name):
+    beacon = Beacon.query.filter_by(name=beacon_name).first()
+    if not beacon:
+        beacon = Beacon(name=beacon_name)
+        db.session.add(beacon)
+        db.session.flush()
+    return beacon
+
+def latest_beacons(scanner):
+    """
+    The beacons a scanner saw in its latest report, as ({beacon name: rssi},
+    time of the latest RSSI row). Rebuilt from its last keyframe, then the
+    changes and departures of the delta reports after it.
+    """
+    latest_rssi_timestamp = db.session.query(func.max(RssiValue.timestamp)).filter_by(scanner_id=scanner.id).scalar()
+    keyframe_timestamp = db.session.query(func.max(ReportKeyframe.timestamp)).filter_by(scanner_id=scanner.id).scalar()
+    if latest_rssi_timestamp is None:
+        return {}, None
+    if keyframe_timestamp is None:
+        # Stored before keyframes were recorded: every report was complete
+        keyframe_timestamp = latest_rssi_timestamp
+
+    rows = RssiValue.query.filter(RssiValue.scanner_id == scanner.id,
+                                  RssiValue.timestamp >= keyframe_timestamp).all()
+    departures = BeaconGone.query.filter(BeaconGone.scanner_id == scanner.id,
+                                         BeaconGone.timestamp >= keyframe_timestamp).all()
+    changes = [(row.timestamp, row.beacon_id, row.rssi) for row in rows]
+    changes += [(gone.timestamp, gone.beacon_id, None) for gone in departures]
+    changes.sort(key=lambda change: change[0])
+
+    state = {}
+    for _, beacon_id, rssi in changes:
+        if rssi is None:
+            state.pop(beacon_id, None)
+        else:
+            state[beacon_id] = rssi
+    names = {beacon.id: beacon.name for beacon in Beacon.query.filter(Beacon.id.in_(state)).all()}
+    return {names[beacon_id]: rssi for beacon_id, rssi in state.items() if beacon_id in names}, latest_rssi_timestamp
+
+def presets_to_upload(device_versions, required_preset=None):
+    """
+    Returns the presets a scanner is missing or holds an old version of,
+    given the [[id, version], ...] list from its report. A preset needed by
+    the command in this response always goes first; the rest trickle out a
+    few per response.
+    """
+    if device_versions is None:
+        return []
+    held = {entry[0]: entry[1] for entry in device_versions if len(entry) == 2}
+    stale = [pid for pid, preset in presets.items() if held.get(pid) != preset["version"]]
+    stale.sort(key=lambda pid: pid != required_preset)
+
+    uploads = []
+    for pid in stale:
+        if len(uploads) >= MAX_PRESET_UPLOADS_PER_RESPONSE and pid != required_preset:
+            break
+        uploads.append({"id": pid, "version": presets[pid]["version"], "body": presets[pid]["body"]})
+    return uploads
+
+@main_bp.route('/presets', methods=['GET'])
+def get_presets():
+    return jsonify(presets)
+
+@main_bp.route('/presets/<int:preset_id>', methods=['POST'])
+def set_preset(preset_id):
+    """
+    Creates or replaces a behavior preset. Scanners receive it with one of
+    their next /data responses; later commands refer to it by id.
+    """
+    data = request.json
+    body = {key: data[key] for key in ('led_behavior', 'vibration_behavior') if data.get(key)}
+    if not body or not 0 <= preset_id <= 255:
+        return jsonify({"status": "error", "message": "Preset id must be 0-255 and a behavior is required"}), 400
+    try:
+        check_waveform(body.get('vibration_behavior'))
+    except (IndexError, TypeError, ValueError) as e:
+        return jsonify({"status": "error", "message": f"Invalid waveform: {e}"}), 400
+
+    version = presets[preset_id]["version"] + 1 if preset_id in presets else 1
+    presets[preset_id] = {"version": version, "body": body}
+    return jsonify({"status": "success", "id": preset_id, "version": version}), 200
+
+def check_waveform(vibration_behavior):
+    """
+    Raises ValueError if a Waveform vibration behavior would not fit the
+    scanners' waveform tables. Other behavior types pass unchecked.
+    """
+    if not vibration_behavior or vibration_behavior.get("type") != "Waveform":
+        return
+    steps = (vibration_behavior.get("params") or {}).get("steps")
+    if steps is None:
+        return
+    if not isinstance(steps, list) or not 0 < len(steps) <= HAPTIC_MAX_STEPS:
+        raise ValueError(f"Expected 1 to {HAPTIC_MAX_STEPS} steps")
+    for step in steps:
+        intensity, duration = int(step[0]), int(step[1])
+        ramp = int(step[2]) if len(step) > 2 else 0
+        if not 0 <= intensity <= 255 or not 0 <= duration <= HAPTIC_MAX_STEP_MS \
+                or not 0 <= ramp <= HAPTIC_MAX_STEP_MS:
+            raise ValueError(f"Step {step}: intensity must be 0..255, duration and ramp 0..{HAPTIC_MAX_STEP_MS} ms")
+
+def compile_rules(rules):
+    """
+    Compiles rule dicts into the scanners' rule bytecode: five bytes per
+    rule, [beacon index, op, rssi threshold, intervals, preset id], with the
+    beacon names in a separate list. Raises ValueError on a bad rule.
+    """
+    beacons = []
+    code = bytearray()
+    for rule in rules:
+        op = RULE_OPS.get(rule.get("when"))
+        if op is None:
+            raise ValueError(f"Unknown condition {rule.get('when')!r}, expected one of {list(RULE_OPS)}")
+
+        beacon = rule.get("beacon", "*")
+        if beacon == "*":
+            beacon_index = RULE_ANY_BEACON
+        else:
+            if beacon not in beacons:
+                beacons.append(beacon)
+            beacon_index = beacons.index(beacon)
+
+        rssi = int(rule.get("rssi", 0))
+        intervals = int(rule.get("intervals", 1))
+        preset = int(rule["preset"])
+        if not -128 <= rssi <= 127 or not 1 <= intervals <= 255 or not 0 <= preset <= 255:
+            raise ValueError("rssi must be -128..127, intervals 1..255 and preset 0..255")
+        code += bytes([beacon_index, op, rssi & 0xFF, intervals, preset])
+
+    if len(rules) > MAX_RULES or len(beacons) > MAX_RULE_BEACONS:
+        raise ValueError(f"At most {MAX_RULES} rules over {MAX_RULE_BEACONS} beacons")
+    return beacons, code.hex()
+
+@main_bp.route('/rules', methods=['GET'])
+def get_rules():
+    return jsonify(rule_set)
+
+@main_bp.route('/rules', methods=['POST'])
+def set_rules():
+    """
+    Replaces the proximity rule set. Each scanner picks up the new version
+    with its next report and from then on reacts locally, e.g.
+    {"beacon": "HitloopBeacon_A", "when": "rssi_above", "rssi": -60, "intervals": 2, "preset": 3}.
+    """
+    rules = (request.json or {}).get("rules")
+    if not isinstance(rules, list):
+        return jsonify({"status": "error", "message": "Expected a list of rules"}), 400
+    try:
+        beacons, code = compile_rules(rules)
+    except (KeyError, TypeError, ValueError) as e:
+        return jsonify({"status": "error", "message": f"Invalid rule: {e}"}), 400
+
+    rule_set.update(version=rule_set["version"] + 1, beacons=beacons, code=code, rules=rules)
+    return jsonify({"status": "success", "version": rule_set["version"], "code": code}), 200
+
+@main_bp.route('/params', methods=['GET'])
+def get_params():
+    return jsonify(param_set)
+
+@main_bp.route('/params', methods=['POST'])
+def set_params():
+    """
+    Replaces the scanners' runtime parameters, e.g.
+    {"values": {"scan_interval_ms": 5000, "led_brightness": 64}}. Each scanner
+    picks up the new version with its next report and checks the bounds itself.
+    """
+    values = (request.json or {}).get("values")
+    if not isinstance(values, dict):
+        return jsonify({"status": "error", "message": "Expected an object of values"}), 400
+    for name, value in values.items():
+        if name not in PARAM_NAMES:
+            return jsonify({"status": "error", "message": f"Unknown parameter {name}"}), 400
+        if not isinstance(value, int):
+            return jsonify({"status": "error", "message": f"{name} must be an integer"}), 400
+
+    param_set.update(version=param_set["version"] % 0xFFFF + 1, values=values)
+    return jsonify({"status": "success", "version": param_set["version"]}), 200
+
+def firmware_offer(running_version):
+    """The update for a scanner running `running_version`, or None."""
+    target = firmware_target
+    if running_version is None or not target["offer"] or running_version == target["version"]:
+        return None
+    offer = dict(target["offer"])
+    patch_size = target["patches"].get(running_version)
+    if patch_size:
+        offer["patch"] = {"url": f"/firmware/{running_version}/{target['version']}.patch", "size": patch_size}
+    return offer
+
+def build_patches(directory, version, patches):
+    """Builds patches to `version` from every other stored image, newest first."""
+    for old in reversed(firmware.list_versions(directory)):
+        if old == version:
+            continue
+        size = firmware.build_patch(directory, old, version)
+        # A patch that saves little is not worth reading back the old image
+        if size is not None and size < firmware.image_info(directory, version)["size"] * 0.8:
+            patches[old] = size
+        print(f"Firmware patch {old} -> {version}: {size} bytes")
+
+@main_bp.route('/firmware', methods=['GET'])
+def get_firmware():
+    directory = current_app.config['FIRMWARE_DIR']
+    versions = [firmware.image_info(directory, version) for version in firmware.list_versions(directory)]
+    return jsonify({"target": firmware_target["version"], "patches": firmware_target["patches"],
+                    "images": [info for info in versions if info]})
+
+@main_bp.route('/firmware/<int:version>', methods=['POST'])
+def upload_firmware(version):
+    """
+    Stores a firmware image, the raw .bin of a build with this FIRMWARE_VERSION:
+    curl --data-binary @Scanner.ino.bin -H "Content-Type: application/octet-stream" .../firmware/4
+    """
+    if version <= 0 or version == firmware_target["version"]:
+        return jsonify({"status": "error", "message": "Invalid version, or the current target"}), 400
+    try:
+        firmware.save_image(current_app.config['FIRMWARE_DIR'], version, request.get_data())
+    except ValueError as e:
+        return jsonify({"status": "error", "message": str(e)}), 400
+    firmware_target["patches"].pop(version, None)  # Its patch was removed with the old image
+    return jsonify({"status": "success", **firmware.image_info(current_app.config['FIRMWARE_DIR'], version)}), 200
+
+@main_bp.route('/firmware/target', methods=['POST'])
+def set_firmware_target():
+    """
+    Offers a stored image to the scanners, {"version": 4}; version 0 stops
+    offering updates. Scanners download it between scans, restart into it
+    and go back to their previous image if it cannot deliver a report.
+    """
+    version = (request.json or {}).get("version")
+    if not isinstance(version, int) or version < 0:
+        return jsonify({"status": "error", "message": "Expected a version"}), 400
+    if version == 0:
+        firmware_target.update(version=0, offer=None, patches={})
+        return jsonify({"status": "success", "version": 0}), 200
+
+    directory = current_app.config['FIRMWARE_DIR']
+    info = firmware.image_info(directory, version)
+    if info is None:
+        return jsonify({"status": "error", "message": f"No image for version {version}"}), 404
+    patches = {}
+    firmware_target.update(version=version, patches=patches,
+                           offer={**info, "url": f"/firmware/{version}.bin"})
+    Thread(target=build_patches, args=(directory, version, patches), daemon=True).start()
+    return jsonify({"status": "success", **info}), 200
+
+@main_bp.route('/firmware/<int:version>.bin', methods=['GET'])
+def download_firmware(version):
+    path = firmware.image_path(current_app.config['FIRMWARE_DIR'], version)
+    if not os.path.exists(path):
+        return jsonify({"status": "error", "message": "No such image"}), 404
+    return send_file(path, mimetype='application/octet-stream')
+
+@main_bp.route('/firmware/<int:old>/<int:new>.patch', methods=['GET'])
+def download_firmware_patch(old, new):
+    path = firmware.patch_path(current_app.config['FIRMWARE_DIR'], old, new)
+    if not os.path.exists(path):
+        return jsonify({"status": "error", "message": "No such patch"}), 404
+    return send_file(path, mimetype='application/octet-stream')
 
 @main_bp.route('/control')
 def control_page():
@@ -166,24 +732,84 @@ def configure_scanner(scanner_id):
     data = request.json
     led_behavior = data.get('led_behavior')
     vibration_behavior = data.get('vibration_behavior')
+    preset = data.get('preset')
 
-    if not led_behavior and not vibration_behavior:
+    if not led_behavior and not vibration_behavior and not preset:
         return jsonify({"status": "error", "message": "No configuration data provided"}), 400
+    try:
+        check_waveform(vibration_behavior)
+    except (IndexError, TypeError, ValueError) as e:
+        return jsonify({"status": "error", "message": f"Invalid waveform: {e}"}), 400
 
-    if scanner_id not in device_configs:
-        device_configs[scanner_id] = {}
-
-    if led_behavior:
-        device_configs[scanner_id]['led_behavior'] = led_behavior
-    if vibration_behavior:
-        device_configs[scanner_id]['vibration_behavior'] = vibration_behavior
+    store_device_config(scanner_id, led_behavior, vibration_behavior, preset)
 
     return jsonify({
         "status": "success",
         "message": f"Configuration for {scanner_id} updated.",
-        "new_config": device_configs[scanner_id]
+        "new_config": device_configs.get(scanner_id, {}),
+        "streamed": stream.is_connected(scanner_id)
+    }), 200
+
+@main_bp.route('/configure_group', methods=['POST'])
+def configure_group():
+    """
+    Sets the same LED and/or vibration behavior for several scanners.
+    With "sync": true, all of them start it at one shared server time.
+    """
+    data = request.json
+    scanner_ids = data.get('scanner_ids') or []
+    led_behavior = data.get('led_behavior')
+    vibration_behavior = data.get('vibration_behavior')
+    preset = data.get('preset')
+
+    if not scanner_ids or (not led_behavior and not vibration_behavior and not preset):
+        return jsonify({"status": "error", "message": "No scanners or configuration data provided"}), 400
+    try:
+        check_waveform(vibration_behavior)
+    except (IndexError, TypeError, ValueError) as e:
+        return jsonify({"status": "error", "message": f"Invalid waveform: {e}"}), 400
+
+    start_at = None
+    if data.get('sync'):
+        start_at = now_ms() + SYNC_LEAD_MS
+        if led_behavior:
+            led_behavior = {**led_behavior, 'at': start_at}
+        if vibration_behavior:
+            vibration_behavior = {**vibration_behavior, 'at': start_at}
+        if preset:
+            preset = {**preset, 'at': start_at}
+
+    for scanner_id in scanner_ids:
+        store_device_config(scanner_id, led_behavior, vibration_behavior, preset)
+
+    return jsonify({
+        "status": "success",
+        "message": f"Configuration for {len(scanner_ids)} scanners updated.",
+        "start_at": start_at
     }), 200
 
+def store_device_config(scanner_id, led_behavior, vibration_behavior, preset=None):
+    """
+    Queues behaviors for the scanner. A scanner with an open stream, or one
+    on MQTT, gets them right away; otherwise they ride on its next /data
+    response.
+    """
+    global next_command_seq
+    with config_lock:
+        config = device_configs.setdefault(scanner_id, {})
+        if led_behavior:
+            config['led_behavior'] = led_behavior
+        if vibration_behavior:
+            config['vibration_behavior'] = vibration_behavior
+        if preset:
+            config['preset'] = preset
+        config['cmd_seq'] = next_command_seq
+        next_command_seq += 1
+        command = dict(config)
+
+    if not stream.push_command(scanner_id, command):
+        mqtt.push_command(scanner_id, command)
+
 @main_bp.route('/devices', methods=['GET'])
 def get_all_devices():
     """
@@ -208,7 +834,7 @@ def get_all_devices():
             "beacons_observed": {}
         }
         latest_movement = ScannerMovement.query.filter_by(scanner_id=scanner.id).order_by(ScannerMovement.timestamp.desc()).first()
-        latest_rssi_timestamp = db.session.query(func.max(RssiValue.timestamp)).filter_by(scanner_id=scanner.id).scalar()
+        beacons_seen, latest_rssi_timestamp = latest_beacons(scanner)
 
         if latest_movement:
             scanner_data["movement"] = {
@@ -216,16 +842,12 @@ def get_all_devices():
                 "avgAngleYZ": latest_movement.avg_angle_yz,
                 "totalMovement": latest_movement.total_movement,
             }
-        if latest_rssi_timestamp:
-            latest_rssi_records = RssiValue.query.filter_by(scanner_id=scanner.id, timestamp=latest_rssi_timestamp).all()
-            for record in latest_rssi_records:
-                beacon = Beacon.query.get(record.beacon_id)
-                if beacon:
-                    scanner_data["beacons_observed"][beacon.name] = {
-                        "rssi": record.rssi,
-                        "beacon_name": beacon.name,
-                        "distance": RSSI_to_distance(record.rssi),
-                    }
+        for beacon_name, rssi in beacons_seen.items():
+            scanner_data["beacons_observed"][beacon_name] = {
+                "rssi": rssi,
+                "beacon_name": beacon_name,
+                "distance": RSSI_to_distance(rssi),
+            }
         
         last_update_time = max(
             latest_movement.timestamp if latest_movement else datetime.min,
@@ -274,8 +896,8 @@ def get_all_scanners():
         # Get latest movement for this scanner
         latest_movement = ScannerMovement.query.filter_by(scanner_id=scanner.id).order_by(ScannerMovement.timestamp.desc()).first()
 
-        # Get the timestamp of the last RSSI update for this scanner
-        latest_rssi_timestamp = db.session.query(func.max(RssiValue.timestamp)).filter_by(scanner_id=scanner.id).scalar()
+        # The beacons of its latest report, and when that was
+        beacons_seen, latest_rssi_timestamp = latest_beacons(scanner)
 
         if latest_movement:
             scanner_data["movement"] = {
@@ -284,19 +906,12 @@ def get_all_scanners():
                 "totalMovement": latest_movement.total_movement,
             }
 
-        if latest_rssi_timestamp:
-            # Get all records from the latest beacon update for this scanner
-            latest_rssi_records = RssiValue.query.filter_by(
-                scanner_id=scanner.id, timestamp=latest_rssi_timestamp
-            ).all()
-            for record in latest_rssi_records:
-                beacon = Beacon.query.get(record.beacon_id)
-                if beacon:
-                    scanner_data["beacons_observed"][beacon.name] = {
-                        "rssi": record.rssi,
-                        "beacon_name": beacon.name,
-                        "distance": RSSI_to_distance(record.rssi),
-                    }
+        for beacon_name, rssi in beacons_seen.items():
+            scanner_data["beacons_observed"][beacon_name] = {
+                "rssi": rssi,
+                "beacon_name": beacon_name,
+                "distance": RSSI_to_distance(rssi),
+            }
 
         # Determine the most recent timestamp for this scanner's activity
         last_update_time = None
@@ -322,6 +937,7 @@ def configure_device_page():
 def reset_devices_data():
     global devices_data, device_configs
     devices_data.clear()
-    device_configs.clear()
+    with config_lock:
+        device_configs.clear()
     print("All device data and configurations have been cleared.")
     return jsonify({"status": "success", "message": "All device data and configurations cleared."}), 200 
\ No newline at end of file
@@ -51,21 +51,19 @@ async function configureScanners(scannerIds, config) {
         return;
     }
 
-    const requests = Array.from(scannerIds).map(id => {
-        return fetch(`/configure/${id}`, {
+    // One request for the whole selection, so the server can give every
+    // scanner the same start time and the effect starts in sync.
+    const body = { ...config, scanner_ids: Array.from(scannerIds), sync: scannerIds.size > 1 };
+
+    try {
+        const res = await fetch('/configure_group', {
             method: 'POST',
             headers: {
                 'Content-Type': 'application/json',
             },
-            body: JSON.stringify(config),
-        });
-    });
-
-    try {
-        const responses = await Promise.all(requests);
-        responses.forEach(res => {
-            if (!res.ok) console.error(`Failed to configure a scanner: ${res.status}`);
+            body: JSON.stringify(body),
         });
+        if (!res.ok) console.error(`Failed to configure scanners: ${res.status}`);
         console.log(`Configuration sent to ${scannerIds.size} scanners.`);
         // Optionally clear selection after successful configuration
         selectedScanners.clear();
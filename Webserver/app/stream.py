@@ -0,0 +1,137 @@
+"""
+Persistent TCP transport for scanners. Instead of one POST per report, a
+scanner keeps a socket open; reports stream up and the server pushes
+commands down as soon as they are configured. The HTTP endpoints stay the
+fallback.
+
+Every message is a frame: type:u8 length:u16 (little-endian) payload.
+
+    HELLO    scanner -> server  scanner id (utf-8)
+    REPORT   scanner -> server  format:u8 captured_at:i64 body
+                                (format 0 = JSON, 1 = binary report, 2 = binary
+                                batch; captured_at 0 for live reports)
+    RESPONSE server -> scanner  status:u16 (HTTP status) JSON, the same as the
+                                /data response
+    COMMAND  server -> scanner  JSON with led_behavior / vibration_behavior /
+                                preset and cmd_seq
+    ACK      scanner -> server  cmd_seq:u32 of an applied command
+"""
+import json
+import socketserver
+import struct
+import threading
+
+FRAME_HELLO = 1
+FRAME_REPORT = 2
+FRAME_RESPONSE = 3
+FRAME_COMMAND = 4
+FRAME_ACK = 5
+
+_FRAME = struct.Struct("<BH")
+_REPORT = struct.Struct("<Bq")
+MAX_FRAME = 0xFFFF
+
+# Open connections by scanner id
+_connections = {}
+_connections_lock = threading.Lock()
+_server = None
+_server_lock = threading.Lock()
+
+
+class StreamConnection:
+    def __init__(self, sock, scanner_id):
+        self.sock = sock
+        self.scanner_id = scanner_id
+        self.send_lock = threading.Lock()
+
+    def send(self, frame_type, payload):
+        if len(payload) > MAX_FRAME:
+            raise ValueError("Frame too large")
+        with self.send_lock:
+            self.sock.sendall(_FRAME.pack(frame_type, len(payload)) + payload)
+
+
+def _read_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("Stream closed")
+        data += chunk
+    return data
+
+
+def _read_frame(sock):
+    frame_type, length = _FRAME.unpack(_read_exact(sock, _FRAME.size))
+    return frame_type, _read_exact(sock, length)
+
+
+class _StreamHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        server = self.server
+        frame_type, payload = _read_frame(self.request)
+        if frame_type != FRAME_HELLO:
+            return
+        connection = StreamConnection(self.request, payload.decode("utf-8", "replace"))
+        with _connections_lock:
+            _connections[connection.scanner_id] = connection
+        print(f"Stream opened by {connection.scanner_id}")
+
+        try:
+            while True:
+                frame_type, payload = _read_frame(self.request)
+                if frame_type == FRAME_REPORT:
+                    fmt, captured_at = _REPORT.unpack_from(payload)
+                    with server.app.app_context():
+                        response, status = server.on_report(fmt, payload[_REPORT.size:], captured_at or None)
+                    connection.send(FRAME_RESPONSE, struct.pack("<H", status) + json.dumps(response).encode())
+                elif frame_type == FRAME_ACK:
+                    server.on_ack(connection.scanner_id, struct.unpack("<I", payload)[0])
+        except (ConnectionError, OSError, struct.error):
+            pass
+        finally:
+            with _connections_lock:
+                if _connections.get(connection.scanner_id) is connection:
+                    del _connections[connection.scanner_id]
+            print(f"Stream closed by {connection.scanner_id}")
+
+
+class _StreamServer(socketserver.ThreadingTCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+
+def start(app, port, on_report, on_ack):
+    """
+    Starts the stream listener once per process. on_report(format, body,
+    captured_at_ms) returns (response dict, status); on_ack(scanner_id, seq)
+    is called for each acknowledged command.
+    """
+    global _server
+    with _server_lock:
+        if _server is not None or not port:
+            return
+        _server = _StreamServer(("0.0.0.0", port), _StreamHandler)
+        _server.app = app
+        _server.on_report = on_report
+        _server.on_ack = on_ack
+        threading.Thread(target=_server.serve_forever, daemon=True).start()
+        print(f"Scanner stream listening on port {port}")
+
+
+def push_command(scanner_id, command):
+    """Sends a command over the scanner's stream. Returns False if it has none."""
+    with _connections_lock:
+        connection = _connections.get(scanner_id)
+    if connection is None:
+        return False
+    try:
+        connection.send(FRAME_COMMAND, json.dumps(command).encode())
+        return True
+    except (OSError, ValueError):
+        return False
+
+
+def is_connected(scanner_id):
+    with _connections_lock:
+        return scanner_id in _connections
@@ -9,4 +9,16 @@ class Config:
     # Database
     SQLALCHEMY_DATABASE_URI = os.environ.get('DATABASE_URL') or \
         'sqlite:///' + os.path.join(basedir, 'hitloop.db')
-    SQLALCHEMY_TRACK_MODIFICATIONS = False 
\ No newline at end of file
+    SQLALCHEMY_TRACK_MODIFICATIONS = False
+
+    # TCP port for scanner streams (see app/stream.py); 0 disables them
+    STREAM_PORT = int(os.environ.get('STREAM_PORT', 5001))
+
+    # MQTT broker for scanners built with UPLINK_MQTT (see app/mqtt.py); unset
+    # disables MQTT ingest. Servers in the same share group split the reports.
+    MQTT_HOST = os.environ.get('MQTT_HOST', '')
+    MQTT_PORT = int(os.environ.get('MQTT_PORT', 1883))
+    MQTT_SHARE_GROUP = os.environ.get('MQTT_SHARE_GROUP', 'hitloop') 
+
+    # Firmware images for over-the-air updates (see app/firmware.py)
+    FIRMWARE_DIR = os.environ.get('FIRMWARE_DIR') or os.path.join(basedir, 'firmware')
@@ -1,9 +1,15 @@
+import os
 from app import create_app
 
+if __name__ == '__main__':
+    # Debug mode with the reloader. Set before the app is created, which
+    # starts the scanner transports only in the reloader's child process.
+    os.environ.setdefault('FLASK_DEBUG', '1')
+
 # The application factory function is called to create an application instance
 app = create_app()
 
 if __name__ == '__main__':
     # The development server is run.
     # In production, a proper WSGI server like Gunicorn or uWSGI should be used.
-    app.run(host='0.0.0.0', port=5000, debug=True) 
\ No newline at end of file
+    app.run(host='0.0.0.0', port=5000)
@@ -0,0 +1,97 @@
+#ifndef BEACON_TABLE_H
+#define BEACON_TABLE_H
+
+#include <Arduino.h>
+#include <BLEScan.h>
+#include <BLEAdvertisedDevice.h>
+#include "config.h"
+
+#define BEACON_TABLE_SIZE 24
+#define BEACON_NAME_LEN 24
+#define BEACON_FORGET_INTERVALS 6 // Drop a beacon after this many scans without it
+
+// The beacons this scanner currently sees, with an RSSI smoothed over
+// scan intervals. Fixed size, so it can be updated on every scan without
+// touching the heap.
+class BeaconTable {
+public:
+    struct Entry {
+        char name[BEACON_NAME_LEN];
+        int16_t filtered;   // RSSI in 1/16 dBm, exponential moving average
+        int8_t lastRssi;
+        uint8_t missed;     // Consecutive scans without this beacon, 0 = seen in the last one
+        bool arrived;       // Seen in the last scan, but not in the one before
+        bool used;
+        bool reported;      // Listed as present in the server's state (delta reports)
+        int16_t reportedRssi; // Filtered RSSI when last reported, 1/16 dBm
+    };
+
+    void update(BLEScanResults& results) {
+        for (Entry& e : entries) {
+            if (e.used && ++e.missed > BEACON_FORGET_INTERVALS) e.used = false;
+            e.arrived = false;
+        }
+        full = false;
+
+        BLEUUID serviceUUID(BEACON_SERVICE_UUID);
+        for (int i = 0; i < results.getCount(); i++) {
+            BLEAdvertisedDevice device = results.getDevice(i);
+            if (!device.isAdvertisingService(serviceUUID)) continue;
+
+            // Same name as in the report: advertised name, else the address
+            std::string name = device.haveName() ? device.getName() : device.getAddress().toString();
+            Entry* e = findOrAdd(name.c_str());
+            if (!e) {
+                full = true;
+                continue;
+            }
+
+            int rssi = device.getRSSI();
+            bool fresh = e->missed > 1;
+            e->lastRssi = rssi;
+            e->arrived = fresh;
+            e->missed = 0;
+            // alpha = 1/4; a beacon that was away starts over from its new reading
+            e->filtered = fresh ? rssi * 16 : e->filtered + (rssi * 16 - e->filtered) / 4;
+        }
+    }
+
+    const Entry* find(const char* name) const {
+        for (const Entry& e : entries) {
+            if (e.used && strncmp(e.name, name, BEACON_NAME_LEN) == 0) return &e;
+        }
+        return nullptr;
+    }
+
+    // The last scan had beacons there was no room for; they are missing here
+    bool overflowed() const { return full; }
+
+    static bool seen(const Entry& e) { return e.used && e.missed == 0; }
+    static int filteredRssi(const Entry& e) { return e.filtered / 16; }
+
+    const Entry* begin() const { return entries; }
+    const Entry* end() const { return entries + BEACON_TABLE_SIZE; }
+    Entry* begin() { return entries; }
+    Entry* end() { return entries + BEACON_TABLE_SIZE; }
+
+private:
+    Entry* findOrAdd(const char* name) {
+        Entry* free = nullptr;
+        for (Entry& e : entries) {
+            if (e.used && strncmp(e.name, name, BEACON_NAME_LEN) == 0) return &e;
+            if (!e.used && !free) free = &e;
+        }
+        if (!free) return nullptr;
+        strncpy(free->name, name, BEACON_NAME_LEN - 1);
+        free->name[BEACON_NAME_LEN - 1] = '\0';
+        free->missed = 0xFF; // Marks the first reading
+        free->used = true;
+        free->reported = false;
+        return free;
+    }
+
+    Entry entries[BEACON_TABLE_SIZE] = {};
+    bool full = false;
+};
+
+#endif // BEACON_TABLE_H
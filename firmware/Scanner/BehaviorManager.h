@@ -2,8 +2,6 @@
 #define BEHAVIOR_MANAGER_H
 
 #include <ArduinoJson.h>
-#include <map>
-#include <string>
 #include "Process.h"
 #include "LedManager.h"
 #include "VibrationManager.h"
@@ -11,6 +9,12 @@
 #include "LedBehaviors.h"
 #include "VibrationBehaviors.h"
 #include "Utils.h"
+#include "JsonArena.h"
+#include "ClockSync.h"
+#include "PresetStore.h"
+#include "RuleEngine.h"
+#include "Params.h"
+#include "OtaManager.h"
 
 class BehaviorManager : public Process {
 private:
@@ -21,22 +25,16 @@ private:
     ServerConnectionState serverState;
 
 public:
-    BehaviorManager(LedManager* led, VibrationManager* vib) 
-        : ledManager(led), vibrationManager(vib),
+    BehaviorManager(LedManager* led, VibrationManager* vib, PresetStore& presetStore, RuleEngine& ruleEngine, ClockSync& clockSync,
+                    Params& parameters, OtaManager& otaManager)
+        : ledManager(led), vibrationManager(vib), clock(clockSync), presets(presetStore), rules(ruleEngine), params(parameters),
+          ota(otaManager),
           serverState(SERVER_CONNECTED),
-          ledsOff(), solid(), breathing(0), heartBeat(), cycle(0,0),
-          motorOff(), constant(0), burst(0,0), pulse(0,0)
+          ledsOff(), solid(), breathing(0), heartBeat(), cycle(0,0), timeline(),
+          statusBreathing(0), statusBeat(), alertTimeline(),
+          motorOff(), constant(0), burst(0,0), pulse(0,0), waveform(),
+          filter(&arena)
     {
-        ledBehaviorMap["Off"] = &ledsOff;
-        ledBehaviorMap["Solid"] = &solid;
-        ledBehaviorMap["Breathing"] = &breathing;
-        ledBehaviorMap["HeartBeat"] = &heartBeat;
-        ledBehaviorMap["Cycle"] = &cycle;
-
-        vibrationBehaviorMap["Off"] = &motorOff;
-        vibrationBehaviorMap["Constant"] = &constant;
-        vibrationBehaviorMap["Burst"] = &burst;
-        vibrationBehaviorMap["Pulse"] = &pulse;
     }
 
     void setup(EventManager* em) override {
@@ -44,9 +42,23 @@ public:
         eventManager->subscribe(EVT_HTTP_RESPONSE_RECEIVED, this);
         eventManager->subscribe(EVT_WIFI_CONNECTED, this);
         eventManager->subscribe(EVT_SERVER_DISCONNECTED, this);
+        eventManager->subscribe(EVT_RULE_FIRED, this);
+        presets.load();
+
+        // Everything else in a response is dropped while parsing
+        filter["clock"] = true;
+        filter["presets"] = true;
+        filter["rules"] = true;
+        filter["params"] = true;
+        filter["ota"] = true;
+        filter["cmd_seq"] = true;
+        filter["preset"] = true;
+        filter["led_behavior"] = true;
+        filter["vibration_behavior"] = true;
         
-        breathing.color = 0xFF0000; // Red
-        ledManager->setBehavior(&breathing);
+        statusBreathing.setColor(0xFF0000); // Red until WiFi connects
+        ledManager->setStatusBehavior(&statusBreathing);
+        ledManager->setBehavior(&ledsOff);
         vibrationManager->setBehavior(&motorOff);
     }
 
@@ -54,24 +66,28 @@ public:
         if (event.type == EVT_HTTP_RESPONSE_RECEIVED) {
             // If we were previously disconnected, restore the green 'connected' state
             if (serverState == SERVER_DISCONNECTED) {
-                heartBeat.setParams(0x00005500, 1000, 10000);
-                ledManager->setBehavior(&heartBeat);
+                statusBeat.setParams(0x00005500, 1000, 10000);
+                ledManager->setStatusBehavior(&statusBeat);
             }
             serverState = SERVER_CONNECTED;
 
-            // Now handle the actual response, which may override the behavior
+            // Now handle the actual response, which may set the base effect
             HttpResponseEvent& e = static_cast<HttpResponseEvent&>(event);
-            handleServerResponse(e.response);
+            handleServerResponse(e.response, e.length, e.receivedAtMs);
         }
         if (event.type == EVT_WIFI_CONNECTED) {
             serverState = SERVER_CONNECTED; // Assume server is reachable if WiFi is up
-            heartBeat.setParams(0x00005500, 1000, 10000); // Green, 1s pulse, 10s interval
-            ledManager->setBehavior(&heartBeat);
+            statusBeat.setParams(0x00005500, 1000, 10000); // Green, 1s pulse, 10s interval
+            ledManager->setStatusBehavior(&statusBeat);
         }
         if (event.type == EVT_SERVER_DISCONNECTED) {
             serverState = SERVER_DISCONNECTED;
-            heartBeat.setParams(0x00FF0000, 1000, 2000); // Red, 1s pulse, 2s interval
-            ledManager->setBehavior(&heartBeat);
+            statusBeat.setParams(0x00FF0000, 1000, 2000); // Red, 1s pulse, 2s interval
+            ledManager->setStatusBehavior(&statusBeat);
+        }
+        if (event.type == EVT_RULE_FIRED) {
+            RuleFiredEvent& e = static_cast<RuleFiredEvent&>(event);
+            applyPreset(e.presetId, JsonObject());
         }
     }
 
@@ -80,9 +96,12 @@ public:
     }
 
 private:
-    void handleServerResponse(String& payload) {
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, payload);
+    // Parses straight from the transport's buffer into the arena, so a
+    // command is handled without heap allocations
+    void handleServerResponse(const char* payload, size_t length, unsigned long receivedAtMs) {
+        JsonArena::Scope scope(arena);
+        JsonDocument doc(&arena);
+        DeserializationError error = deserializeJson(doc, payload, length, DeserializationOption::Filter(filter));
 
         if (error) {
             Serial.printf("deserializeJson() failed: %s\\n", error.c_str());
@@ -95,39 +114,241 @@ private:
         //     eventManager->publish(event);
         // }
 
-        if (doc.containsKey("led_behavior")) {
-            JsonObject led_config = doc["led_behavior"];
-            const char* type = led_config["type"];
-            
-            auto it = ledBehaviorMap.find(type);
-            if (it != ledBehaviorMap.end()) {
-                LedBehavior* behavior = it->second;
-                if(led_config.containsKey("params")) {
-                    JsonObject params = led_config["params"];
-                    behavior->updateParams(params);
+        // The server echoes our send time with its own receive and send times
+        if (doc.containsKey("clock")) {
+            JsonObject c = doc["clock"];
+            clock.addSample(c["t0"].as<unsigned long>(), c["t1"].as<int64_t>(), c["t2"].as<int64_t>(), receivedAtMs);
+        }
+
+        // New or updated presets come before any command that uses them
+        if (doc.containsKey("presets")) {
+            for (JsonVariant preset : doc["presets"].as<JsonArray>()) {
+                if (!storePreset(preset.as<JsonObject>())) {
+                    Serial.println("Preset rejected: unknown behavior, bad params or invalid version.");
                 }
-                ledManager->setBehavior(behavior);
             }
         }
 
+        if (doc.containsKey("rules")) {
+            rules.install(doc["rules"].as<JsonObject>());
+        }
+
+        // Sent while the "cv" in our reports differs from the server's set
+        if (doc.containsKey("params")) {
+            params.apply(doc["params"].as<JsonObject>(), eventManager);
+        }
+
+        // Offered until we report running that version
+        if (doc.containsKey("ota")) {
+            ota.offer(doc["ota"].as<JsonObject>());
+        }
+
+        // The server repeats a command until we acknowledge its cmd_seq, and
+        // may push it over the stream as well; apply each one only once
+        uint32_t commandSeq = doc["cmd_seq"] | 0UL;
+        if (commandSeq != 0) {
+            if (commandSeq <= appliedCommandSeq) return;
+            appliedCommandSeq = commandSeq;
+        }
+
+        if (doc.containsKey("preset")) {
+            applyPreset(doc["preset"].as<JsonObject>());
+        }
+
+        if (doc.containsKey("led_behavior")) {
+            applyLedBehavior(doc["led_behavior"].as<JsonObject>());
+        }
+
         if (doc.containsKey("vibration_behavior")) {
-            JsonObject vib_config = doc["vibration_behavior"];
-            const char* type = vib_config["type"];
-
-            auto it = vibrationBehaviorMap.find(type);
-            if (it != vibrationBehaviorMap.end()) {
-                VibrationBehavior* behavior = it->second;
-                if(vib_config.containsKey("params")) {
-                    JsonObject params = vib_config["params"];
-                    behavior->updateParams(params);
-                }
-                vibrationManager->setBehavior(behavior);
+            applyVibrationBehavior(doc["vibration_behavior"].as<JsonObject>());
+        }
+
+        if (commandSeq != 0) {
+            CommandAppliedEvent applied(commandSeq);
+            eventManager->publish(applied);
+        }
+    }
+
+    // { "id": 3, "version": 2, "body": { "led_behavior": {...}, "vibration_behavior": {...} } }
+    // Each behavior's params are parsed here, once, over the behavior's
+    // current ones, and kept in binary form.
+    bool storePreset(JsonObject preset) {
+        PresetStore::Preset parsed = {};
+        JsonObject body = preset["body"];
+        if (body.containsKey("led_behavior")) {
+            JsonObject led_config = body["led_behavior"];
+            bool alert = isAlert(led_config);
+            LedBehavior* behavior = alert ? &alertTimeline : findLedBehavior(led_config["type"].as<const char*>());
+            if (!behavior) return false;
+            JsonObject params = led_config["params"];
+            behavior->saveParams(parsed.led.params);
+            if (!behavior->parseParams(params, parsed.led.params)) return false;
+            parsed.led.type = nameHash(behavior->type);
+            parsed.led.alert = alert;
+            parsed.led.durationMs = led_config["duration"] | 3000UL;
+        }
+        if (body.containsKey("vibration_behavior")) {
+            JsonObject vib_config = body["vibration_behavior"];
+            VibrationBehavior* behavior = findVibrationBehavior(vib_config["type"].as<const char*>());
+            if (!behavior) return false;
+            JsonObject params = vib_config["params"];
+            behavior->saveParams(parsed.vibration.params);
+            if (!behavior->parseParams(params, parsed.vibration.params)) return false;
+            parsed.vibration.type = nameHash(behavior->type);
+        }
+        return presets.store(preset["id"].as<uint8_t>(), preset["version"].as<uint16_t>(), parsed);
+    }
+
+    // command: { "id": 3, "led_params": {...}, "vibration_params": {...}, "at": ... }
+    // The override params are merged over the preset's own params.
+    void applyPreset(JsonObject command) {
+        applyPreset(command["id"].as<uint8_t>(), command);
+    }
+
+    void applyPreset(uint8_t id, JsonObject command) {
+        const PresetStore::Preset* preset = presets.find(id);
+        if (!preset) {
+            Serial.printf("Unknown preset %d.\n", id);
+            return;
+        }
+        bool scheduled = false;
+        unsigned long startAt = resolveStartTime(command, scheduled);
+
+        LedBehavior* led = preset->led.alert ? &alertTimeline : findLedBehavior(preset->led.type);
+        if (led) {
+            JsonObject overrides = command["led_params"];
+            if (overrides.isNull()) {
+                led->loadParams(preset->led.params);
+            } else {
+                LedParams params = preset->led.params;
+                if (!led->parseParams(overrides, params)) return;
+                led->loadParams(params);
             }
+            playLed(led, preset->led.alert, preset->led.durationMs, scheduled, startAt);
+        }
+
+        VibrationBehavior* vibration = findVibrationBehavior(preset->vibration.type);
+        if (vibration) {
+            JsonObject overrides = command["vibration_params"];
+            if (overrides.isNull()) {
+                vibration->loadParams(preset->vibration.params);
+            } else {
+                VibrationParams params = preset->vibration.params;
+                if (!vibration->parseParams(overrides, params)) return;
+                vibration->loadParams(params);
+            }
+            playVibration(vibration, scheduled, startAt);
+        }
+    }
+
+    void applyLedBehavior(JsonObject led_config) {
+        // Alerts play a timeline on the top layer and expire by themselves
+        bool alert = isAlert(led_config);
+        LedBehavior* behavior = alert ? &alertTimeline : findLedBehavior(led_config["type"].as<const char*>());
+        if (!behavior) return;
+        if (led_config.containsKey("params")) {
+            JsonObject params = led_config["params"];
+            behavior->updateParams(params);
+        }
+        bool scheduled = false;
+        unsigned long startAt = resolveStartTime(led_config, scheduled);
+        playLed(behavior, alert, led_config["duration"] | 3000UL, scheduled, startAt);
+    }
+
+    void applyVibrationBehavior(JsonObject vib_config) {
+        VibrationBehavior* behavior = findVibrationBehavior(vib_config["type"].as<const char*>());
+        if (!behavior) return;
+        if (vib_config.containsKey("params")) {
+            JsonObject params = vib_config["params"];
+            behavior->updateParams(params);
+        }
+        bool scheduled = false;
+        unsigned long startAt = resolveStartTime(vib_config, scheduled);
+        playVibration(behavior, scheduled, startAt);
+    }
+
+    void playLed(LedBehavior* behavior, bool alert, unsigned long durationMs, bool scheduled, unsigned long startAt) {
+        if (alert) {
+            if (scheduled) {
+                ledManager->showAlertAt(behavior, durationMs, startAt);
+            } else {
+                ledManager->showAlert(behavior, durationMs);
+            }
+        } else if (scheduled) {
+            ledManager->setBehaviorAt(behavior, startAt);
+        } else {
+            ledManager->setBehavior(behavior);
+        }
+    }
+
+    void playVibration(VibrationBehavior* behavior, bool scheduled, unsigned long startAt) {
+        if (scheduled) {
+            vibrationManager->setBehaviorAt(behavior, startAt);
+        } else {
+            vibrationManager->setBehavior(behavior);
         }
     }
 
+    static bool isAlert(JsonObject& led_config) {
+        return strcmp(led_config["layer"] | "base", "alert") == 0;
+    }
+
+    // Names are dispatched on their compile-time hash; the final strcmp
+    // rejects unknown names that happen to share a hash with a known one
+    LedBehavior* findLedBehavior(const char* type) {
+        if (!type) return nullptr;
+        LedBehavior* behavior = findLedBehavior(nameHash(type));
+        return behavior && strcmp(behavior->type, type) == 0 ? behavior : nullptr;
+    }
+
+    VibrationBehavior* findVibrationBehavior(const char* type) {
+        if (!type) return nullptr;
+        VibrationBehavior* behavior = findVibrationBehavior(nameHash(type));
+        return behavior && strcmp(behavior->type, type) == 0 ? behavior : nullptr;
+    }
+
+    // A stored preset's type was checked by name when it was stored; 0 finds nothing
+    LedBehavior* findLedBehavior(uint32_t hash) {
+        LedBehavior* behavior = nullptr;
+        switch (hash) {
+            case nameHash("Off"):       behavior = &ledsOff; break;
+            case nameHash("Solid"):     behavior = &solid; break;
+            case nameHash("Breathing"): behavior = &breathing; break;
+            case nameHash("HeartBeat"): behavior = &heartBeat; break;
+            case nameHash("Cycle"):     behavior = &cycle; break;
+            case nameHash("Timeline"):  behavior = &timeline; break;
+        }
+        return behavior;
+    }
+
+    VibrationBehavior* findVibrationBehavior(uint32_t hash) {
+        VibrationBehavior* behavior = nullptr;
+        switch (hash) {
+            case nameHash("Off"):      behavior = &motorOff; break;
+            case nameHash("Constant"): behavior = &constant; break;
+            case nameHash("Burst"):    behavior = &burst; break;
+            case nameHash("Pulse"):    behavior = &pulse; break;
+            case nameHash("Waveform"): behavior = &waveform; break;
+        }
+        return behavior;
+    }
+
+    // "at" is a start time on the server clock (ms since the epoch), shared
+    // by every scanner the command was sent to. Without a clock estimate
+    // the behavior starts immediately.
+    unsigned long resolveStartTime(JsonObject& config, bool& scheduled) {
+        scheduled = config.containsKey("at") && clock.isSynced();
+        return scheduled ? clock.toLocal(config["at"].as<int64_t>()) : 0;
+    }
+
     LedManager* ledManager;
     VibrationManager* vibrationManager;
+    ClockSync& clock;
+    uint32_t appliedCommandSeq = 0;
+    PresetStore& presets;
+    RuleEngine& rules;
+    Params& params;
+    OtaManager& ota;
 
     // --- Behavior Pools ---
     LedsOffBehavior ledsOff;
@@ -135,14 +356,26 @@ private:
     BreathingBehavior breathing;
     HeartBeatBehavior heartBeat;
     CycleBehavior cycle;
+    TimelineBehavior timeline;
+
+    // Status and alert layers have their own instances, so they never share
+    // a behavior with the server-selected base effect
+    BreathingBehavior statusBreathing;
+    HeartBeatBehavior statusBeat;
+    TimelineBehavior alertTimeline;
 
     MotorOffBehavior motorOff;
     ConstantVibrationBehavior constant;
     BurstVibrationBehavior burst;
     PulseVibrationBehavior pulse;
-    
-    std::map<std::string, LedBehavior*> ledBehaviorMap;
-    std::map<std::string, VibrationBehavior*> vibrationBehaviorMap;
+    WaveformVibrationBehavior waveform;
+
+    // Backs every JsonDocument of the command path; the filter stays at its
+    // bottom for good. Responses, pushed commands and rule firings all come
+    // in on the main loop, so scopes only ever nest. Nothing on another task
+    // may parse into it.
+    JsonArena arena;
+    JsonDocument filter;
 };
 
 #endif // BEHAVIOR_MANAGER_H 
\ No newline at end of file
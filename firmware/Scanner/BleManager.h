@@ -8,6 +8,12 @@
 #include "config.h"
 #include "EventManager.h"
 #include "IMUManager.h"
+#include "BeaconTable.h"
+#include "Params.h"
+#include "BootStats.h"
+#include <atomic>
+
+#define BLE_NEAR_QUEUE_LEN 4
 
 // Forward declaration for the global pointer
 class BleManager;
@@ -16,12 +22,24 @@ extern BleManager* g_bleManager;
 // The callback function that is executed when the scan is complete.
 void scanCompleteCallback(BLEScanResults results);
 
-class BleManager : public Process {
+// Besides the periodic scans, every advertisement is checked as it arrives:
+// a beacon closer than report_urgent_rssi becomes an UrgentEvent right away
+// instead of waiting for the scan to complete.
+//
+// The first scan starts as soon as WiFi connects rather than a scan interval
+// after boot, so the first report can go out right when it completes.
+//
+// The scan completes on the BLE task, which only latches the results. The
+// ScanCompleteEvent is published from update(), so reports, the transports
+// and the server's answers are all handled on the main loop.
+class BleManager : public Process, public BLEAdvertisedDeviceCallbacks {
 public:
-    BleManager(IMUManager* imu)
+    BleManager(IMUManager* imu, Params& parameters, BootStats& bootStats)
         : Process(),
           imuManager(imu),
-          scanTimer(SCAN_INTERVAL_MS),
+          params(parameters),
+          boot(bootStats),
+          scanTimer(parameters.get(PARAM_SCAN_INTERVAL_MS)),
           pBLEScan(nullptr)
     {
         g_bleManager = this;
@@ -30,12 +48,15 @@ public:
     void setup(EventManager* em) override {
         Process::setup(em);
         eventManager->subscribe(EVT_SYNC_TIMER, this);
+        eventManager->subscribe(EVT_CONFIG_CHANGED, this);
+        eventManager->subscribe(EVT_WIFI_CONNECTED, this);
         BLEDevice::init("");
         pBLEScan = BLEDevice::getScan();
         pBLEScan->setActiveScan(false);
-        pBLEScan->setInterval(BLE_SCAN_INTERVAL);
-        pBLEScan->setWindow(BLE_SCAN_WINDOW);
-        scanTimer.reset();
+        pBLEScan->setAdvertisedDeviceCallbacks(this);
+        scanTimer.interval = params.get(PARAM_SCAN_INTERVAL_MS); // Loaded from NVS after construction
+        scanTimer.reset(); // Without WiFi, scanning starts on the interval
+        boot.mark(BOOT_BLE);
         Serial.println("BLE Initialized");
     }
 
@@ -46,38 +67,123 @@ public:
             scanTimer.interval = e.wait_ms;
             scanTimer.reset();
         }
+        if (event.type == EVT_WIFI_CONNECTED && scansStarted == 0) {
+            scanTimer.reset();
+            startScan();
+        }
+        // The scan window and duration are read at the start of each scan
+        if (event.type == EVT_CONFIG_CHANGED) {
+            ConfigChangedEvent& e = static_cast<ConfigChangedEvent&>(event);
+            if (e.key == CONFIG_PARAM && e.param == PARAM_SCAN_INTERVAL_MS) {
+                scanTimer.interval = params.get(PARAM_SCAN_INTERVAL_MS);
+            }
+        }
     }
 
     void update() override {
+        // Before a new scan, which clears the results
+        publishScanResults();
         if (scanTimer.checkAndReset()) {
             startScan();
         }
+        publishNearBeacons();
     }
 
+    // Runs on the BLE task for each device found during a scan. Close
+    // beacons are handed to the main loop through a single-producer queue.
+    void onResult(BLEAdvertisedDevice device) override {
+        if (device.getRSSI() <= params.get(PARAM_REPORT_URGENT_RSSI)) return;
+        if (!device.isAdvertisingService(BLEUUID(BEACON_SERVICE_UUID))) return;
+        uint8_t head = nearHead.load(std::memory_order_relaxed);
+        if ((uint8_t)(head - nearTail.load(std::memory_order_acquire)) >= BLE_NEAR_QUEUE_LEN) return;
+
+        NearBeacon& b = near[head % BLE_NEAR_QUEUE_LEN];
+        std::string name = device.haveName() ? device.getName() : device.getAddress().toString();
+        strncpy(b.name, name.c_str(), BEACON_NAME_LEN - 1);
+        b.name[BEACON_NAME_LEN - 1] = '\0';
+        b.rssi = device.getRSSI();
+        b.atMs = millis();
+        nearHead.store(head + 1, std::memory_order_release);
+    }
+
+    // Runs on the BLE task
     void onScanComplete(BLEScanResults results) {
-        Serial.printf("Scan complete! Found %d devices.\n", results.getCount());
-        
-        float avgAngleXZ = 0.0, avgAngleYZ = 0.0, totalMovement = 0.0;
+        // Close the motion interval at the same instant the scan window ends,
+        // so RSSI and movement in one report cover the same span.
+        unsigned long scanEndMs = millis();
+        latchedMotion.startMs = scanStartMs;
+        latchedMotion.endMs = scanEndMs;
         if (imuManager) {
-            avgAngleXZ = imuManager->getAverageAngleXZ();
-            avgAngleYZ = imuManager->getAverageAngleYZ();
-            totalMovement = imuManager->getTotalMovement();
-            imuManager->prepareForNextInterval();
+            latchedMotion = imuManager->latchInterval(scanEndMs);
         }
-        
-        ScanCompleteEvent event(results, avgAngleXZ, avgAngleYZ, totalMovement);
-        eventManager->publish(event);
+        latchedResults = results;
+        scanning.store(false, std::memory_order_release); // Hands the latched scan to update()
+    }
+
+    // True during a scan window, when the radio time should go to BLE
+    bool isScanning() const {
+        return scanning.load();
     }
 
 private:
+    struct NearBeacon {
+        char name[BEACON_NAME_LEN];
+        int8_t rssi;
+        unsigned long atMs;
+    };
+
+    void publishScanResults() {
+        if (!scanPending || scanning.load(std::memory_order_acquire)) return;
+        scanPending = false;
+        boot.mark(BOOT_FIRST_SCAN);
+        Serial.printf("Scan complete! Found %d devices.\n", latchedResults.getCount());
+
+        const ImuInterval& motion = latchedMotion;
+        ScanCompleteEvent event(latchedResults, motion.avgAngleXZ, motion.avgAngleYZ, motion.totalMovement,
+                                motion.startMs, motion.endMs, motion.samples);
+        eventManager->publish(event);
+    }
+
+    void publishNearBeacons() {
+        uint8_t tail = nearTail.load(std::memory_order_relaxed);
+        while (tail != nearHead.load(std::memory_order_acquire)) {
+            NearBeacon& b = near[tail % BLE_NEAR_QUEUE_LEN];
+            UrgentEvent event(URGENT_BEACON, b.name, b.rssi, b.atMs);
+            eventManager->publish(event);
+            nearTail.store(++tail, std::memory_order_release);
+        }
+    }
+
     void startScan() {
         Serial.println("Starting BLE scan...");
-        pBLEScan->start(SCAN_DURATION, scanCompleteCallback);
+        scanStartMs = millis();
+        scansStarted++;
+        scanning.store(true);
+        scanPending = true;
+        int32_t interval = params.get(PARAM_BLE_SCAN_INTERVAL);
+        pBLEScan->setInterval(interval);
+        pBLEScan->setWindow(min(params.get(PARAM_BLE_SCAN_WINDOW), interval)); // The window must fit in the interval
+        if (!pBLEScan->start(params.get(PARAM_SCAN_DURATION_S), scanCompleteCallback)) {
+            Serial.println("BLE scan did not start.");
+            scanning.store(false);
+            scanPending = false;
+        }
     }
 
     IMUManager* imuManager;
+    Params& params;
+    BootStats& boot;
     Timer scanTimer;
     BLEScan* pBLEScan;
+    unsigned long scanStartMs = 0;
+    uint32_t scansStarted = 0;
+    std::atomic<bool> scanning{false};
+    bool scanPending = false;     // A scan was started and its results not published yet
+    BLEScanResults latchedResults; // Written by onScanComplete() while scanning is set
+    ImuInterval latchedMotion;
+    NearBeacon near[BLE_NEAR_QUEUE_LEN];
+    std::atomic<uint8_t> nearHead{0};
+    std::atomic<uint8_t> nearTail{0};
 };
 
 // Define the callback function to pass to the BLE scanner
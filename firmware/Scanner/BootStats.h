@@ -0,0 +1,69 @@
+#ifndef BOOT_STATS_H
+#define BOOT_STATS_H
+
+#include <Arduino.h>
+#include "ReportWriter.h"
+#include "JsonWriter.h"
+
+// Boot phases in the order they normally complete
+enum BootPhase : uint8_t {
+    BOOT_CONFIG,         // Configuration and parameters loaded from NVS
+    BOOT_WIFI_STARTED,   // First join or scan issued; association runs on the WiFi task from here
+    BOOT_LEDS,           // LED strip and ticker running
+    BOOT_IMU,            // Accelerometer initialized
+    BOOT_BLE,            // BLE stack initialized
+    BOOT_READY,          // All processes set up, main loop starts
+    BOOT_WIFI_CONNECTED,
+    BOOT_FIRST_SCAN,     // First scan window closed
+    BOOT_FIRST_REPORT,   // First report delivered to the server
+    BOOT_PHASE_COUNT
+};
+
+static const char* const BOOT_PHASE_NAMES[BOOT_PHASE_COUNT] = {
+    "config", "wifi_start", "leds", "imu", "ble", "ready", "wifi", "scan", "report"
+};
+
+// When each boot phase completed, in ms since the application started
+// (millis(); the ROM bootloader before it is not counted). Phases are
+// marked by the processes that own them, only the first time. The timings
+// go into reports until one of them, with the first report time in it, has
+// been delivered.
+struct BootStats {
+    uint32_t atMs[BOOT_PHASE_COUNT] = {};
+    bool delivered = false;
+
+    void mark(BootPhase phase) {
+        if (atMs[phase]) return;
+        atMs[phase] = millis() | 1; // Never 0 ("not yet")
+    }
+
+    bool complete() const {
+        return atMs[BOOT_FIRST_REPORT] != 0;
+    }
+
+    // Call after a report with the timings in it went out, before marking
+    // BOOT_FIRST_REPORT for it: that report did not carry its own time yet
+    void reportSent(bool wasDelivered) {
+        if (wasDelivered && complete()) delivered = true;
+    }
+
+    // "boot": {"config": 35, "wifi_start": 41, ...}; phases not reached yet are left out
+    void writeReport(JsonWriter& out) const {
+        if (delivered) return;
+        out.beginObject("boot");
+        for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+            if (atMs[i]) out.add(BOOT_PHASE_NAMES[i], atMs[i]);
+        }
+        out.endObject();
+    }
+
+    // One u32 per phase, 0 for phases not reached yet
+    void writeReport(ReportWriter& out) const {
+        if (delivered) return;
+        out.beginSection(SECTION_BOOT);
+        for (int i = 0; i < BOOT_PHASE_COUNT; i++) out.put32(atMs[i]);
+        out.endSection();
+    }
+};
+
+#endif // BOOT_STATS_H
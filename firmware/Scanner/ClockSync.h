@@ -0,0 +1,63 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <Arduino.h>
+
+#define CLOCK_SYNC_SAMPLES 8
+
+// Estimates the offset between the server clock and millis() from the
+// timestamps of each report round trip, NTP style:
+//   t0 = report sent (local), t1 = received by server, t2 = response sent
+//   (server), t3 = response received (local)
+//   offset = ((t1 - t0) + (t2 - t3)) / 2, delay = (t3 - t0) - (t2 - t1)
+// Of the last few samples, the one with the lowest round-trip delay is
+// trusted most, since queuing delay is what makes the estimate asymmetric.
+class ClockSync {
+public:
+    void addSample(unsigned long t0, int64_t t1, int64_t t2, unsigned long t3) {
+        unsigned long roundTrip = t3 - t0;
+        int64_t serverTime = t2 - t1;
+        if (serverTime < 0 || (int64_t)roundTrip < serverTime) return; // Inconsistent timestamps
+
+        Sample& s = samples[nextSample];
+        s.offset = ((t1 - (int64_t)t0) + (t2 - (int64_t)t3)) / 2;
+        s.delay = roundTrip - (unsigned long)serverTime;
+        nextSample = (nextSample + 1) % CLOCK_SYNC_SAMPLES;
+        if (sampleCount < CLOCK_SYNC_SAMPLES) sampleCount++;
+
+        const Sample* best = &samples[0];
+        for (int i = 1; i < sampleCount; i++) {
+            if (samples[i].delay < best->delay) best = &samples[i];
+        }
+        offsetMs = best->offset;
+        delayMs = best->delay;
+    }
+
+    bool isSynced() const { return sampleCount > 0; }
+
+    // Local millis() at which the server clock reads serverMs
+    unsigned long toLocal(int64_t serverMs) const {
+        return (unsigned long)(serverMs - offsetMs);
+    }
+
+    int64_t nowServer() const {
+        return (int64_t)millis() + offsetMs;
+    }
+
+    int64_t getOffset() const { return offsetMs; }
+    unsigned long getDelay() const { return delayMs; }
+
+private:
+    struct Sample {
+        int64_t offset;
+        unsigned long delay;
+    };
+
+    Sample samples[CLOCK_SYNC_SAMPLES];
+    int sampleCount = 0;
+    int nextSample = 0;
+    int64_t offsetMs = 0;
+    unsigned long delayMs = 0;
+};
+
+#endif // CLOCK_SYNC_H
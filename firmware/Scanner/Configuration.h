@@ -3,14 +3,22 @@
 
 #include <Preferences.h>
 #include <WiFi.h>
+#include <esp_mac.h>
 #include "config.h" // For SCANNER_NAME
 
 #define BOOT_BUTTON_PIN 9
 
-class Configuration {
-public:
+struct WifiNetwork {
+  int slot; // Where it is stored, 0 to WIFI_MAX_NETWORKS - 1
   String ssid;
   String password;
+};
+
+class Configuration {
+public:
+  // The configured networks in slot order, without the empty slots
+  WifiNetwork networks[WIFI_MAX_NETWORKS];
+  int networkCount = 0;
   String serverUrl;
   String scannerName;
   String macAddress;
@@ -18,30 +26,52 @@ public:
 
   void loadConfig() {
     preferences.begin("config", true); // Start preferences in read-only mode
-    ssid = preferences.getString("ssid", "");
-    password = preferences.getString("password", "");
+    loadNetworks();
     serverUrl = preferences.getString("serverUrl", "http://192.168.1.165:5000/data"); // Default value
     preferences.end();
 
     Serial.println("Loaded configuration:");
-    Serial.print("SSID: ");
-    Serial.println(ssid);
+    for (int i = 0; i < networkCount; i++) {
+      Serial.print("SSID: ");
+      Serial.println(networks[i].ssid);
+    }
     Serial.print("Server URL: ");
     Serial.println(serverUrl);
 
-    WiFi.mode(WIFI_STA); // Ensure WiFi is on to get MAC address
-    String mac = WiFi.macAddress();
-    String macSuffix = mac.substring(12);
-    macSuffix.replace(":", "");
-    scannerName = String(SCANNER_NAME) + "-" + macSuffix;
+    // Read from eFuse, so the WiFi driver does not have to start here
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    char text[18];
+    snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    macAddress = text;
+    snprintf(text, sizeof(text), "%02X%02X%02X", mac[3], mac[4], mac[5]);
+    scannerName = String(SCANNER_NAME) + "-" + text;
     Serial.print("Scanner name set to: ");
     Serial.println(scannerName);
 
-    macAddress = WiFi.macAddress();
     Serial.print("Scanner ID set to: ");
     Serial.println(macAddress);
   }
 
+  // "http://host:port/data" -> "host", for the transports that do not speak HTTP
+  String serverHost() const {
+    int start = serverUrl.indexOf("://");
+    start = start < 0 ? 0 : start + 3;
+    int end = start;
+    while (end < (int)serverUrl.length() && serverUrl[end] != ':' && serverUrl[end] != '/') end++;
+    return serverUrl.substring(start, end);
+  }
+
+  // "http://host:port/data" -> port, 80 when the URL has none
+  uint16_t serverPort() const {
+    int start = serverUrl.indexOf("://");
+    start = start < 0 ? 0 : start + 3;
+    int colon = serverUrl.indexOf(':', start);
+    int slash = serverUrl.indexOf('/', start);
+    if (colon < 0 || (slash >= 0 && colon > slash)) return 80;
+    return serverUrl.substring(colon + 1, slash < 0 ? serverUrl.length() : slash).toInt();
+  }
+
   void clearConfig() {
     Serial.println("Clearing configuration...");
     preferences.begin("config", false); // Start in read-write mode
@@ -52,56 +82,49 @@ public:
     ESP.restart();
   }
 
-  void enterSerialConfig() {
-    Serial.println("Entering configuration mode...");
-    Serial.println("Send 'c' to configure, or 'e' to erase configuration.");
-
-    while (!Serial.available()) { delay(100); }
-    char cmd = Serial.read();
-    while(Serial.available() && Serial.read() != '\n'); 
-
-    if (cmd == 'e') {
-        clearConfig();
-        return;
-    }
-
-    if (cmd != 'c') {
-        Serial.println("Invalid command. Aborting configuration.");
-        return;
+  // Sets or, with an empty SSID, removes network `slot`. Applied by
+  // WifiManager on the next ConfigChangedEvent.
+  void setNetwork(int slot, const String& ssid, const String& password) {
+    preferences.begin("config", false);
+    if (ssid.length() == 0) {
+      preferences.remove(networkKey("ssid", slot).c_str());
+      preferences.remove(networkKey("password", slot).c_str());
+    } else {
+      preferences.putString(networkKey("ssid", slot).c_str(), ssid);
+      preferences.putString(networkKey("password", slot).c_str(), password);
     }
+    loadNetworks();
+    preferences.end();
+  }
 
-    preferences.begin("config", false); // Start preferences in read-write mode
-
-    Serial.println("Enter SSID:");
-    while (!Serial.available()) { delay(100); }
-    ssid = Serial.readStringUntil('\n');
-    ssid.trim();
-    preferences.putString("ssid", ssid);
-    Serial.print("SSID set to: ");
-    Serial.println(ssid);
-
-    Serial.println("Enter Password:");
-    while (!Serial.available()) { delay(100); }
-    password = Serial.readStringUntil('\n');
-    password.trim();
-    preferences.putString("password", password);
-    Serial.println("Password set.");
-
-    Serial.println("Enter Server URL:");
-    while (!Serial.available()) { delay(100); }
-    serverUrl = Serial.readStringUntil('\n');
-    serverUrl.trim();
+  // Call from the main loop, where the transports read serverUrl. They
+  // reconnect on their next send after the ConfigChangedEvent.
+  void setServerUrl(const String& url) {
+    serverUrl = url;
+    preferences.begin("config", false);
     preferences.putString("serverUrl", serverUrl);
-    Serial.print("Server URL set to: ");
-    Serial.println(serverUrl);
-
     preferences.end();
-    Serial.println("Configuration saved. Restarting in 3 seconds...");
-    delay(3000);
-    ESP.restart();
   }
 
 private:
+  // Network 0 keeps the keys older firmware used, so configurations carry over
+  static String networkKey(const char* base, int index) {
+    return index == 0 ? String(base) : String(base) + index;
+  }
+
+  // Expects preferences to be open
+  void loadNetworks() {
+    networkCount = 0;
+    for (int i = 0; i < WIFI_MAX_NETWORKS; i++) {
+      String ssid = preferences.getString(networkKey("ssid", i).c_str(), "");
+      if (ssid.length() == 0) continue;
+      networks[networkCount].slot = i;
+      networks[networkCount].ssid = ssid;
+      networks[networkCount].password = preferences.getString(networkKey("password", i).c_str(), "");
+      networkCount++;
+    }
+  }
+
   Preferences preferences;
 };
 
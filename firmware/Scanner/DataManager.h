@@ -1,21 +1,36 @@
 #ifndef DATA_MANAGER_H
 #define DATA_MANAGER_H
 
-#include <ArduinoJson.h>
 #include <BLEAdvertisedDevice.h>
 #include "Process.h"
 #include "IMUManager.h"
 #include "EventManager.h"
 #include "config.h"
 #include "Configuration.h"
+#include "PresetStore.h"
+#include "RuleEngine.h"
+#include "UplinkStats.h"
+#include "WifiStats.h"
+#include "BootStats.h"
+#include "OtaManager.h"
+#include "ReportEncoder.h"
+#include "ReportBatch.h"
+#include "BeaconTable.h"
+#include "Params.h"
 
 class DataManager : public Process {
 public:
-    DataManager(Configuration& config) : cfg(config) {}
+    DataManager(Configuration& config, Params& parameters, PresetStore& presetStore, RuleEngine& ruleEngine,
+                UplinkStats& uplinkStats, WifiStats& wifiStats, BootStats& bootStats, OtaManager& otaManager,
+                BeaconTable& beaconTable)
+        : cfg(config), params(parameters), presets(presetStore), rules(ruleEngine), link(uplinkStats), wifi(wifiStats),
+          boot(bootStats), ota(otaManager), beacons(beaconTable), batch(REPORT_BINARY) {}
     
     void setup(EventManager* em) override {
         Process::setup(em);
         eventManager->subscribe(EVT_SCAN_COMPLETE, this);
+        eventManager->subscribe(EVT_COMMAND_APPLIED, this);
+        eventManager->subscribe(EVT_DATA_READY_FOR_HTTP, this); // For late outcomes from MqttManager
     }
     
     void onEvent(Event& event) override {
@@ -23,6 +38,13 @@ public:
             ScanCompleteEvent& e = static_cast<ScanCompleteEvent&>(event);
             processScanResults(e);
         }
+        if (event.type == EVT_COMMAND_APPLIED) {
+            appliedCommandSeq = static_cast<CommandAppliedEvent&>(event).seq;
+        }
+        if (event.type == EVT_DATA_READY_FOR_HTTP) {
+            DataReadyForHttpEvent& e = static_cast<DataReadyForHttpEvent&>(event);
+            if (e.late && !e.urgent && !e.replay) reportOutcome(e.delivered);
+        }
     }
     
     void update() override {
@@ -30,45 +52,186 @@ public:
     }
 
 private:
+    // The report parameters are read here, once per report, rather than
+    // cached on a ConfigChangedEvent.
     void processScanResults(ScanCompleteEvent& scanEvent) {
-        if (!cfg.wifiConnected) {
-            Serial.println("WiFi not connected, skipping data processing.");
+        // Every keyframeInterval-th report lists all beacons, the ones in
+        // between only what changed. A new interval starts with a keyframe.
+        int keyframeInterval = params.get(PARAM_REPORT_KEYFRAME_INTERVAL);
+        if (keyframeInterval != lastKeyframeInterval) {
+            lastKeyframeInterval = keyframeInterval;
+            sinceKeyframe = 0;
+        }
+        // Deltas are judged on the BeaconTable. When it could not hold every
+        // beacon, the report lists the whole scan, and the next one is a
+        // keyframe again so the server drops what left meanwhile.
+        bool tableFull = beacons.overflowed();
+        deltaReport = keyframeInterval > 1 && sinceKeyframe > 0 && !tableFull;
+        sinceKeyframe = tableFull ? 0 : (sinceKeyframe + 1) % keyframeInterval;
+
+        // Encoded in place; the transports send straight from this buffer
+#if REPORT_BINARY
+        encode(scanEvent, writer);
+        if (writer.overflowed()) {
+            Serial.println("Report too large for the binary buffer, dropped.");
+            return;
+        }
+        const uint8_t* report = writer.data();
+        size_t length = writer.size();
+        const char* contentType = REPORT_CONTENT_TYPE_BINARY;
+#else
+        encode(scanEvent, json);
+        if (json.overflowed()) {
+            Serial.println("Report too large for the JSON buffer, dropped.");
+            return;
+        }
+        const uint8_t* report = json.data();
+        size_t length = json.size();
+        const char* contentType = REPORT_CONTENT_TYPE_JSON;
+#endif
+        int batchSize = params.get(PARAM_REPORT_BATCH_SIZE);
+        if (batchSize <= 1) {
+            sendBatch(); // Left over from a larger batch size
+            DataReadyForHttpEvent httpEvent(report, length, contentType);
+            eventManager->publish(httpEvent);
+            if (!httpEvent.queued) reportOutcome(httpEvent.delivered);
             return;
         }
 
-        JsonDocument doc;
-        doc["scanner_id"] = cfg.macAddress;
-        doc["scanner_name"] = cfg.scannerName;
-
-        JsonArray beacons = doc.createNestedArray("beacons");
-        BLEUUID serviceUUID(BEACON_SERVICE_UUID);
-
-        for (int i = 0; i < scanEvent.results.getCount(); i++) {
-            BLEAdvertisedDevice device = scanEvent.results.getDevice(i);
-            if (device.isAdvertisingService(serviceUUID)) {
-                JsonObject beacon = beacons.add<JsonObject>();
-                if (device.haveName()) {
-                    beacon["name"] = device.getName().c_str();
-                } else {
-                    beacon["name"] = device.getAddress().toString().c_str();
-                }
-                beacon["rssi"] = device.getRSSI();
-            }
+        if (!batch.add(report, length)) {
+            sendBatch();
+            batch.add(report, length);
         }
+        if (batch.reports() >= batchSize || batch.ageMs() >= REPORT_BATCH_MAX_AGE_MS || urgentArrival()) {
+            sendBatch();
+        }
+    }
 
-        JsonObject movement = doc.createNestedObject("movement");
-        movement["avgAngleXZ"] = scanEvent.avgAngleXZ;
-        movement["avgAngleYZ"] = scanEvent.avgAngleYZ;
-        movement["totalMovement"] = scanEvent.totalMovement;
-        
-        String jsonBuffer;
-        serializeJson(doc, jsonBuffer);
-        
-        DataReadyForHttpEvent httpEvent(jsonBuffer);
+    void sendBatch() {
+        if (batch.reports() == 0) return;
+        batch.finish(millis());
+        DataReadyForHttpEvent httpEvent(batch.data(), batch.length(), batch.contentType());
         eventManager->publish(httpEvent);
+        if (!httpEvent.queued) reportOutcome(httpEvent.delivered);
+        batch.clear();
+    }
+
+    void reportOutcome(bool delivered) {
+        boot.reportSent(delivered);
+        if (delivered) boot.mark(BOOT_FIRST_REPORT);
+        // The server missed this report's changes; rebuild its state
+        if (!delivered) sinceKeyframe = 0;
+    }
+
+    // A beacon that just showed up close by is worth reporting right away
+    bool urgentArrival() {
+        for (const BeaconTable::Entry& e : beacons) {
+            if (e.arrived && BeaconTable::seen(e) && BeaconTable::filteredRssi(e) > params.get(PARAM_REPORT_URGENT_RSSI)) return true;
+        }
+        return false;
+    }
+
+    // Calls emit(name, rssi) for each beacon that goes into this report.
+    // Without delta reports, or when the BeaconTable overflowed, that is
+    // every beacon in the scan. Otherwise a keyframe lists every beacon
+    // seen; a delta only those that appeared or whose filtered RSSI moved by
+    // more than the hysteresis since they were last reported.
+    template <typename Emit>
+    void forEachReportedBeacon(ScanCompleteEvent& scanEvent, Emit emit) {
+        if (lastKeyframeInterval <= 1 || beacons.overflowed()) {
+            BLEUUID serviceUUID(BEACON_SERVICE_UUID);
+            for (int i = 0; i < scanEvent.results.getCount(); i++) {
+                BLEAdvertisedDevice device = scanEvent.results.getDevice(i);
+                if (!device.isAdvertisingService(serviceUUID)) continue;
+                std::string name = device.haveName() ? device.getName() : device.getAddress().toString();
+                emit(name.c_str(), device.getRSSI());
+            }
+            return;
+        }
+
+        int hysteresis = params.get(PARAM_REPORT_DELTA_HYSTERESIS_DB) * 16;
+        for (BeaconTable::Entry& e : beacons) {
+            if (!BeaconTable::seen(e)) continue;
+            bool changed = !e.reported || abs(e.filtered - e.reportedRssi) > hysteresis;
+            if (deltaReport && !changed) continue;
+            e.reported = true;
+            e.reportedRssi = e.filtered;
+            emit(e.name, e.lastRssi);
+        }
+    }
+
+    // Calls emit(name) for each beacon the server still lists that was not
+    // in this scan. Only deltas carry them; a keyframe replaces the list.
+    template <typename Emit>
+    void forEachGoneBeacon(Emit emit) {
+        for (BeaconTable::Entry& e : beacons) {
+            if (!e.reported || BeaconTable::seen(e)) continue;
+            e.reported = false;
+            if (deltaReport) emit(e.name);
+        }
+    }
+
+    // Written member by member into a fixed buffer (JsonWriter or
+    // ReportWriter) rather than through a JsonDocument, so memory use does
+    // not grow with the number of beacons. Writer is the one REPORT_BINARY
+    // selects.
+    template <typename Writer>
+    void encode(ScanCompleteEvent& scanEvent, Writer& out) {
+        ReportContent content = {
+            cfg.macAddress, cfg.scannerName, deltaReport,
+            scanEvent.avgAngleXZ, scanEvent.avgAngleYZ, scanEvent.totalMovement,
+            (uint32_t)(scanEvent.intervalEndMs - scanEvent.intervalStartMs), scanEvent.motionSamples,
+            appliedCommandSeq, (uint32_t)millis()
+        };
+        encodeReport(out, content,
+                     [&](auto emit) { forEachReportedBeacon(scanEvent, emit); },
+                     [&](auto emit) { forEachGoneBeacon(emit); },
+                     [&](Writer& w) { writeSections(w); });
+    }
+
+    template <typename Writer>
+    void writeSections(Writer& out) {
+        // Presets we hold, so the server knows which ones to upload
+        presets.writeVersions(out);
+
+        // Rule set version, and what the rules triggered since the last report
+        rules.writeReport(out);
+
+        // Connection reuse and round-trip times of the uplink so far
+        link.writeReport(out);
+
+        // Lets the server send its parameter set when ours is older
+        params.writeReport(out);
+
+        // Time to connect, outages and roams of the WiFi connection
+        wifi.writeReport(out);
+
+        // How long each boot phase took, until the server has it
+        boot.writeReport(out);
+
+        // Firmware version, and the progress of an update
+        ota.writeReport(out);
     }
 
     Configuration& cfg;
+    Params& params;
+    PresetStore& presets;
+    RuleEngine& rules;
+    UplinkStats& link;
+    WifiStats& wifi;
+    BootStats& boot;
+    OtaManager& ota;
+    BeaconTable& beacons;
+    ReportBatch batch;
+    uint32_t appliedCommandSeq = 0;
+    bool deltaReport = false;
+    int sinceKeyframe = 0;
+    int lastKeyframeInterval = 0;
+#if REPORT_BINARY
+    ReportWriter writer;
+#else
+    JsonWriter json;
+#endif
 };
 
 #endif // DATA_MANAGER_H 
\ No newline at end of file
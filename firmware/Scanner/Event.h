@@ -13,6 +13,10 @@ enum EventType {
     EVT_WIFI_CONNECTED,
     EVT_SYNC_TIMER,
     EVT_SERVER_DISCONNECTED,
+    EVT_RULE_FIRED,
+    EVT_COMMAND_APPLIED,
+    EVT_URGENT,
+    EVT_CONFIG_CHANGED,
     // Add other event types here
 };
 
@@ -28,21 +32,51 @@ struct ScanCompleteEvent : Event {
     float avgAngleXZ;
     float avgAngleYZ;
     float totalMovement;
+    unsigned long intervalStartMs; // Motion interval, closed when the scan window ended
+    unsigned long intervalEndMs;
+    uint32_t motionSamples;
 
-    ScanCompleteEvent(BLEScanResults res, float axz, float ayz, float move)
-        : Event(EVT_SCAN_COMPLETE), results(res), avgAngleXZ(axz), avgAngleYZ(ayz), totalMovement(move) {}
+    ScanCompleteEvent(BLEScanResults res, float axz, float ayz, float move,
+                      unsigned long start, unsigned long end, uint32_t samples)
+        : Event(EVT_SCAN_COMPLETE), results(res), avgAngleXZ(axz), avgAngleYZ(ayz), totalMovement(move),
+          intervalStartMs(start), intervalEndMs(end), motionSamples(samples) {}
 };
 
+// Largest answer a transport takes from the server (presets, rules and an
+// OTA offer in one response); every transport sizes its receive buffer to it
+#define HTTP_RESPONSE_MAX_BYTES 4096
+
+// The response is the transport's receive buffer, only valid during publish()
 struct HttpResponseEvent : Event {
-    String response;
-    HttpResponseEvent(String resp)
-        : Event(EVT_HTTP_RESPONSE_RECEIVED), response(resp) {}
+    const char* response;
+    size_t length;
+    unsigned long receivedAtMs; // millis() when the response arrived, for clock sync
+    HttpResponseEvent(const char* resp, size_t len, unsigned long receivedAt)
+        : Event(EVT_HTTP_RESPONSE_RECEIVED), response(resp), length(len), receivedAtMs(receivedAt) {}
 };
 
+// The body is owned by the publisher and only valid during publish().
+// The transport sets `delivered`, so subscribers after it and the publisher
+// can tell whether the report got through.
+//
+// MqttManager confirms delivery later: it sets `queued` instead, and once the
+// broker has acknowledged the report, or the connection closed first, it
+// publishes the report again with `late` set and the final `delivered`.
 struct DataReadyForHttpEvent : Event {
-    String jsonData;
-    DataReadyForHttpEvent(String data)
-        : Event(EVT_DATA_READY_FOR_HTTP), jsonData(data) {}
+    const uint8_t* body;
+    size_t length;
+    const char* contentType;
+    bool replay = false;     // A stored report sent after an outage
+    int64_t capturedAt = 0;  // For replays: server time the report was captured
+    bool urgent = false;     // Urgent events (UrgentManager), not a scan report
+    bool delivered = false;
+    bool queued = false;     // Taken by MqttManager; the outcome follows as a late event
+    bool late = false;       // The outcome of a queued report, after the fact
+    DataReadyForHttpEvent(const uint8_t* data, size_t len, const char* type)
+        : Event(EVT_DATA_READY_FOR_HTTP), body(data), length(len), contentType(type) {}
+
+    // Not yet taken by a transport
+    bool pending() const { return !delivered && !queued && !late; }
 };
 
 struct WifiConnectedEvent : public Event {
@@ -59,4 +93,47 @@ struct ServerDisconnectedEvent : public Event {
     ServerDisconnectedEvent() : Event(EVT_SERVER_DISCONNECTED) {}
 };
 
+struct RuleFiredEvent : public Event {
+    uint8_t rule;
+    uint8_t presetId;
+    RuleFiredEvent(uint8_t r, uint8_t preset)
+        : Event(EVT_RULE_FIRED), rule(r), presetId(preset) {}
+};
+
+// A server command (identified by its cmd_seq) has been applied
+struct CommandAppliedEvent : public Event {
+    uint32_t seq;
+    CommandAppliedEvent(uint32_t s) : Event(EVT_COMMAND_APPLIED), seq(s) {}
+};
+
+enum ConfigKey : uint8_t {
+    CONFIG_WIFI,   // Configuration::networks
+    CONFIG_SERVER, // Configuration::serverUrl
+    CONFIG_PARAM   // A Params entry, named by param
+};
+
+// A setting was changed at runtime; its owner applies it without a restart
+struct ConfigChangedEvent : public Event {
+    ConfigKey key;
+    uint8_t param; // ParamId, with CONFIG_PARAM
+    ConfigChangedEvent(ConfigKey k, uint8_t p = 0) : Event(EVT_CONFIG_CHANGED), key(k), param(p) {}
+};
+
+// Urgent events outrank beacons: a higher kind goes out first
+enum UrgentKind : uint8_t {
+    URGENT_BEACON = 1, // A beacon heard closer than report_urgent_rssi (Params.h); value is the RSSI
+    URGENT_IMPACT = 2  // Acceleration above urgent_impact_mg; value in mg
+};
+
+// Something the server should hear about before the next report.
+// UrgentManager copies the name, so it only has to live during publish().
+struct UrgentEvent : public Event {
+    UrgentKind kind;
+    const char* name;   // Beacon name, "" for impacts
+    int16_t value;
+    unsigned long atMs; // millis() at detection, for the latency
+    UrgentEvent(UrgentKind k, const char* n, int16_t v, unsigned long at)
+        : Event(EVT_URGENT), kind(k), name(n), value(v), atMs(at) {}
+};
+
 #endif 
\ No newline at end of file
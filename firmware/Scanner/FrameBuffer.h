@@ -0,0 +1,80 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <Adafruit_NeoPixel.h>
+#include <string.h>
+#include "config.h"
+#include "RmtLedOutput.h"
+
+#define LED_BYTES_PER_PIXEL 3 // NEO_GRB
+
+// Sits between the LED behaviors and the strip. Behaviors draw into the
+// NeoPixel buffer as before; present() only pushes the frame to the LEDs
+// when it differs from the last one that was shown. With LED_OUTPUT_RMT
+// the frame is sent asynchronously over RMT; otherwise the strip's blocking
+// show() is used. Pixels from getLength() on are kept off, for strips with
+// fewer LEDs in use than LED_COUNT.
+class FrameBuffer {
+public:
+    FrameBuffer(Adafruit_NeoPixel& strip) : strip(strip), output(LED_PIN) {
+        invalidate();
+    }
+
+    // Call after strip.begin(), which claims the pin as a plain GPIO.
+    void begin() {
+#if LED_OUTPUT_RMT
+        output.begin();
+#endif
+        invalidate();
+    }
+
+    // Pushes the current frame if it changed. Returns true if show() was called.
+    bool present() {
+        uint8_t* frame = strip.getPixels();
+        memset(frame + length * LED_BYTES_PER_PIXEL, 0, (LED_COUNT - length) * LED_BYTES_PER_PIXEL);
+        if (!dirty && memcmp(frame, lastPushed, sizeof(lastPushed)) == 0) {
+            framesSkipped++;
+            return false;
+        }
+        if (output.isReady()) {
+            // Busy with the previous frame, or refused: keep this one dirty and retry next tick
+            if (!output.write(frame, sizeof(lastPushed))) {
+                return false;
+            }
+        } else {
+            strip.show();
+        }
+        memcpy(lastPushed, frame, sizeof(lastPushed));
+        dirty = false;
+        framesPushed++;
+        return true;
+    }
+
+    // Pixels to light, at most LED_COUNT
+    void setLength(uint16_t pixels) {
+        length = pixels < LED_COUNT ? pixels : LED_COUNT;
+    }
+
+    uint16_t getLength() const { return length; }
+
+    // Forces the next present() to push, e.g. after the strip was re-initialized.
+    void invalidate() {
+        dirty = true;
+    }
+
+    uint32_t getFramesPushed() const { return framesPushed; }
+    uint32_t getFramesSkipped() const { return framesSkipped; }
+    uint32_t getFramesDeferred() const { return output.getFramesDeferred(); }
+    uint32_t getFramesFailed() const { return output.getFramesFailed(); }
+
+private:
+    Adafruit_NeoPixel& strip;
+    RmtLedOutput output;
+    uint8_t lastPushed[LED_COUNT * LED_BYTES_PER_PIXEL];
+    uint16_t length = LED_COUNT;
+    bool dirty;
+    uint32_t framesPushed = 0;
+    uint32_t framesSkipped = 0;
+};
+
+#endif // FRAME_BUFFER_H
@@ -2,24 +2,43 @@
 #define HTTP_MANAGER_H
 
 #include <HTTPClient.h>
+#include <WiFi.h>
 #include "Process.h"
 #include "Configuration.h"
 #include "EventManager.h"
+#include "UplinkStats.h"
+#include "ReportWriter.h"
 
+#define HTTP_TIMEOUT_MS 3000
+#define HTTP_BACKOFF_MIN_MS 1000
+#define HTTP_BACKOFF_MAX_MS 30000
+
+// Posts reports over one HTTP/1.1 keep-alive connection that is reused
+// across reports. A connection the server has closed in the meantime is
+// detected on the next POST and reopened once right away; after a failed
+// reconnect, further attempts back off exponentially.
 class HTTPManager : public Process {
 public:
-    HTTPManager(Configuration& config) 
-        : cfg(config) {}
+    HTTPManager(Configuration& config, UplinkStats& uplinkStats) 
+        : cfg(config), stats(uplinkStats) {}
     
     void setup(EventManager* em) override {
         Process::setup(em);
         eventManager->subscribe(EVT_DATA_READY_FOR_HTTP, this);
+        eventManager->subscribe(EVT_CONFIG_CHANGED, this);
+        http.setReuse(true);
+        http.setTimeout(HTTP_TIMEOUT_MS);
+        http.setConnectTimeout(HTTP_TIMEOUT_MS);
     }
     
     void onEvent(Event& event) override {
         if (event.type == EVT_DATA_READY_FOR_HTTP) {
             DataReadyForHttpEvent& e = static_cast<DataReadyForHttpEvent&>(event);
-            sendData(e.jsonData);
+            sendData(e);
+        }
+        // The next report opens a connection to the new URL
+        if (event.type == EVT_CONFIG_CHANGED && static_cast<ConfigChangedEvent&>(event).key == CONFIG_SERVER) {
+            serverChanged = true;
         }
     }
 
@@ -28,29 +47,162 @@ public:
     }
 
 private:
-    void sendData(String& jsonPayload) {
-        HTTPClient http;
-        http.begin(cfg.serverUrl.c_str());
-        http.addHeader("Content-Type", "application/json");
+    void sendData(DataReadyForHttpEvent& report) {
+        if (!report.pending()) return; // Already sent over MQTT or the stream
+        if (serverChanged) {
+            serverChanged = false;
+            close();
+            backoffMs = 0;
+        }
+        if (!cfg.wifiConnected) {
+            Serial.println("WiFi not connected, report not sent.");
+            return;
+        }
+        if (backoffMs && (long)(millis() - retryAtMs) < 0) {
+            // Left undelivered, so ReportLog stores it and replays it once
+            // the server answers again
+            Serial.println("[HTTP] Backing off, report kept for replay.");
+            stats.failures++;
+            ServerDisconnectedEvent event;
+            eventManager->publish(event);
+            return;
+        }
 
-        Serial.println("Sending JSON: " + jsonPayload);
-        int httpResponseCode = http.POST(jsonPayload);
+        if (strcmp(report.contentType, REPORT_CONTENT_TYPE_JSON) == 0) {
+            Serial.printf("Sending JSON: %.*s\n", (int)report.length, (const char*)report.body);
+        } else {
+            Serial.printf("Sending %u byte report (%s)\n", (unsigned)report.length, report.contentType);
+        }
+        bool reused = begun && client.connected();
+        unsigned long sentAtMs = millis();
+        int httpResponseCode = post(report);
+
+        // The server may have closed an idle connection; that only shows up
+        // when we write to it, so retry once on a fresh socket. Only when the
+        // request cannot have reached the server: after a read timeout it may
+        // have been handled already, and a second POST would store it twice.
+        if (reused && notSent(httpResponseCode)) {
+            Serial.println("[HTTP] Stale connection, reconnecting.");
+            close();
+            reused = false;
+            sentAtMs = millis();
+            httpResponseCode = post(report);
+        }
+        unsigned long receivedAtMs = millis();
+
+        stats.requests++;
+        if (reused) stats.reused++;
 
         if (httpResponseCode == HTTP_CODE_OK) {
-            String payload = http.getString();
-            Serial.println("Received response: " + payload);
-            HttpResponseEvent responseEvent(payload);
+            // Read into a fixed buffer rather than a String; writeToStream
+            // handles both Content-Length and chunked bodies
+            response.clear();
+            int bodyLength = http.writeToStream(&response);
+            stats.recordRoundTrip(receivedAtMs - sentAtMs);
+            backoffMs = 0;
+            report.delivered = true;
+            if (bodyLength < 0 || response.overflowed()) {
+                // Unread bytes would be taken for the next response
+                Serial.println("[HTTP] Response incomplete or too large, ignored.");
+                close();
+                return;
+            }
+            Serial.printf("Received response: %s\n", response.c_str());
+            HttpResponseEvent responseEvent(response.c_str(), response.size(), receivedAtMs);
             eventManager->publish(responseEvent);
         } else {
             Serial.printf("[HTTP] POST... failed, error: %s\n", http.errorToString(httpResponseCode).c_str());
+            stats.failures++;
+            if (httpResponseCode < 0) {
+                close();
+                backoffMs = backoffMs == 0 ? HTTP_BACKOFF_MIN_MS : min(backoffMs * 2, (unsigned long)HTTP_BACKOFF_MAX_MS);
+                retryAtMs = millis() + backoffMs;
+            }
             ServerDisconnectedEvent event;
             eventManager->publish(event);
         }
+    }
 
+    int post(DataReadyForHttpEvent& report) {
+        if (!begun) {
+            // The URL is parsed once, not per report
+            if (!http.begin(client, cfg.serverUrl)) return HTTPC_ERROR_CONNECTION_REFUSED;
+            begun = true;
+        }
+        // HTTPClient reconnects by itself when the server did not keep the
+        // connection open; count that as well
+        if (!client.connected()) {
+            if (everConnected) stats.reconnects++;
+            everConnected = true;
+        }
+        http.addHeader("Content-Type", report.contentType);
+        // Headers stay set on the reused client, so live reports send it empty
+        char capturedAt[24] = "";
+        if (report.replay) snprintf(capturedAt, sizeof(capturedAt), "%lld", (long long)report.capturedAt);
+        http.addHeader("X-Captured-At", capturedAt);
+        return http.POST(const_cast<uint8_t*>(report.body), report.length);
+    }
+
+    static bool notSent(int httpResponseCode) {
+        return httpResponseCode == HTTPC_ERROR_CONNECTION_LOST || httpResponseCode == HTTPC_ERROR_SEND_HEADER_FAILED ||
+               httpResponseCode == HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+    }
+
+    void close() {
         http.end();
+        client.stop();
+        begun = false;
     }
 
+    // Collects a response body; bytes past the end are dropped and flagged
+    class ResponseBuffer : public Stream {
+    public:
+        size_t write(uint8_t c) override {
+            if (length >= HTTP_RESPONSE_MAX_BYTES) {
+                overflow = true;
+                return 0;
+            }
+            buffer[length++] = c;
+            buffer[length] = '\0';
+            return 1;
+        }
+        size_t write(const uint8_t* data, size_t size) override {
+            size_t n = min(size, (size_t)HTTP_RESPONSE_MAX_BYTES - length);
+            memcpy(buffer + length, data, n);
+            length += n;
+            buffer[length] = '\0';
+            if (n < size) overflow = true;
+            return n;
+        }
+        int available() override { return 0; }
+        int read() override { return -1; }
+        int peek() override { return -1; }
+
+        void clear() {
+            length = 0;
+            buffer[0] = '\0';
+            overflow = false;
+        }
+        const char* c_str() const { return buffer; }
+        size_t size() const { return length; }
+        bool overflowed() const { return overflow; }
+
+    private:
+        char buffer[HTTP_RESPONSE_MAX_BYTES + 1];
+        size_t length = 0;
+        bool overflow = false;
+    };
+
     Configuration& cfg;
+    UplinkStats& stats;
+    WiFiClient client;
+    HTTPClient http;
+    ResponseBuffer response;
+    bool begun = false;
+    bool serverChanged = false; // The connection is closed before the next POST rather than mid-request
+    bool everConnected = false;
+    unsigned long backoffMs = 0;
+    unsigned long retryAtMs = 0;
 };
 
-#endif // HTTP_MANAGER_H 
\ No newline at end of file
+#endif // HTTP_MANAGER_H
@@ -0,0 +1,132 @@
+#ifndef HAPTIC_SEQUENCER_H
+#define HAPTIC_SEQUENCER_H
+
+#include <Arduino.h>
+#include <Ticker.h>
+#include <atomic>
+#include "config.h"
+
+#define HAPTIC_MAX_STEPS 16
+#define HAPTIC_MAX_STEP_MS 65535 // Step durations and ramps are 16 bit
+#define HAPTIC_PWM_FREQUENCY 5000
+#define HAPTIC_PWM_RESOLUTION 8
+
+// One segment of a vibration pattern: ramp to `intensity` over rampMs using
+// the LEDC hardware fade, then hold until durationMs has passed since the
+// start of the step. A duration of 0 holds forever.
+struct HapticStep {
+    uint8_t intensity;
+    uint16_t durationMs;
+    uint16_t rampMs;
+};
+
+struct HapticWaveform {
+    HapticStep steps[HAPTIC_MAX_STEPS];
+    uint8_t count = 0;
+    bool loop = false;
+
+    void clear() {
+        count = 0;
+        loop = false;
+    }
+
+    bool add(uint8_t intensity, uint16_t durationMs, uint16_t rampMs = 0) {
+        if (count >= HAPTIC_MAX_STEPS) return false;
+        steps[count++] = { intensity, durationMs, rampMs < durationMs || durationMs == 0 ? rampMs : durationMs };
+        return true;
+    }
+};
+
+// Plays a waveform on the vibration motor without the main loop. Step
+// boundaries are timed by a Ticker (esp_timer) and ramps run on the LEDC
+// fade engine, so patterns keep their timing while the loop is blocked on
+// HTTP. A new pattern is copied into the request the timer is not reading
+// and published through an atomic pointer; the start timer swaps it in, so
+// only the esp_timer task touches the playing pattern. It preempts the loop
+// and never the other way round.
+class HapticSequencer {
+public:
+    HapticSequencer(int pin) : pin(pin) {}
+
+    bool begin() {
+        ready = ledcAttach(pin, HAPTIC_PWM_FREQUENCY, HAPTIC_PWM_RESOLUTION);
+        if (ready) {
+            ledcWrite(pin, 0);
+        } else {
+            Serial.println("Could not attach LEDC to the vibration motor pin.");
+        }
+        return ready;
+    }
+
+    // Replaces the running pattern delayMs from now, or right away. The
+    // waveform is copied, so the caller may rebuild its own copy while this
+    // one plays. A later call replaces a start that is still pending.
+    void play(const HapticWaveform& newWaveform, unsigned long delayMs = 0) {
+        HapticWaveform& request = requests[nextRequest];
+        nextRequest ^= 1;
+        request = newWaveform;
+        pending.store(&request);
+        startTimer.once_ms(delayMs, +[](HapticSequencer* self) { self->start(); }, this);
+    }
+
+    void stop() {
+        play(HapticWaveform());
+    }
+
+    uint32_t getStepsPlayed() const { return stepsPlayed; }
+
+private:
+    // Runs on the esp_timer task
+    void start() {
+        const HapticWaveform* request = pending.exchange(nullptr);
+        if (!request) return;
+        stepTimer.detach();
+        waveform = *request;
+        index = 0;
+        if (!ready) return;
+        if (waveform.count > 0) {
+            runStep();
+        } else {
+            setIntensity(0, 0);
+        }
+    }
+
+    // Runs on the esp_timer task
+    void runStep() {
+        const HapticStep& step = waveform.steps[index];
+        setIntensity(step.intensity, step.rampMs);
+        stepsPlayed++;
+
+        index++;
+        if (index >= waveform.count) {
+            if (!waveform.loop) return; // Last step holds its intensity
+            index = 0;
+        }
+        if (step.durationMs > 0) {
+            stepTimer.once_ms(step.durationMs, +[](HapticSequencer* self) { self->runStep(); }, this);
+        }
+    }
+
+    void setIntensity(uint8_t target, uint16_t rampMs) {
+        if (rampMs > 0 && target != current) {
+            ledcFade(pin, current, target, rampMs);
+        } else {
+            ledcWrite(pin, target);
+        }
+        current = target;
+    }
+
+    int pin;
+    bool ready = false;
+    Ticker stepTimer;
+    Ticker startTimer;
+    HapticWaveform requests[2]; // Written by the loop, alternately
+    uint8_t nextRequest = 0;
+    std::atomic<const HapticWaveform*> pending{nullptr};
+    HapticWaveform waveform;    // Playing; only the timer task touches it
+    uint8_t index = 0;
+    uint8_t current = 0;
+    uint32_t stepsPlayed = 0;
+};
+
+#endif // HAPTIC_SEQUENCER_H
@@ -3,16 +3,33 @@
 
 #include "Process.h"
 #include "Timer.h"
+#include "EventManager.h"
+#include "config.h"
+#include "Params.h"
+#include "BootStats.h"
 #include "SparkFun_LIS2DH12.h"
 #include <Wire.h>
 #include <math.h>
+#include <atomic>
 
 // Conversion factor from cm/s^2 to g. 1g = 980.665 cm/s^2
 #define CMS2_TO_G 0.0010197
 #define MOVING_AVG_WINDOW_SIZE 10
 
+// Motion aggregates for one report interval, latched at a scan boundary.
+struct ImuInterval {
+    unsigned long startMs = 0;   // Boundary that opened this interval
+    unsigned long endMs = 0;     // Boundary that closed this interval
+    uint32_t samples = 0;        // IMU samples that fell inside the interval
+    float avgAngleXZ = 0.0;      // Mean of the samples in the interval
+    float avgAngleYZ = 0.0;
+    float totalMovement = 0.0;
+};
+
 class IMUManager : public Process {
 private:
+    Params& params;
+    BootStats& boot;
     Timer readTimer;
     SPARKFUN_LIS2DH12 sensor;       //Create instance
     bool sensorOk = false;
@@ -25,17 +42,43 @@ private:
     int historyIndex = 0;
     int readingsInHistory = 0;
 
-    // --- Interval Accumulator State ---
-    float totalMovementInInterval = 0.0;
-    float lastIntervalTotalMovement = 0.0;
-
     // --- Current Calculated Values ---
     float movingAverageAngleXZ = 0.0;
     float movingAverageAngleYZ = 0.0;
+
+    // --- Published Running Totals ---
+    // The main loop is the only writer and the BLE callback task the only
+    // reader. Totals are cumulative and never reset, so the reader derives
+    // interval aggregates by differencing two snapshots instead of clearing
+    // state the writer is still using.
+    struct Totals {
+        unsigned long timestampMs;
+        uint32_t sampleCount;
+        double movementSum;
+        double angleXZSum;
+        double angleYZSum;
+        float angleXZ; // Moving average, for an interval without samples
+        float angleYZ;
+    };
+
+    // Two copies guarded by a sequence counter (a "latch"): the writer bumps
+    // the sequence before touching each copy, and readers take the copy that
+    // is not being modified. A reader that preempts the writer never spins.
+    Totals published[2] = {};
+    std::atomic<uint32_t> publishSeq{0};
+    uint32_t sampleCount = 0;
+    double movementSum = 0.0;
+    double angleXZSum = 0.0;
+    double angleYZSum = 0.0;
+
+    // Reader-side state: totals at the previous interval boundary.
+    Totals lastBoundary = {};
     
 public:
-    IMUManager() : 
-        readTimer(100) // Read every 100ms
+    IMUManager(Params& parameters, BootStats& bootStats) :
+        params(parameters),
+        boot(bootStats),
+        readTimer(parameters.get(PARAM_IMU_INTERVAL_MS))
     {}
 
     void setup(EventManager* em) override {
@@ -43,6 +86,8 @@ public:
         // The LIS2DH12 library uses Wire, so it should be initialized.
         // It's often safe to call Wire.begin() multiple times.
         Wire.begin(); 
+        eventManager->subscribe(EVT_CONFIG_CHANGED, this);
+        readTimer.interval = params.get(PARAM_IMU_INTERVAL_MS); // Loaded from NVS after construction
         
         // The begin function returns a status, 0 on success
         if (sensor.begin() != 0) {
@@ -51,6 +96,15 @@ public:
         } else {            
             Serial.println("Could not initialize IMU sensor.");
         }
+        boot.mark(BOOT_IMU);
+    }
+
+    void onEvent(Event& event) override {
+        if (event.type != EVT_CONFIG_CHANGED) return;
+        ConfigChangedEvent& e = static_cast<ConfigChangedEvent&>(event);
+        if (e.key == CONFIG_PARAM && e.param == PARAM_IMU_INTERVAL_MS) {
+            readTimer.interval = params.get(PARAM_IMU_INTERVAL_MS);
+        }
     }
 
     void update() override {
@@ -84,23 +138,72 @@ public:
             movingAverageAngleXZ = sumAngleXZ / readingsInHistory;
             movingAverageAngleYZ = sumAngleYZ / readingsInHistory;
 
-            // --- 3. Accumulate total movement for the current interval ---
-            totalMovementInInterval += sqrt(x_g*x_g + y_g*y_g + z_g*z_g);
+            // --- 3. Accumulate total movement and publish the running totals ---
+            float magnitude = sqrt(x_g*x_g + y_g*y_g + z_g*z_g);
+            movementSum += magnitude;
+            angleXZSum += currentAngleXZ;
+            angleYZSum += currentAngleYZ;
+            sampleCount++;
+            publishTotals();
+
+            // --- 4. A hard knock or a fall goes out without waiting for the report ---
+            if (magnitude * 1000 > params.get(PARAM_URGENT_IMPACT_MG)) {
+                UrgentEvent event(URGENT_IMPACT, "", (int16_t)min(magnitude * 1000, 32767.0f), millis());
+                eventManager->publish(event);
+            }
         }
     }
 
-    // Called by BleManager before a new scan interval begins
-    void prepareForNextInterval() {
-        // Latch the total movement from the completed interval
-        lastIntervalTotalMovement = totalMovementInInterval;
-        
-        // Reset the accumulator for the next interval
-        totalMovementInInterval = 0.0;
+    // Called by BleManager when a scan window closes. Returns the aggregates
+    // for the interval since the previous boundary and starts a new one at
+    // boundaryMs. Safe to call from the BLE callback task while update() runs.
+    ImuInterval latchInterval(unsigned long boundaryMs) {
+        Totals current = readTotals();
+
+        ImuInterval interval;
+        interval.startMs = lastBoundary.timestampMs;
+        interval.endMs = boundaryMs;
+        interval.samples = current.sampleCount - lastBoundary.sampleCount;
+        if (interval.samples > 0) {
+            interval.avgAngleXZ = (float)((current.angleXZSum - lastBoundary.angleXZSum) / interval.samples);
+            interval.avgAngleYZ = (float)((current.angleYZSum - lastBoundary.angleYZSum) / interval.samples);
+        } else {
+            interval.avgAngleXZ = current.angleXZ;
+            interval.avgAngleYZ = current.angleYZ;
+        }
+        interval.totalMovement = (float)(current.movementSum - lastBoundary.movementSum);
+
+        lastBoundary = current;
+        lastBoundary.timestampMs = boundaryMs;
+        return interval;
     }
 
     float getAverageAngleXZ() const { return movingAverageAngleXZ; }
     float getAverageAngleYZ() const { return movingAverageAngleYZ; }
-    float getTotalMovement() const { return lastIntervalTotalMovement; }
+
+private:
+    void publishTotals() {
+        Totals t = { millis(), sampleCount, movementSum, angleXZSum, angleYZSum, movingAverageAngleXZ, movingAverageAngleYZ };
+        uint32_t seq = publishSeq.load(std::memory_order_relaxed);
+
+        publishSeq.store(seq + 1, std::memory_order_release); // Readers move to copy 1
+        std::atomic_thread_fence(std::memory_order_release);
+        published[0] = t;
+        publishSeq.store(seq + 2, std::memory_order_release); // Readers move back to copy 0
+        std::atomic_thread_fence(std::memory_order_release);
+        published[1] = t;
+    }
+
+    Totals readTotals() const {
+        Totals t;
+        uint32_t seq;
+        do {
+            seq = publishSeq.load(std::memory_order_acquire);
+            t = published[seq & 1];
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while (seq != publishSeq.load(std::memory_order_relaxed));
+        return t;
+    }
 };
 
 #endif // IMU_MANAGER_H 
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define JSON_ARENA_BYTES 12288
+
+// ArduinoJson allocator over a static buffer, so parsing server commands
+// never touches the heap. Allocation bumps a pointer. Memory comes back in
+// stack order: a Scope returns the arena to where it was when the scope
+// opened, which frees every document created inside it at once. Declare
+// the Scope before the documents that use it.
+//
+// Not thread-safe: an arena belongs to one task, since scopes opened on two
+// tasks would interleave and free each other's documents.
+class JsonArena : public ArduinoJson::Allocator {
+public:
+    class Scope {
+    public:
+        explicit Scope(JsonArena& a) : arena(a), mark(a.used) {}
+        ~Scope() { arena.used = mark; }
+    private:
+        JsonArena& arena;
+        size_t mark;
+    };
+
+    void* allocate(size_t size) override {
+        size_t total = HEADER + align(size);
+        if (used + total > JSON_ARENA_BYTES) return nullptr;
+        uint8_t* block = buffer + used;
+        *(size_t*)block = size;
+        used += total;
+        if (used > highWater) highWater = used;
+        return block + HEADER;
+    }
+
+    // Only the most recent block can be given back early
+    void deallocate(void* ptr) override {
+        if (ptr && isLast(ptr)) used = (uint8_t*)ptr - HEADER - buffer;
+    }
+
+    void* reallocate(void* ptr, size_t size) override {
+        if (!ptr) return allocate(size);
+        size_t oldSize = *(size_t*)((uint8_t*)ptr - HEADER);
+        if (isLast(ptr)) {
+            // Grow or shrink in place
+            size_t start = (uint8_t*)ptr - buffer;
+            if (start + align(size) > JSON_ARENA_BYTES) return nullptr;
+            *(size_t*)((uint8_t*)ptr - HEADER) = size;
+            used = start + align(size);
+            if (used > highWater) highWater = used;
+            return ptr;
+        }
+        void* moved = allocate(size);
+        if (moved) memcpy(moved, ptr, min(oldSize, size));
+        return moved;
+    }
+
+    size_t peak() const { return highWater; }
+
+private:
+    static const size_t HEADER = 8; // Block size, keeps the block 8-byte aligned
+    static size_t align(size_t n) { return (n + 7) & ~(size_t)7; }
+
+    bool isLast(void* ptr) const {
+        size_t size = *(size_t*)((uint8_t*)ptr - HEADER);
+        return (uint8_t*)ptr + align(size) == buffer + used;
+    }
+
+    alignas(8) uint8_t buffer[JSON_ARENA_BYTES];
+    size_t used = 0;
+    size_t highWater = 0;
+};
+
+#endif // JSON_ARENA_H
@@ -0,0 +1,136 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <Arduino.h>
+#include <math.h>
+#include <stdarg.h>
+
+#define REPORT_JSON_MAX_BYTES 2048
+#define JSON_WRITER_MAX_DEPTH 6
+
+// Writes a JSON report straight into a fixed buffer, without building a
+// JsonDocument first, so encoding a report takes the same memory however
+// many beacons it lists. The caller supplies the structure; commas are
+// inserted automatically. Like ReportWriter, writes past the end are
+// dropped and flagged, so callers check overflowed() once at the end.
+class JsonWriter {
+public:
+    void begin() {
+        length = 0;
+        depth = 0;
+        overflow = false;
+        open('{');
+    }
+
+    void end() { close('}'); }
+
+    void beginObject(const char* key = nullptr) {
+        separate(key);
+        open('{');
+    }
+    void endObject() { close('}'); }
+
+    void beginArray(const char* key = nullptr) {
+        separate(key);
+        open('[');
+    }
+    void endArray() { close(']'); }
+
+    // Members of an object
+    void add(const char* key, const char* v) { separate(key); putString(v); }
+    void add(const char* key, int v) { separate(key); putf("%d", v); }
+    void add(const char* key, unsigned int v) { separate(key); putf("%u", v); }
+    void add(const char* key, long v) { separate(key); putf("%ld", v); }
+    void add(const char* key, unsigned long v) { separate(key); putf("%lu", v); }
+    void add(const char* key, long long v) { separate(key); putf("%lld", v); }
+    void add(const char* key, float v) { separate(key); putFloat(v); }
+    void add(const char* key, bool v) { separate(key); putf(v ? "true" : "false"); }
+
+    // Elements of an array
+    void value(const char* v) { add(nullptr, v); }
+    void value(int v) { add(nullptr, v); }
+    void value(unsigned int v) { add(nullptr, v); }
+    void value(long v) { add(nullptr, v); }
+    void value(unsigned long v) { add(nullptr, v); }
+
+    const uint8_t* data() const { return buffer; }
+    size_t size() const { return length; }
+    bool overflowed() const { return overflow; }
+
+private:
+    void open(char c) {
+        put(c);
+        if (depth < JSON_WRITER_MAX_DEPTH) first[depth] = true;
+        depth++;
+    }
+
+    void close(char c) {
+        if (depth > 0) depth--;
+        put(c);
+    }
+
+    // Comma before every member or element but the first, then the key
+    void separate(const char* key) {
+        bool& isFirst = first[min(depth, JSON_WRITER_MAX_DEPTH) - 1];
+        if (!isFirst) put(',');
+        isFirst = false;
+        if (key) {
+            putString(key);
+            put(':');
+        }
+    }
+
+    void putString(const char* s) {
+        put('"');
+        for (; *s; s++) {
+            uint8_t c = *s;
+            if (c == '"' || c == '\\') {
+                put('\\');
+                put(c);
+            } else if (c < 0x20) {
+                putf("\\u%04x", c);
+            } else {
+                put(c);
+            }
+        }
+        put('"');
+    }
+
+    void putFloat(float v) {
+        if (!isfinite(v)) {
+            putf("null"); // Like ArduinoJson: JSON has no NaN
+        } else {
+            putf("%.3f", v);
+        }
+    }
+
+    void putf(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        size_t room = REPORT_JSON_MAX_BYTES - length;
+        int n = vsnprintf((char*)buffer + length, room, format, args);
+        va_end(args);
+        if (n < 0 || (size_t)n >= room) {
+            overflow = true;
+            length = REPORT_JSON_MAX_BYTES;
+            return;
+        }
+        length += n;
+    }
+
+    void put(uint8_t c) {
+        if (length >= REPORT_JSON_MAX_BYTES) {
+            overflow = true;
+            return;
+        }
+        buffer[length++] = c;
+    }
+
+    uint8_t buffer[REPORT_JSON_MAX_BYTES];
+    size_t length = 0;
+    bool first[JSON_WRITER_MAX_DEPTH];
+    int depth = 0;
+    bool overflow = false;
+};
+
+#endif // JSON_WRITER_H
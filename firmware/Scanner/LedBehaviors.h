@@ -1,224 +1,266 @@
 #ifndef LED_BEHAVIORS_H
 #define LED_BEHAVIORS_H
 
-#include <Adafruit_NeoPixel.h>
-#include "Timer.h"
 #include <ArduinoJson.h>
+#include <atomic>
 #include "Utils.h"
+#include "LedMath.h"
+#include "LedTimeline.h"
+#include "LedCanvas.h"
+
+// A behavior's parameters in binary form. Presets keep them like this, so
+// playing one does not parse anything.
+struct LedParams {
+    uint32_t color = 0;
+    uint32_t values[2] = {}; // HeartBeat: pulse duration and interval. Cycle: delay
+    LedTimeline track;       // Timeline: the keyframes. Last, so presets can leave it out
+};
 
 // --- LED Behavior Base Class ---
+// Behaviors draw into the canvas of the compositor layer they play on;
+// LedManager blends the layers and presents the frame after each tick.
 class LedBehavior {
 public:
     const char* type;
     virtual ~LedBehavior() {}
-    virtual void setup(Adafruit_NeoPixel& pixels) {
+    // startMs is the millis() the effect is timed from; it can lie slightly in
+    // the past when the effect was scheduled for a shared start time.
+    virtual void setup(LedCanvas& pixels, unsigned long startMs) {
         this->pixels = &pixels;
     }
-    virtual void update() = 0;
-    virtual void updateParams(JsonObject& params) {}
+    // Returns true if the canvas changed
+    virtual bool update() = 0;
+
+    // Params a command leaves out keep their current values
+    void updateParams(JsonObject& params) {
+        LedParams p;
+        saveParams(p);
+        if (parseParams(params, p)) loadParams(p);
+    }
+    virtual void saveParams(LedParams& p) const {}
+    // Merges the JSON params over p; false if they are invalid
+    virtual bool parseParams(JsonObject& params, LedParams& p) const { return true; }
+    virtual void loadParams(const LedParams& p) {}
 
 protected:
     LedBehavior(const char* type) : type(type) {}
-    Adafruit_NeoPixel* pixels;
+    LedCanvas* pixels;
     uint32_t scaleColor(uint32_t color, uint8_t brightness) {
-        uint8_t r = (uint8_t)(((color >> 16) & 0xFF) * brightness / 255);
-        uint8_t g = (uint8_t)(((color >> 8) & 0xFF) * brightness / 255);
-        uint8_t b = (uint8_t)((color & 0xFF) * brightness / 255);
-        return pixels->Color(r, g, b);
+        return LedMath::scaleColor(color, brightness);
+    }
+};
+
+// --- Timeline Behavior ---
+// Plays a keyframe track. The main loop builds tracks into the buffer the
+// ticker is not reading and then publishes it; setup(), which runs on the
+// LED ticker, copies the published one to `active`. The ticker preempts the
+// loop and never the other way round, so a copy never sees half a track.
+class TimelineBehavior : public LedBehavior {
+public:
+    TimelineBehavior(const char* type = "Timeline") : LedBehavior(type) {}
+
+    // params: { "loop": true, "duration": 2000,
+    //           "keyframes": [[0, "linear", "#000000"], [500, "sine", ["#FF0000", "#00FF00"]]] }
+    // Each keyframe is [time_ms, easing, color or per-pixel colors]; the easing
+    // (step, linear, in_out, sine) applies to the segment after the keyframe.
+    bool parseParams(JsonObject& params, LedParams& p) const override {
+        LedTimeline& track = p.track;
+        if (params.containsKey("keyframes")) track.clear();
+
+        JsonArray keyframes = params["keyframes"];
+        for (JsonVariant kf : keyframes) {
+            unsigned long t = kf[0].as<unsigned long>();
+            TimelineEasing easing = parseEasing(kf[1] | "linear");
+            bool added;
+            if (kf[2].is<JsonArray>()) {
+                uint32_t colors[LED_COUNT];
+                int count = 0;
+                for (JsonVariant c : kf[2].as<JsonArray>()) {
+                    if (count < LED_COUNT) colors[count++] = hexToColor(c.as<const char*>());
+                }
+                added = track.addKeyframe(t, easing, colors, count);
+            } else {
+                added = track.addKeyframe(t, easing, hexToColor(kf[2].as<const char*>()));
+            }
+            if (!added) {
+                Serial.printf("Timeline rejected: keyframes must be in time order, max %d.\n", TIMELINE_MAX_KEYFRAMES);
+                return false;
+            }
+        }
+        if (params.containsKey("loop")) {
+            track.setLoop(params["loop"].as<bool>());
+        }
+        if (params.containsKey("duration")) {
+            track.setDuration(params["duration"].as<unsigned long>());
+        }
+        track.finalize();
+        return true;
     }
+
+    void saveParams(LedParams& p) const override { p.track = tracks[published.load()]; }
+    void loadParams(const LedParams& p) override {
+        stage() = p.track;
+        publish();
+    }
+
+    void setup(LedCanvas& pixels, unsigned long startMs) override {
+        LedBehavior::setup(pixels, startMs);
+        active = tracks[published.load()];
+        active.restart(startMs);
+    }
+
+    bool update() override {
+        return active.render(millis(), *pixels);
+    }
+
+protected:
+    static TimelineEasing parseEasing(const char* name) {
+        if (strcmp(name, "step") == 0) return EASE_STEP;
+        if (strcmp(name, "in_out") == 0) return EASE_IN_OUT;
+        if (strcmp(name, "sine") == 0) return EASE_SINE;
+        return EASE_LINEAR;
+    }
+
+    // The track to build; setup() plays it once it is published
+    LedTimeline& stage() { return tracks[published.load() ^ 1]; }
+    void publish() { published.store(published.load() ^ 1); }
+
+    LedTimeline tracks[2];
+    std::atomic<uint8_t> published{0};
+    LedTimeline active;
 };
 
-// --- Concrete LED Behaviors ---
+// --- Preset LED Behaviors ---
+// The named behaviors the server can select. Each one translates its
+// parameters into a keyframe track and lets the timeline engine play it.
 
 // 1. LedsOffBehavior
-class LedsOffBehavior : public LedBehavior {
+class LedsOffBehavior : public TimelineBehavior {
 public:
-    LedsOffBehavior() : LedBehavior("Off") {}
-    void setup(Adafruit_NeoPixel& pixels) override {
-        LedBehavior::setup(pixels);
-        this->pixels->clear();
-        this->pixels->show();
-    }
-    void update() override {
-        // Do nothing, LEDs are off
+    LedsOffBehavior() : TimelineBehavior("Off") {
+        stage().addKeyframe(0, EASE_STEP, 0);
+        stage().finalize();
+        publish();
     }
+    bool parseParams(JsonObject& params, LedParams& p) const override { return true; }
+    void loadParams(const LedParams& p) override {}
 };
 
 // 2. SolidBehavior
-class SolidBehavior : public LedBehavior {
+class SolidBehavior : public TimelineBehavior {
 public:
     uint32_t color;
-    SolidBehavior(uint32_t color = 0) : LedBehavior("Solid"), color(color) {}
+    SolidBehavior(uint32_t color = 0) : TimelineBehavior("Solid"), color(color) {
+        build();
+    }
+
+    void saveParams(LedParams& p) const override { p.color = color; }
 
-    void updateParams(JsonObject& params) override {
-        color = hexToColor(params["color"].as<String>());
+    bool parseParams(JsonObject& params, LedParams& p) const override {
+        if (params.containsKey("color")) p.color = hexToColor(params["color"].as<const char*>());
+        return true;
     }
 
-    void setup(Adafruit_NeoPixel& pixels) override {
-        LedBehavior::setup(pixels);
-        this->pixels->fill(color);
-        this->pixels->show();
+    void loadParams(const LedParams& p) override {
+        color = p.color;
+        build();
     }
-    void update() override {
-        // Do nothing, color is set in setup.
+
+private:
+    void build() {
+        LedTimeline& track = stage();
+        track.clear();
+        track.addKeyframe(0, EASE_STEP, color);
+        track.finalize();
+        publish();
     }
 };
 
-// 2. BreathingBehavior
-class BreathingBehavior : public LedBehavior {
+// 3. BreathingBehavior
+class BreathingBehavior : public TimelineBehavior {
 public:
     uint32_t color;
-    BreathingBehavior(uint32_t color) : LedBehavior("Breathing"), color(color), updateTimer(1000 / 50) {} // 50Hz for smooth animation
+    BreathingBehavior(uint32_t color) : TimelineBehavior("Breathing"), color(color) {
+        build();
+    }
+
+    void saveParams(LedParams& p) const override { p.color = color; }
 
-    void updateParams(JsonObject& params) override {
-        color = hexToColor(params["color"].as<String>());
+    bool parseParams(JsonObject& params, LedParams& p) const override {
+        if (params.containsKey("color")) p.color = hexToColor(params["color"].as<const char*>());
+        return true;
     }
 
-    void setup(Adafruit_NeoPixel& pixels) override {
-        LedBehavior::setup(pixels);
-        updateTimer.reset();
+    void loadParams(const LedParams& p) override {
+        color = p.color;
+        build();
     }
 
-    void update() override {
-        if (updateTimer.checkAndReset()) {
-            float sine_wave = sin(millis() * 2.0 * PI / 4000.0); // 4-second period
-            uint8_t brightness = (uint8_t)(((sine_wave + 1.0) / 2.0) * 255.0);
-            pixels->fill(scaleColor(color, brightness));
-            pixels->show();
-        }
+    void setColor(uint32_t c) {
+        color = c;
+        build();
     }
 
 private:
-    Timer updateTimer;
+    static const unsigned long PERIOD_MS = 4000;
+
+    void build() {
+        LedTimeline& track = stage();
+        track.clear();
+        track.addKeyframe(0, EASE_SINE, 0);
+        track.addKeyframe(PERIOD_MS / 2, EASE_SINE, color);
+        track.setDuration(PERIOD_MS);
+        track.finalize();
+        publish();
+    }
 };
 
-// 3. HeartBeatBehavior
-class HeartBeatBehavior : public LedBehavior {
+// 4. HeartBeatBehavior
+class HeartBeatBehavior : public TimelineBehavior {
 public:
     uint32_t color;
     unsigned long pulse_duration;
     unsigned long pulse_interval;
 
     HeartBeatBehavior(uint32_t color = 0, unsigned long duration = 770, unsigned long interval = 2000) 
-        : LedBehavior("HeartBeat"), 
+        : TimelineBehavior("HeartBeat"), 
           color(color), 
           pulse_duration(duration), 
-          pulse_interval(interval), 
-          intervalTimer(interval), 
-          beatTimer(0), // interval is set dynamically
-          state(IDLE) {}
+          pulse_interval(interval) {
+        build();
+    }
+
+    void saveParams(LedParams& p) const override {
+        p.color = color;
+        p.values[0] = pulse_duration;
+        p.values[1] = pulse_interval;
+    }
 
-    void updateParams(JsonObject& params) override {
+    bool parseParams(JsonObject& params, LedParams& p) const override {
         if (params.containsKey("color")) {
-            color = hexToColor(params["color"].as<String>());
+            p.color = hexToColor(params["color"].as<const char*>());
         }
         if (params.containsKey("pulse_duration")) {
-            pulse_duration = params["pulse_duration"].as<unsigned long>();
+            p.values[0] = params["pulse_duration"].as<unsigned long>();
         }
         if (params.containsKey("pulse_interval")) {
-            pulse_interval = params["pulse_interval"].as<unsigned long>();
-            intervalTimer.interval = pulse_interval;
+            p.values[1] = params["pulse_interval"].as<unsigned long>();
         }
+        return true;
     }
 
-    void setup(Adafruit_NeoPixel& pixels) override {
-        LedBehavior::setup(pixels);
-        state = IDLE;
-        intervalTimer.reset();
-        this->pixels->clear();
-        this->pixels->show();
-    }
-
-    void update() override {
-        switch (state) {
-            case IDLE:
-                if (intervalTimer.checkAndReset()) {
-                    state = FADE_IN_1;
-                    beatTimer.interval = getScaledDuration(FADE_IN_1_DUR);
-                    beatTimer.reset();
-                }
-                break;
-            case FADE_IN_1: {
-                unsigned long elapsed = millis() - beatTimer.last_update;
-                if (elapsed >= beatTimer.interval) {
-                    pixels->fill(color);
-                    pixels->show();
-                    state = FADE_OUT_1;
-                    beatTimer.interval = getScaledDuration(FADE_OUT_1_DUR);
-                    beatTimer.reset();
-                } else {
-                    uint8_t brightness = (elapsed * 255) / beatTimer.interval;
-                    pixels->fill(scaleColor(color, brightness));
-                    pixels->show();
-                }
-                break;
-            }
-            case FADE_OUT_1: {
-                 unsigned long elapsed = millis() - beatTimer.last_update;
-                if (elapsed >= beatTimer.interval) {
-                    pixels->clear();
-                    pixels->show();
-                    state = PAUSE;
-                    beatTimer.interval = getScaledDuration(PAUSE_DUR);
-                    beatTimer.reset();
-                } else {
-                    uint8_t brightness = 255 - (elapsed * 255 / beatTimer.interval);
-                    pixels->fill(scaleColor(color, brightness));
-                    pixels->show();
-                }
-                break;
-            }
-            case PAUSE:
-                if (beatTimer.checkAndReset()) {
-                    state = FADE_IN_2;
-                    beatTimer.interval = getScaledDuration(FADE_IN_2_DUR);
-                    beatTimer.reset();
-                }
-                break;
-            case FADE_IN_2: {
-                 unsigned long elapsed = millis() - beatTimer.last_update;
-                if (elapsed >= beatTimer.interval) {
-                    pixels->fill(color);
-                    pixels->show();
-                    state = FADE_OUT_2;
-                    beatTimer.interval = getScaledDuration(FADE_OUT_2_DUR);
-                    beatTimer.reset();
-                } else {
-                    uint8_t brightness = (elapsed * 255) / beatTimer.interval;
-                    pixels->fill(scaleColor(color, brightness));
-                    pixels->show();
-                }
-                break;
-            }
-            case FADE_OUT_2: {
-                unsigned long elapsed = millis() - beatTimer.last_update;
-                if (elapsed >= beatTimer.interval) {
-                    pixels->clear();
-                    pixels->show();
-                    state = IDLE;
-                } else {
-                    uint8_t brightness = 255 - (elapsed * 255 / beatTimer.interval);
-                    pixels->fill(scaleColor(color, brightness));
-                    pixels->show();
-                }
-                break;
-            }
-        }
+    void loadParams(const LedParams& p) override {
+        setParams(p.color, p.values[0], p.values[1]);
     }
 
     void setParams(uint32_t c, unsigned long dur, unsigned long inter) {
         color = c;
         pulse_duration = dur;
         pulse_interval = inter;
-        intervalTimer.interval = inter;
+        build();
     }
 
 private:
-    enum BeatState { IDLE, FADE_IN_1, FADE_OUT_1, PAUSE, FADE_IN_2, FADE_OUT_2 };
-    BeatState state;
-    Timer intervalTimer; // Time between heartbeats
-    Timer beatTimer;   // Time for individual fades/pauses
-
     static const unsigned long BASE_DURATION = 770;
     static const unsigned long FADE_IN_1_DUR = 60;
     static const unsigned long FADE_OUT_1_DUR = 150;
@@ -230,39 +272,77 @@ private:
         if (pulse_duration == 0 || BASE_DURATION == 0) return 0;
         return (base_part_duration * pulse_duration) / BASE_DURATION;
     }
+
+    // Dark until the beat, then two linear pulses ("lub-dub"). A beat starts
+    // every pulse_interval, or back-to-back if the beat is longer than that.
+    void build() {
+        unsigned long beat = getScaledDuration(FADE_IN_1_DUR) + getScaledDuration(FADE_OUT_1_DUR)
+                           + getScaledDuration(PAUSE_DUR) + getScaledDuration(FADE_IN_2_DUR)
+                           + getScaledDuration(FADE_OUT_2_DUR);
+        unsigned long period = pulse_interval > beat ? pulse_interval : beat;
+        unsigned long t = period - beat;
+
+        LedTimeline& track = stage();
+        track.clear();
+        track.addKeyframe(0, EASE_STEP, 0);
+        track.addKeyframe(t, EASE_LINEAR, 0);
+        t += getScaledDuration(FADE_IN_1_DUR);
+        track.addKeyframe(t, EASE_LINEAR, color);
+        t += getScaledDuration(FADE_OUT_1_DUR);
+        track.addKeyframe(t, EASE_STEP, 0);
+        t += getScaledDuration(PAUSE_DUR);
+        track.addKeyframe(t, EASE_LINEAR, 0);
+        t += getScaledDuration(FADE_IN_2_DUR);
+        track.addKeyframe(t, EASE_LINEAR, color);
+        track.setDuration(period);
+        track.finalize();
+        publish();
+    }
 };
 
 
-// 4. CycleBehavior
-class CycleBehavior : public LedBehavior {
+// 5. CycleBehavior
+class CycleBehavior : public TimelineBehavior {
 public:
     uint32_t color;
     int delay;
-    CycleBehavior(uint32_t color, int delay) : LedBehavior("Cycle"), color(color), delay(delay), updateTimer(delay) {}
+    CycleBehavior(uint32_t color, int delay) : TimelineBehavior("Cycle"), color(color), delay(delay) {
+        build();
+    }
 
-    void updateParams(JsonObject& params) override {
-        color = hexToColor(params["color"].as<String>());
-        delay = params["delay"].as<int>();
+    void saveParams(LedParams& p) const override {
+        p.color = color;
+        p.values[0] = delay;
     }
 
-    void setup(Adafruit_NeoPixel& pixels) override {
-        LedBehavior::setup(pixels);
-        updateTimer.reset();
-        currentPixel = 0;
+    bool parseParams(JsonObject& params, LedParams& p) const override {
+        if (params.containsKey("color")) p.color = hexToColor(params["color"].as<const char*>());
+        if (params.containsKey("delay")) p.values[0] = params["delay"].as<int>();
+        return true;
     }
 
-    void update() override {
-        if (updateTimer.checkAndReset()) {
-            pixels->clear();
-            pixels->setPixelColor(currentPixel, color);
-            pixels->show();
-            currentPixel = (currentPixel + 1) % pixels->numPixels();
-        }
+    void loadParams(const LedParams& p) override {
+        color = p.color;
+        delay = p.values[0];
+        build();
     }
 
 private:
-    Timer updateTimer;
-    int currentPixel;
+    static_assert(LED_COUNT <= TIMELINE_MAX_KEYFRAMES, "Cycle needs one keyframe per pixel");
+
+    // One step keyframe per pixel, each lighting only that pixel
+    void build() {
+        LedTimeline& track = stage();
+        track.clear();
+        uint32_t colors[LED_COUNT];
+        for (int i = 0; i < LED_COUNT; i++) {
+            for (int j = 0; j < LED_COUNT; j++) colors[j] = (i == j) ? color : 0;
+            track.addKeyframe((unsigned long)i * delay, EASE_STEP, colors, LED_COUNT);
+        }
+        track.setDuration((unsigned long)LED_COUNT * delay);
+        track.finalize();
+        publish();
+    }
 };
 
-#endif // LED_BEHAVIORS_H 
\ No newline at end of file
+#endif // LED_BEHAVIORS_H
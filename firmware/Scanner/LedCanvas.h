@@ -0,0 +1,54 @@
+#ifndef LED_CANVAS_H
+#define LED_CANVAS_H
+
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+
+// An off-screen RGBA pixel buffer that a behavior draws into. Each
+// compositor layer owns one; pixels that were never drawn stay transparent.
+class LedCanvas {
+public:
+    LedCanvas() { clear(); }
+
+    void clear() {
+        memset(rgb, 0, sizeof(rgb));
+        memset(alpha, 0, sizeof(alpha));
+    }
+
+    void fill(uint32_t color, uint8_t a = 255) {
+        fill((color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF, a);
+    }
+
+    void fill(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) {
+        for (uint16_t i = 0; i < LED_COUNT; i++) {
+            rgb[i][0] = r;
+            rgb[i][1] = g;
+            rgb[i][2] = b;
+            alpha[i] = a;
+        }
+    }
+
+    void setPixelColor(uint16_t i, uint32_t color, uint8_t a = 255) {
+        setPixelColor(i, (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF, a);
+    }
+
+    void setPixelColor(uint16_t i, uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) {
+        if (i >= LED_COUNT) return;
+        rgb[i][0] = r;
+        rgb[i][1] = g;
+        rgb[i][2] = b;
+        alpha[i] = a;
+    }
+
+    uint16_t numPixels() const { return LED_COUNT; }
+
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) {
+        return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+    }
+
+    uint8_t rgb[LED_COUNT][3];
+    uint8_t alpha[LED_COUNT];
+};
+
+#endif // LED_CANVAS_H
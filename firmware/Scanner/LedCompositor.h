@@ -0,0 +1,185 @@
+#ifndef LED_COMPOSITOR_H
+#define LED_COMPOSITOR_H
+
+#include <Adafruit_NeoPixel.h>
+#include <atomic>
+#include "config.h"
+#include "LedCanvas.h"
+#include "LedBehaviors.h"
+#include "LedMath.h"
+
+// Layers from bottom to top
+enum LedLayer {
+    LAYER_BASE,     // Effect selected by the server
+    LAYER_STATUS,   // Connection status indicator
+    LAYER_ALERT,    // Short-lived effects that expire on their own
+    LED_LAYER_COUNT
+};
+
+enum BlendMode {
+    BLEND_NORMAL,   // Alpha-over
+    BLEND_ADD,      // Saturating add
+    BLEND_LIGHTEN   // Per-channel maximum; black leaves the layers below visible
+};
+
+// Renders one behavior per layer into its own canvas and blends the layers
+// into the strip's buffer. Composites of the lower layers are cached, so a
+// tick only re-blends from the lowest layer that changed, and a tick where
+// no layer changed does no blending at all.
+//
+// setBehavior() and clear() may be called from the main loop; the switch is
+// applied by render() on the LED ticker.
+class LedCompositor {
+public:
+    LedCompositor() {
+        memset(composite, 0, sizeof(composite));
+        setBlend(LAYER_BASE, BLEND_NORMAL);
+        setBlend(LAYER_STATUS, BLEND_LIGHTEN);
+        setBlend(LAYER_ALERT, BLEND_NORMAL);
+    }
+
+    void setBlend(LedLayer layer, BlendMode mode, uint8_t opacity = 255) {
+        layers[layer].blend = mode;
+        layers[layer].opacity = opacity;
+        layers[layer].forceDirty = true;
+    }
+
+    // Plays a behavior on a layer. With durationMs > 0 the layer clears
+    // itself once the time has passed. With startAt set, the behavior is
+    // started at that millis() and its animation is timed from it exactly,
+    // even though the switch itself lands on the next tick.
+    void setBehavior(LedLayer layer, LedBehavior* behavior, unsigned long durationMs = 0,
+                     bool scheduled = false, unsigned long startAt = 0) {
+        if (!behavior) {
+            clear(layer);
+            return;
+        }
+        // Fill the request the ticker is not reading, then hand it over whole
+        Layer& l = layers[layer];
+        Switch& request = l.requests[l.nextRequest];
+        l.nextRequest ^= 1;
+        request.behavior = behavior;
+        request.durationMs = durationMs;
+        request.startAt = startAt;
+        request.scheduled = scheduled;
+        l.pending.store(&request);
+    }
+
+    void clear(LedLayer layer) {
+        layers[layer].clearRequested.store(true);
+    }
+
+    // Rewrites the strip's buffer on the next render, e.g. after its
+    // brightness changed. Call from the rendering context.
+    void repaint() {
+        layers[LED_LAYER_COUNT - 1].forceDirty = true;
+    }
+
+    // Returns true if the strip's buffer was rewritten.
+    bool render(Adafruit_NeoPixel& strip, unsigned long nowMs) {
+        int lowestDirty = LED_LAYER_COUNT;
+        for (int k = LED_LAYER_COUNT - 1; k >= 0; k--) {
+            if (updateLayer(layers[k], nowMs)) lowestDirty = k;
+        }
+        if (lowestDirty == LED_LAYER_COUNT) return false;
+
+        for (int k = lowestDirty; k < LED_LAYER_COUNT; k++) {
+            blendLayer(layers[k], composite[k], composite[k + 1]);
+        }
+        const uint8_t (*out)[3] = composite[LED_LAYER_COUNT];
+        for (uint16_t i = 0; i < LED_COUNT; i++) {
+            strip.setPixelColor(i, out[i][0], out[i][1], out[i][2]);
+        }
+        return true;
+    }
+
+private:
+    // A setBehavior() call, handed to the ticker as a whole
+    struct Switch {
+        LedBehavior* behavior;
+        unsigned long durationMs;
+        unsigned long startAt;
+        bool scheduled;
+    };
+
+    struct Layer {
+        LedBehavior* behavior = nullptr;
+        LedCanvas canvas;
+        BlendMode blend = BLEND_NORMAL;
+        uint8_t opacity = 255;
+        bool forceDirty = true;
+        unsigned long expiresAt = 0; // 0 = never
+        // The loop fills one request while the ticker may still read the
+        // other; the ticker preempts the loop, never the other way round
+        Switch requests[2] = {};
+        uint8_t nextRequest = 0;
+        std::atomic<const Switch*> pending{nullptr};
+        std::atomic<bool> clearRequested{false};
+    };
+
+    // Applies pending changes and advances the layer's behavior.
+    // Returns true if the layer's canvas or blend settings changed.
+    bool updateLayer(Layer& layer, unsigned long nowMs) {
+        bool dirty = layer.forceDirty;
+        layer.forceDirty = false;
+
+        const Switch* next = layer.pending.load();
+        unsigned long startMs = nowMs;
+        if (next && next->scheduled) {
+            startMs = next->startAt;
+            if ((long)(nowMs - startMs) < 0) next = nullptr; // Not due yet
+        }
+        if (next && layer.pending.compare_exchange_strong(next, nullptr)) {
+            layer.behavior = next->behavior;
+            unsigned long duration = next->durationMs;
+            layer.expiresAt = duration > 0 ? (startMs + duration) | 1 : 0; // Never 0 ("no expiry")
+            layer.canvas.clear();
+            layer.behavior->setup(layer.canvas, startMs);
+            dirty = true;
+        }
+
+        bool expired = layer.expiresAt != 0 && (long)(nowMs - layer.expiresAt) >= 0;
+        if (layer.clearRequested.exchange(false) || expired) {
+            layer.behavior = nullptr;
+            layer.expiresAt = 0;
+            layer.canvas.clear();
+            return true;
+        }
+
+        if (layer.behavior && layer.behavior->update()) {
+            dirty = true;
+        }
+        return dirty;
+    }
+
+    static void blendLayer(const Layer& layer, const uint8_t (*below)[3], uint8_t (*out)[3]) {
+        for (uint16_t i = 0; i < LED_COUNT; i++) {
+            uint8_t a = LedMath::scale8(layer.canvas.alpha[i], layer.opacity);
+            for (int c = 0; c < 3; c++) {
+                uint8_t dst = below[i][c];
+                uint8_t src = layer.canvas.rgb[i][c];
+                switch (layer.blend) {
+                    case BLEND_ADD: {
+                        unsigned sum = dst + LedMath::scale8(src, a);
+                        out[i][c] = sum > 255 ? 255 : sum;
+                        break;
+                    }
+                    case BLEND_LIGHTEN: {
+                        uint8_t s = LedMath::scale8(src, a);
+                        out[i][c] = s > dst ? s : dst;
+                        break;
+                    }
+                    default:
+                        out[i][c] = dst + (((int)src - dst) * (a + (a >> 7)) >> 8);
+                        break;
+                }
+            }
+        }
+    }
+
+    Layer layers[LED_LAYER_COUNT];
+    // composite[k] holds layers 0..k-1 blended onto black
+    uint8_t composite[LED_LAYER_COUNT + 1][LED_COUNT][3];
+};
+
+#endif // LED_COMPOSITOR_H
@@ -6,43 +6,102 @@
 #include "Process.h"
 #include "config.h"
 #include "LedBehaviors.h"
+#include "FrameBuffer.h"
+#include "LedCompositor.h"
+#include "Params.h"
+#include "BootStats.h"
+#include <atomic>
 
 class LedManager : public Process {
 public:
-    LedManager() : Process(), pixels(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800), currentBehavior(nullptr) {
+    LedManager(Params& parameters, BootStats& bootStats)
+        : Process(), pixels(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800), frame(pixels), params(parameters), boot(bootStats) {
     }
 
     ~LedManager() {
         ledTicker.detach();
     }
 
+    // The setters below may be called from the main loop while the ticker is
+    // rendering; the compositor applies the switch on the next tick.
+
+    // Server-selected effect on the base layer
     void setBehavior(LedBehavior* newBehavior) {
-        currentBehavior = newBehavior;
-        if (currentBehavior) {
-            currentBehavior->setup(pixels);
-        }
+        compositor.setBehavior(LAYER_BASE, newBehavior);
+    }
+
+    // Same, but starting at a given millis(), e.g. a fleet-wide start time
+    void setBehaviorAt(LedBehavior* newBehavior, unsigned long startAtMs) {
+        compositor.setBehavior(LAYER_BASE, newBehavior, 0, true, startAtMs);
+    }
+
+    // Connection status indicator, drawn over the base effect
+    void setStatusBehavior(LedBehavior* newBehavior) {
+        compositor.setBehavior(LAYER_STATUS, newBehavior);
+    }
+
+    // Transient effect on top of everything that clears itself after durationMs
+    void showAlert(LedBehavior* newBehavior, unsigned long durationMs) {
+        compositor.setBehavior(LAYER_ALERT, newBehavior, durationMs);
+    }
+
+    void showAlertAt(LedBehavior* newBehavior, unsigned long durationMs, unsigned long startAtMs) {
+        compositor.setBehavior(LAYER_ALERT, newBehavior, durationMs, true, startAtMs);
     }
 
     void setup(EventManager* em) override {
         Process::setup(em);
+        eventManager->subscribe(EVT_CONFIG_CHANGED, this);
         pixels.begin();
-        pixels.setBrightness(127); // Don't set too high to avoid high current draw
+        applyStripParams();
+        frame.begin();
         // Use a lambda to call the member function, passing 'this'
-        ledTicker.attach_ms(20, +[](LedManager* instance) { instance->update(); }, this);
+        ledTicker.attach_ms(20, +[](LedManager* instance) { instance->render(); }, this);
+        boot.mark(BOOT_LEDS);
+    }
+
+    // Brightness and length change the strip's buffer, which the ticker
+    // owns; they are applied on the next tick
+    void onEvent(Event& event) override {
+        if (event.type != EVT_CONFIG_CHANGED) return;
+        ConfigChangedEvent& e = static_cast<ConfigChangedEvent&>(event);
+        if (e.key == CONFIG_PARAM && (e.param == PARAM_LED_BRIGHTNESS || e.param == PARAM_LED_COUNT)) {
+            stripChanged.store(true);
+        }
     }
 
     void update() override {
-        if (currentBehavior) {
-            currentBehavior->update();
+        // Rendering runs from the ticker, not the main loop.
+    }
+
+    void render() {
+        if (stripChanged.exchange(false)) {
+            applyStripParams();
+            compositor.repaint();
         }
+        compositor.render(pixels, millis());
+        frame.present();
     }
 
-    // Public members for access by BleManager
+    uint32_t getFramesPushed() const { return frame.getFramesPushed(); }
+    uint32_t getFramesSkipped() const { return frame.getFramesSkipped(); }
+    uint32_t getFramesDeferred() const { return frame.getFramesDeferred(); }
+    uint32_t getFramesFailed() const { return frame.getFramesFailed(); }
+
     Adafruit_NeoPixel pixels;
-    LedBehavior* currentBehavior;
 
 private:
+    void applyStripParams() {
+        pixels.setBrightness(params.get(PARAM_LED_BRIGHTNESS));
+        frame.setLength(params.get(PARAM_LED_COUNT));
+    }
+
     Ticker ledTicker;
+    FrameBuffer frame;
+    LedCompositor compositor;
+    Params& params;
+    BootStats& boot;
+    std::atomic<bool> stripChanged{false};
 };
 
 #endif // LED_MANAGER_H 
\ No newline at end of file
@@ -0,0 +1,119 @@
+#ifndef LED_MATH_H
+#define LED_MATH_H
+
+#include <stdint.h>
+#include <array>
+
+// Integer-only helpers for LED animations. The tables are generated at
+// compile time and live in flash, so behaviors never touch floating point
+// or division per frame.
+namespace LedMath {
+
+namespace detail {
+    constexpr double PI_D = 3.14159265358979323846;
+
+    // Taylor series, accurate to well below one LSB over [-PI, PI]
+    constexpr double sine(double x) {
+        while (x > PI_D) x -= 2 * PI_D;
+        while (x < -PI_D) x += 2 * PI_D;
+        double term = x, sum = x;
+        for (int n = 1; n < 12; n++) {
+            term *= -x * x / ((2 * n) * (2 * n + 1));
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr double squareRoot(double x) {
+        if (x <= 0) return 0;
+        double r = x > 1 ? x : 1;
+        for (int i = 0; i < 40; i++) r = 0.5 * (r + x / r);
+        return r;
+    }
+
+    constexpr uint8_t toByte(double v) {
+        return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v + 0.5));
+    }
+
+    // One full period mapped to 0..255, starting at the midpoint (like (sin + 1) / 2)
+    constexpr std::array<uint8_t, 256> makeSine() {
+        std::array<uint8_t, 256> t{};
+        for (int i = 0; i < 256; i++) t[i] = toByte((sine(2 * PI_D * i / 256) + 1.0) * 127.5);
+        return t;
+    }
+
+    // Smoothstep ease-in-out: 3x^2 - 2x^3
+    constexpr std::array<uint8_t, 256> makeEaseInOut() {
+        std::array<uint8_t, 256> t{};
+        for (int i = 0; i < 256; i++) {
+            double x = i / 255.0;
+            t[i] = toByte((3 * x * x - 2 * x * x * x) * 255);
+        }
+        return t;
+    }
+
+    // Perceptual correction, gamma 2.5 (x^2 * sqrt(x))
+    constexpr std::array<uint8_t, 256> makeGamma() {
+        std::array<uint8_t, 256> t{};
+        for (int i = 0; i < 256; i++) {
+            double x = i / 255.0;
+            t[i] = toByte(x * x * squareRoot(x) * 255);
+        }
+        return t;
+    }
+
+    // Fixed-point factor so that (c * factor) >> 16 == c * b / 255, rounded
+    constexpr std::array<uint16_t, 256> makeScale() {
+        std::array<uint16_t, 256> t{};
+        for (int i = 0; i < 256; i++) t[i] = (uint16_t)(i * 257);
+        return t;
+    }
+}
+
+constexpr std::array<uint8_t, 256> SINE = detail::makeSine();
+constexpr std::array<uint8_t, 256> EASE_IN_OUT = detail::makeEaseInOut();
+constexpr std::array<uint8_t, 256> GAMMA = detail::makeGamma();
+constexpr std::array<uint16_t, 256> BRIGHTNESS_SCALE = detail::makeScale();
+
+// c * brightness / 255 without a division
+inline uint8_t scale8(uint8_t c, uint8_t brightness) {
+    return (uint8_t)(((uint32_t)c * BRIGHTNESS_SCALE[brightness] + 0x8000) >> 16);
+}
+
+inline uint32_t scaleColor(uint32_t color, uint8_t brightness) {
+    uint32_t factor = BRIGHTNESS_SCALE[brightness];
+    uint32_t r = (((color >> 16) & 0xFF) * factor + 0x8000) >> 16;
+    uint32_t g = (((color >> 8) & 0xFF) * factor + 0x8000) >> 16;
+    uint32_t b = ((color & 0xFF) * factor + 0x8000) >> 16;
+    return (r << 16) | (g << 8) | b;
+}
+
+// Linearly interpolated periodic sine lookup. phase16 covers one period in 0..65535.
+inline uint8_t sine16(uint16_t phase16) {
+    uint8_t i = phase16 >> 8;
+    uint8_t frac = phase16 & 0xFF;
+    int a = SINE[i];
+    int b = SINE[(uint8_t)(i + 1)];
+    return (uint8_t)(a + (((b - a) * frac) >> 8));
+}
+
+// Reciprocal of a ramp duration, computed once per ramp so that progress
+// along the ramp is a multiply and shift instead of a division per frame.
+struct Ramp {
+    uint32_t step = 0; // (255 << 16) / duration
+
+    void begin(unsigned long duration) {
+        step = duration > 0 ? (255UL << 16) / duration : 0;
+    }
+
+    // 0..255 progress after elapsed ms; saturates at the end of the ramp
+    uint8_t at(unsigned long elapsed) const {
+        if (step == 0) return 255;
+        uint64_t v = ((uint64_t)elapsed * step) >> 16;
+        return v > 255 ? 255 : (uint8_t)v;
+    }
+};
+
+} // namespace LedMath
+
+#endif // LED_MATH_H
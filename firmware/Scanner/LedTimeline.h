@@ -0,0 +1,248 @@
+#ifndef LED_TIMELINE_H
+#define LED_TIMELINE_H
+
+#include <string.h>
+#include "config.h"
+#include "LedMath.h"
+#include "LedCanvas.h"
+
+#define TIMELINE_MAX_KEYFRAMES 12
+
+// How a segment moves from one keyframe to the next
+enum TimelineEasing : uint8_t {
+    EASE_STEP,      // Hold the keyframe's colors until the next keyframe
+    EASE_LINEAR,
+    EASE_IN_OUT,    // Smoothstep
+    EASE_SINE       // Raised cosine, (1 - cos(PI * x)) / 2
+};
+
+// Progress through each easing as a blend weight (0..256, so a blend is
+// exact at both ends), one table per TimelineEasing, so a frame looks it up
+// instead of branching. Step segments are holds and never read theirs.
+constexpr uint16_t easeWeight(uint8_t p) { return p + (p >> 7); }
+
+constexpr std::array<std::array<uint16_t, 256>, 4> makeEaseWeights() {
+    std::array<std::array<uint16_t, 256>, 4> weights{};
+    for (int x = 0; x < 256; x++) {
+        weights[EASE_STEP][x] = easeWeight(x);
+        weights[EASE_LINEAR][x] = easeWeight(x);
+        weights[EASE_IN_OUT][x] = easeWeight(LedMath::EASE_IN_OUT[x]);
+        weights[EASE_SINE][x] = easeWeight(LedMath::SINE[(uint8_t)((x >> 1) - 64)]);
+    }
+    return weights;
+}
+
+constexpr std::array<std::array<uint16_t, 256>, 4> EASE_WEIGHTS = makeEaseWeights();
+
+// A keyframe track for the LED strip: each keyframe holds a time, an easing
+// for the segment that follows it and one RGB value per pixel. Tracks live
+// in a fixed arena, so loading one never allocates. Rendering is integer-only
+// and skips frames that cannot have changed (holds and static tracks).
+class LedTimeline {
+public:
+    LedTimeline() { clear(); }
+
+    void clear() {
+        keyframeCount = 0;
+        duration = 0;
+        loop = true;
+        invalidate();
+    }
+
+    // Adds a keyframe that sets every pixel to the same color.
+    bool addKeyframe(unsigned long timeMs, TimelineEasing easing, uint32_t color) {
+        uint32_t colors[LED_COUNT];
+        for (int i = 0; i < LED_COUNT; i++) colors[i] = color;
+        return addKeyframe(timeMs, easing, colors, LED_COUNT);
+    }
+
+    // Adds a keyframe with one color per pixel. Missing pixels are off.
+    // Keyframes must be added in time order.
+    bool addKeyframe(unsigned long timeMs, TimelineEasing easing, const uint32_t* colors, int count) {
+        if (keyframeCount >= TIMELINE_MAX_KEYFRAMES) return false;
+        if (keyframeCount > 0 && timeMs < keyframes[keyframeCount - 1].timeMs) return false;
+
+        Keyframe& k = keyframes[keyframeCount];
+        k.timeMs = timeMs;
+        k.easing = easing;
+        k.uniform = true;
+        for (int i = 0; i < LED_COUNT; i++) {
+            uint32_t c = i < count ? colors[i] : 0;
+            k.rgb[i][0] = (c >> 16) & 0xFF;
+            k.rgb[i][1] = (c >> 8) & 0xFF;
+            k.rgb[i][2] = c & 0xFF;
+            if (memcmp(k.rgb[i], k.rgb[0], 3) != 0) k.uniform = false;
+        }
+        keyframeCount++;
+        invalidate();
+        return true;
+    }
+
+    // Total length of the track. For looping tracks, the time after the last
+    // keyframe is a segment back to the first one. Defaults to the time of
+    // the last keyframe.
+    void setDuration(unsigned long ms) { duration = ms; invalidate(); }
+    void setLoop(bool shouldLoop) { loop = shouldLoop; invalidate(); }
+    int getKeyframeCount() const { return keyframeCount; }
+
+    // Precomputes per-segment data. Called automatically on the first render.
+    void finalize() {
+        if (keyframeCount > 0 && duration < keyframes[keyframeCount - 1].timeMs) {
+            duration = keyframes[keyframeCount - 1].timeMs;
+        }
+        for (int i = 0; i < keyframeCount; i++) {
+            Keyframe& k = keyframes[i];
+            const Keyframe& next = keyframes[nextIndex(i)];
+            unsigned long end = (i + 1 < keyframeCount) ? next.timeMs : duration;
+            LedMath::Ramp ramp;
+            ramp.begin(end - k.timeMs);
+
+            Segment& s = k.segment;
+            s.startMs = k.timeMs;
+            s.endMs = (i + 1 < keyframeCount) ? next.timeMs : (loop && duration > 0 ? duration : ~0UL);
+            s.step = ramp.step;
+            s.easing = k.easing;
+            s.hold = k.easing == EASE_STEP || memcmp(k.rgb, next.rgb, sizeof(k.rgb)) == 0
+                     || (i + 1 == keyframeCount && !loop);
+            s.drawn = false;
+            s.uniform = k.uniform && (s.hold || next.uniform);
+            for (int c = 0; c < 3; c++) {
+                s.rgb[c] = k.rgb[0][c];
+                s.delta[c] = (int16_t)next.rgb[0][c] - k.rgb[0][c];
+            }
+        }
+        finalized = true;
+        segment.endMs = 0;
+    }
+
+    void restart(unsigned long nowMs) {
+        startMs = nowMs;
+        cursor = 0;
+        segment.endMs = 0; // Finds the segment on the first render
+    }
+
+    // Draws the track at nowMs. Returns false if the frame was left untouched.
+    bool render(unsigned long nowMs, LedCanvas& pixels) {
+        // Most frames fall in the segment of the previous one, and only
+        // read the copy of it in `segment`
+        unsigned long t = nowMs - startMs;
+        if (t >= segment.endMs) return enterSegment(nowMs, pixels);
+        if (segment.drawn) return false; // Nothing moves during a hold
+        if (!segment.uniform) return drawSegment(t, pixels);
+
+        int weight = progress(t);
+        pixels.fill(segment.rgb[0] + (segment.delta[0] * weight >> 8),
+                    segment.rgb[1] + (segment.delta[1] * weight >> 8),
+                    segment.rgb[2] + (segment.delta[2] * weight >> 8));
+        return true;
+    }
+
+private:
+    // Blend weight along the current segment at t; a hold stays on its keyframe
+    uint16_t progress(unsigned long t) {
+        if (segment.hold) {
+            segment.drawn = true;
+            return 0;
+        }
+        // t is inside the segment, so the ramp cannot overshoot
+        unsigned long elapsed = t > segment.startMs ? t - segment.startMs : 0;
+        return EASE_WEIGHTS[segment.easing][(uint32_t)elapsed * segment.step >> 16];
+    }
+
+    // seek() leaves t inside the new segment, so render() draws it
+    bool enterSegment(unsigned long nowMs, LedCanvas& pixels) {
+        if (!seek(nowMs - startMs)) return false;
+        return render(nowMs, pixels);
+    }
+
+    // Segments with more than one color
+    bool drawSegment(unsigned long t, LedCanvas& pixels) {
+        uint16_t weight = progress(t);
+        draw(keyframes[cursor], keyframes[segment.hold ? cursor : nextIndex(cursor)], weight, pixels);
+        return true;
+    }
+
+    // The next render finalizes the track again
+    void invalidate() {
+        finalized = false;
+        segment.endMs = 0;
+    }
+
+    // Finds the segment at t (from startMs) and loads it into `segment`.
+    // startMs follows the start of the current loop, so a tick never
+    // divides; only a clock jump of more than a loop takes the modulo.
+    // False if there is nothing to draw.
+    bool seek(unsigned long t) {
+        if (keyframeCount == 0) return false;
+        if (!finalized) finalize();
+        if (t >= duration) {
+            if (loop && duration > 0) {
+                unsigned long wrapped = t < 2 * duration ? t - duration : t % duration;
+                startMs += t - wrapped;
+                t = wrapped;
+                cursor = 0;
+            } else {
+                t = duration;
+            }
+        }
+        while (cursor + 1 < keyframeCount && t >= keyframes[cursor + 1].timeMs) cursor++;
+        segment = keyframes[cursor].segment;
+        return true;
+    }
+
+    // What a frame needs from the segment after a keyframe
+    struct Segment {
+        unsigned long startMs;  // From the start of the loop
+        unsigned long endMs;
+        uint32_t step;          // Of a LedMath::Ramp over the segment
+        TimelineEasing easing;
+        bool hold;              // Never changes
+        bool drawn;             // A hold that is on the strip
+        bool uniform;           // Drawn as rgb + delta * progress
+        uint8_t rgb[3];
+        int16_t delta[3];
+    };
+
+    struct Keyframe {
+        unsigned long timeMs;
+        uint8_t rgb[LED_COUNT][3];
+        TimelineEasing easing;
+        bool uniform;           // All pixels share one color
+        Segment segment;        // The one after this keyframe, built by finalize()
+    };
+
+    int nextIndex(int i) const {
+        return (i + 1 < keyframeCount) ? i + 1 : (loop ? 0 : i);
+    }
+
+    // a + (b - a) * weight / 256
+    static uint8_t lerp(uint8_t a, uint8_t b, int weight) {
+        return (uint8_t)(a + (((int)b - a) * weight >> 8));
+    }
+
+    static void draw(const Keyframe& a, const Keyframe& b, uint16_t weight, LedCanvas& pixels) {
+        if (a.uniform && b.uniform) {
+            pixels.fill(lerp(a.rgb[0][0], b.rgb[0][0], weight),
+                        lerp(a.rgb[0][1], b.rgb[0][1], weight),
+                        lerp(a.rgb[0][2], b.rgb[0][2], weight));
+            return;
+        }
+        for (int i = 0; i < LED_COUNT; i++) {
+            pixels.setPixelColor(i, lerp(a.rgb[i][0], b.rgb[i][0], weight),
+                                    lerp(a.rgb[i][1], b.rgb[i][1], weight),
+                                    lerp(a.rgb[i][2], b.rgb[i][2], weight));
+        }
+    }
+
+    Keyframe keyframes[TIMELINE_MAX_KEYFRAMES];
+    int keyframeCount;
+    unsigned long duration;
+    bool loop;
+    bool finalized;
+
+    unsigned long startMs = 0; // Start of the current loop
+    int cursor = 0;
+    Segment segment = {};      // Copy of the cursor's, for the frames inside it
+};
+
+#endif // LED_TIMELINE_H
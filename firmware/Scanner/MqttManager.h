@@ -0,0 +1,315 @@
+#ifndef MQTT_MANAGER_H
+#define MQTT_MANAGER_H
+
+#include "ServerLink.h"
+#include "ReportWriter.h"
+#include "ReportBatch.h"
+
+#define MQTT_KEEPALIVE_S 30
+#define MQTT_CONNECT_TIMEOUT_MS 2000
+#define MQTT_ACK_TIMEOUT_MS 5000    // Resend a QoS 1 report after this long without PUBACK
+#define MQTT_RETRY_MIN_MS 2000
+#define MQTT_RETRY_MAX_MS 60000
+#define MQTT_QUEUE_LEN 4
+#define MQTT_TOPIC_LEN 48
+// format:u8 captured_at:i64, then the largest report or batch
+#define MQTT_MESSAGE_MAX_BYTES (9 + (REPORT_BATCH_MAX_BYTES > REPORT_MAX_BYTES ? REPORT_BATCH_MAX_BYTES : REPORT_MAX_BYTES))
+// A PUBLISH on our cmd topic: topic, packet id, then the largest answer
+#define MQTT_RX_MAX_BYTES (2 + MQTT_TOPIC_LEN + 2 + HTTP_RESPONSE_MAX_BYTES)
+
+// Publishes reports to an MQTT broker on hitloop/<scanner>/report and
+// subscribes to hitloop/<scanner>/cmd for the server's answers and pushed
+// commands, so ingest does not depend on one HTTP server. The payload is
+// the same as a stream REPORT frame (format, capture time, body), and what
+// arrives on the cmd topic is the JSON a /data response would carry.
+//
+// Just enough MQTT 3.1.1 for that: CONNECT, PUBLISH at QoS 0 or 1,
+// SUBSCRIBE and PINGREQ. Reports are copied into a small queue and
+// published from update(); with QoS 1 one report is in flight at a time
+// and leaves the queue on its PUBACK. A full queue or a closed connection
+// leaves the report to the stream and HTTP.
+//
+// A queued report is marked `queued`, not delivered. Its outcome is
+// published again as a late event: delivered on the PUBACK (at QoS 0, once
+// written), or not delivered if the connection closes first, so ReportLog
+// keeps it. Urgent events and replays need their answer right away and are
+// left to the stream and HTTP. A command larger than rx is read and
+// dropped without closing the session.
+//
+// Must run before StreamManager and HTTPManager in the process list.
+// The broker runs on the server host, so it follows server changes.
+class MqttManager : public ServerLink {
+public:
+    MqttManager(Configuration& config, UplinkStats& uplinkStats)
+        : ServerLink(config, uplinkStats, "MQTT", MQTT_PORT, MQTT_CONNECT_TIMEOUT_MS,
+                     MQTT_RETRY_MIN_MS, MQTT_RETRY_MAX_MS) {}
+
+    void setup(EventManager* em) override {
+        ServerLink::setup(em);
+        eventManager->subscribe(EVT_DATA_READY_FOR_HTTP, this);
+    }
+
+    void onEvent(Event& event) override {
+        ServerLink::onEvent(event);
+        if (event.type == EVT_DATA_READY_FOR_HTTP) {
+            DataReadyForHttpEvent& e = static_cast<DataReadyForHttpEvent&>(event);
+            if (e.pending() && !e.urgent && !e.replay && isOpen()) e.queued = enqueue(e);
+        }
+    }
+
+    void update() override {
+        if (!maintain()) return;
+
+        while (client.available() >= 2 && readPacket()) {}
+        if (!isOpen()) return;
+
+        // The broker drops us after 1.5 keep-alive periods without a packet
+        if (millis() - lastSentMs > MQTT_KEEPALIVE_S * 1000UL / 2) {
+            const uint8_t ping[2] = { 0xC0, 0 };
+            send(ping, sizeof(ping));
+        }
+        if (millis() - lastReceivedMs > MQTT_KEEPALIVE_S * 1500UL) {
+            Serial.println("MQTT broker silent, reconnecting.");
+            close();
+            return;
+        }
+
+        publishNext();
+    }
+
+private:
+    struct Message {
+        uint16_t length;
+        const char* contentType;
+        uint8_t data[MQTT_MESSAGE_MAX_BYTES];
+    };
+
+    bool enqueue(DataReadyForHttpEvent& report) {
+        if (queued == MQTT_QUEUE_LEN || report.length + 9 > MQTT_MESSAGE_MAX_BYTES) return false;
+        Message& m = queue[(head + queued) % MQTT_QUEUE_LEN];
+        int64_t capturedAt = report.replay ? report.capturedAt : 0;
+        m.data[0] = reportFormat(report.contentType);
+        for (int i = 0; i < 8; i++) m.data[1 + i] = (uint8_t)(capturedAt >> (8 * i));
+        memcpy(m.data + 9, report.body, report.length);
+        m.length = report.length + 9;
+        m.contentType = report.contentType;
+        queued++;
+        return true;
+    }
+
+    void publishNext() {
+        if (queued == 0) return;
+        if (MQTT_REPORT_QOS == 0) {
+            if (publish(queue[head], false)) pop(true);
+            return;
+        }
+        if (inFlight) {
+            if (millis() - sentAtMs < MQTT_ACK_TIMEOUT_MS) return;
+            stats.failures++;
+            publish(queue[head], true); // Same packet id, DUP set
+            return;
+        }
+        if (++packetId == 0) packetId = 1;
+        inFlight = publish(queue[head], false);
+    }
+
+    bool publish(const Message& m, bool dup) {
+        size_t topicLength = strlen(reportTopic);
+        size_t remaining = 2 + topicLength + (MQTT_REPORT_QOS ? 2 : 0) + m.length;
+        uint8_t header[5 + 2 + MQTT_TOPIC_LEN + 2];
+        size_t n = 0;
+        header[n++] = 0x30 | (dup ? 0x08 : 0) | (MQTT_REPORT_QOS << 1);
+        n += putLength(header + n, remaining);
+        n += putString(header + n, reportTopic);
+        if (MQTT_REPORT_QOS) {
+            header[n++] = packetId >> 8;
+            header[n++] = packetId & 0xFF;
+        }
+        if (!send(header, n) || !send(m.data, m.length)) return false;
+
+        sentAtMs = millis();
+        stats.requests++;
+        stats.reused++;
+        return true;
+    }
+
+    // Removes the oldest report and publishes its outcome
+    void pop(bool delivered) {
+        const Message& m = queue[head];
+        head = (head + 1) % MQTT_QUEUE_LEN;
+        queued--;
+        DataReadyForHttpEvent outcome(m.data + 9, m.length - 9, m.contentType);
+        outcome.late = true;
+        outcome.delivered = delivered;
+        eventManager->publish(outcome);
+    }
+
+    bool handshake() override {
+        snprintf(reportTopic, sizeof(reportTopic), "hitloop/%s/report", cfg.macAddress.c_str());
+        snprintf(commandTopic, sizeof(commandTopic), "hitloop/%s/cmd", cfg.macAddress.c_str());
+
+        // CONNECT with a clean session; pending commands are repeated by the server anyway
+        uint8_t packet[2 + 10 + 2 + 32];
+        const char* clientId = cfg.macAddress.c_str();
+        size_t n = 0;
+        packet[n++] = 0x10;
+        n += putLength(packet + n, 10 + 2 + strlen(clientId));
+        n += putString(packet + n, "MQTT");
+        packet[n++] = 4;    // Protocol level 3.1.1
+        packet[n++] = 0x02; // Clean session
+        packet[n++] = MQTT_KEEPALIVE_S >> 8;
+        packet[n++] = MQTT_KEEPALIVE_S & 0xFF;
+        n += putString(packet + n, clientId);
+        if (!send(packet, n)) return false;
+
+        uint8_t type;
+        size_t length;
+        if (!readFixedHeader(type, length, MQTT_CONNECT_TIMEOUT_MS) || type != 0x20 || length != 2 ||
+            client.readBytes(rx, 2) != 2 || rx[1] != 0) {
+            Serial.println("MQTT broker refused the connection.");
+            return false;
+        }
+
+        // SUBSCRIBE to our command topic at QoS 1
+        n = 0;
+        packet[n++] = 0x82;
+        n += putLength(packet + n, 2 + 2 + strlen(commandTopic) + 1);
+        packet[n++] = 0;
+        packet[n++] = 1;
+        if (!send(packet, n)) return false;
+        n = putString(packet, commandTopic);
+        packet[n++] = 1;
+        if (!send(packet, n)) return false;
+
+        lastReceivedMs = millis();
+        return true;
+    }
+
+    // Reports still queued will not get a PUBACK from this session
+    void onClosed() override {
+        inFlight = false;
+        while (queued > 0) pop(false);
+    }
+
+    // Handles one incoming packet. False when the connection was closed.
+    bool readPacket() {
+        uint8_t type;
+        size_t length;
+        if (!readFixedHeader(type, length, MQTT_CONNECT_TIMEOUT_MS)) return false;
+        // Past rx, only the head of the packet is kept
+        size_t kept = min(length, (size_t)MQTT_RX_MAX_BYTES);
+        if (client.readBytes(rx, kept) != kept || !skip(length - kept)) {
+            close();
+            return false;
+        }
+        lastReceivedMs = millis();
+
+        switch (type & 0xF0) {
+        case 0x30: handlePublish(type, length); break;
+        case 0x40: // PUBACK
+            if (length >= 2 && inFlight && ((rx[0] << 8) | rx[1]) == packetId) {
+                stats.recordRoundTrip(millis() - sentAtMs);
+                inFlight = false;
+                pop(true);
+            }
+            break;
+        default: break; // SUBACK, PINGRESP
+        }
+        return true;
+    }
+
+    // A command or report answer from the server, as JSON
+    void handlePublish(uint8_t type, size_t length) {
+        if (length < 2) return;
+        uint8_t qos = (type >> 1) & 0x03;
+        size_t topicLength = (rx[0] << 8) | rx[1];
+        size_t offset = 2 + topicLength + (qos ? 2 : 0);
+        if (offset > length || offset > MQTT_RX_MAX_BYTES) return;
+        if (qos) {
+            const uint8_t puback[4] = { 0x40, 2, rx[2 + topicLength], rx[3 + topicLength] };
+            send(puback, sizeof(puback));
+        }
+        // Acknowledged but dropped; the server repeats a pending command
+        if (length > MQTT_RX_MAX_BYTES) {
+            Serial.println("MQTT command too large, ignored.");
+            return;
+        }
+
+        memmove(rx, rx + offset, length - offset);
+        rx[length - offset] = '\0';
+        HttpResponseEvent commandEvent((const char*)rx, length - offset, millis());
+        eventManager->publish(commandEvent);
+    }
+
+    bool readFixedHeader(uint8_t& type, size_t& length, unsigned long timeoutMs) {
+        client.setTimeout(timeoutMs);
+        if (client.readBytes(&type, 1) != 1) {
+            if (!client.connected()) close();
+            return false;
+        }
+        length = 0;
+        for (int shift = 0; shift < 28; shift += 7) {
+            uint8_t b;
+            if (client.readBytes(&b, 1) != 1) {
+                close();
+                return false;
+            }
+            length |= (size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        close();
+        return false;
+    }
+
+    bool skip(size_t length) {
+        uint8_t scratch[64];
+        while (length > 0) {
+            size_t n = min(length, sizeof(scratch));
+            if (client.readBytes(scratch, n) != n) return false;
+            length -= n;
+        }
+        return true;
+    }
+
+    bool send(const uint8_t* data, size_t length) {
+        if (client.write(data, length) != length) {
+            close();
+            return false;
+        }
+        lastSentMs = millis();
+        return true;
+    }
+
+    static size_t putLength(uint8_t* out, size_t length) {
+        size_t n = 0;
+        do {
+            uint8_t b = length & 0x7F;
+            length >>= 7;
+            out[n++] = b | (length ? 0x80 : 0);
+        } while (length);
+        return n;
+    }
+
+    static size_t putString(uint8_t* out, const char* s) {
+        size_t length = strlen(s);
+        out[0] = length >> 8;
+        out[1] = length & 0xFF;
+        memcpy(out + 2, s, length);
+        return 2 + length;
+    }
+
+    char reportTopic[MQTT_TOPIC_LEN];
+    char commandTopic[MQTT_TOPIC_LEN];
+
+    Message queue[MQTT_QUEUE_LEN];
+    uint8_t head = 0;
+    uint8_t queued = 0;
+    uint16_t packetId = 0;
+    bool inFlight = false;
+    unsigned long sentAtMs = 0;
+    unsigned long lastSentMs = 0;
+    unsigned long lastReceivedMs = 0;
+    uint8_t rx[MQTT_RX_MAX_BYTES + 1];
+};
+
+#endif // MQTT_MANAGER_H
@@ -0,0 +1,459 @@
+#ifndef OTA_MANAGER_H
+#define OTA_MANAGER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+#include <Update.h>
+#include <WiFi.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <mbedtls/sha256.h>
+#include "Process.h"
+#include "EventManager.h"
+#include "Configuration.h"
+#include "BleManager.h"
+#include "ReportWriter.h"
+#include "JsonWriter.h"
+#include "config.h"
+
+#define OTA_CHUNK_BYTES 1024          // Flashed per update() at most, so the main loop keeps running
+#define OTA_HTTP_TIMEOUT_MS 5000
+#define OTA_STALL_TIMEOUT_MS 15000    // A download without data for this long is abandoned
+#define OTA_RETRY_MS 60000            // Before a failed update is tried again
+#define OTA_CONFIRM_TIMEOUT_MS 180000 // A new image must deliver a report within this much uplink time,
+#define OTA_TRIAL_BOOTS 3             // and before crashing this many times, or the previous image comes back
+#define OTA_PROBE_MS 10000            // How often a trial checks that the server takes connections
+#define OTA_PROBE_TIMEOUT_MS 1000
+#define OTA_REJECT_MS 21600000UL      // A rolled back version is not taken again for this long after boot
+
+// Delta patch, as built by the server (Webserver/app/firmware.py):
+//   header "HD" format:u8 size:u32 (of the new image)
+//   ops    OTA_OP_COPY offset:u32 length:u32  bytes from the running image
+//          OTA_OP_INSERT length:u32 bytes     new bytes
+#define OTA_PATCH_HEADER_BYTES 7
+#define OTA_PATCH_FORMAT 1
+#define OTA_OP_COPY 1
+#define OTA_OP_INSERT 2
+
+enum OtaState : uint8_t {
+    OTA_IDLE,
+    OTA_DOWNLOADING,
+    OTA_FAILED,  // Waits OTA_RETRY_MS before taking the offer again
+    OTA_TRIAL    // Running a new image that has not delivered a report yet
+};
+
+// Over-the-air updates from the local server.
+//
+// A server response may offer an image with a different FIRMWARE_VERSION
+// (see offer()). The image, or a patch against the running one when the
+// server has it, is downloaded while the BLE scanner is idle, a chunk per
+// update(), and written to the other OTA partition. The SHA-256 of the
+// resulting image must match the offer before the partition is made
+// bootable and the scanner restarts.
+//
+// The new image then runs on trial. The first report it delivers confirms
+// it. The trial clock only runs while WiFi is up and the server accepts
+// connections, so an outage does not count against the image. Without a
+// report within OTA_CONFIRM_TIMEOUT_MS of that time, or after
+// OTA_TRIAL_BOOTS crashes, the previous partition is booted again and the
+// version is refused for OTA_REJECT_MS. The trial is kept in NVS, so the old
+// image knows it was rolled back even when the bootloader did it.
+class OtaManager : public Process {
+public:
+    OtaManager(Configuration& config, BleManager& bleManager) : cfg(config), ble(bleManager) {}
+
+    void setup(EventManager* em) override {
+        Process::setup(em);
+        eventManager->subscribe(EVT_DATA_READY_FOR_HTTP, this);
+        http.setTimeout(OTA_HTTP_TIMEOUT_MS);
+        http.setConnectTimeout(OTA_HTTP_TIMEOUT_MS);
+    }
+
+    // Counts the crashes of an image on trial, and notices one that was rolled
+    // back. A power cycle or a restart from the console is not the image's
+    // fault. Called first thing in setup(), so an image that crashes while
+    // the processes set up still runs out of boots and is rolled back.
+    void checkTrial() {
+        preferences.begin("ota", false);
+        uint32_t trial = preferences.getUInt("trial", 0);
+        rejectedVersion = preferences.getUInt("rejected", 0);
+        if (trial == FIRMWARE_VERSION) {
+            uint8_t boots = preferences.getUChar("boots", 0);
+            if (crashed()) preferences.putUChar("boots", ++boots);
+            preferences.end();
+            state = OTA_TRIAL;
+            Serial.printf("[OTA] Firmware %d on trial, %u of %d crashes.\n", FIRMWARE_VERSION, boots, OTA_TRIAL_BOOTS);
+            if (boots >= OTA_TRIAL_BOOTS) rollback("keeps crashing");
+            return;
+        }
+        if (trial != 0) {
+            rejectedVersion = trial;
+            preferences.putUInt("rejected", trial);
+            preferences.putUInt("trial", 0);
+            Serial.printf("[OTA] Firmware %lu was rolled back, staying on %d.\n", (unsigned long)trial, FIRMWARE_VERSION);
+        }
+        preferences.end();
+    }
+
+    void onEvent(Event& event) override {
+        if (event.type != EVT_DATA_READY_FOR_HTTP) return;
+        DataReadyForHttpEvent& e = static_cast<DataReadyForHttpEvent&>(event);
+        if (e.delivered && !e.urgent && !e.replay) reportDelivered = true;
+    }
+
+    void update() override {
+        if (state == OTA_TRIAL) {
+            if (reportDelivered) {
+                confirm();
+            } else {
+                timeTrial();
+                if (trialMs > OTA_CONFIRM_TIMEOUT_MS) rollback("no report delivered");
+            }
+            return;
+        }
+        // The download shares the radio with BLE; scan windows get it to themselves
+        if (ble.isScanning() || !cfg.wifiConnected) return;
+        if (offerPending) {
+            offerPending = false;
+            begin();
+        } else if (state == OTA_DOWNLOADING) {
+            pump();
+        }
+    }
+
+    // From the server response:
+    // {"version": 4, "size": 1181456, "sha256": "...", "url": "/firmware/4.bin",
+    //  "patch": {"url": "/firmware/3/4.patch", "size": 80112}}
+    void offer(JsonObjectConst o) {
+        uint32_t version = o["version"] | 0UL;
+        if (version == 0 || version == FIRMWARE_VERSION) return;
+        if (version == rejectedVersion && millis() < OTA_REJECT_MS) return;
+        if (state == OTA_DOWNLOADING || state == OTA_TRIAL || offerPending) return;
+        if (state == OTA_FAILED && millis() - failedAtMs < OTA_RETRY_MS) return;
+        const char* sha256 = o["sha256"] | "";
+        if (strlen(sha256) != 64) return;
+
+        if (version != offered.version) patchFailed = false;
+        offered.version = version;
+        offered.size = o["size"] | 0UL;
+        strcpy(offered.sha256, sha256);
+        offered.url = o["url"] | "";
+        offered.patchUrl = o["patch"]["url"] | "";
+        offered.patchSize = o["patch"]["size"] | 0UL;
+        offerPending = true;
+    }
+
+    // "fw": FIRMWARE_VERSION, and while an update is going on
+    // "ota": {"version": 4, "state": "downloading", "done": 35}
+    void writeReport(JsonWriter& out) const {
+        out.add("fw", (unsigned long)FIRMWARE_VERSION);
+        if (state == OTA_IDLE) return;
+        out.beginObject("ota");
+        out.add("version", (unsigned long)reportedVersion());
+        out.add("state", STATE_NAMES[state]);
+        out.add("done", (int)percentDone());
+        out.endObject();
+    }
+
+    void writeReport(ReportWriter& out) const {
+        out.beginSection(SECTION_FIRMWARE);
+        out.put32(FIRMWARE_VERSION);
+        out.put8(state);
+        out.put32(reportedVersion());
+        out.put8(percentDone());
+        out.endSection();
+    }
+
+private:
+    enum Step { STEP_IMAGE, STEP_HEADER, STEP_OP, STEP_COPY_ARGS, STEP_COPY, STEP_INSERT_ARGS, STEP_INSERT };
+
+    struct Offer {
+        uint32_t version = 0;
+        uint32_t size = 0;
+        char sha256[65] = "";
+        String url;
+        String patchUrl;
+        uint32_t patchSize = 0;
+    };
+
+    static constexpr const char* STATE_NAMES[] = { "idle", "downloading", "failed", "trial" };
+
+    void begin() {
+        usePatch = offered.patchUrl.length() > 0 && offered.patchSize < offered.size && !patchFailed;
+        String url = serverBase() + (usePatch ? offered.patchUrl : offered.url);
+        http.begin(client, url);
+        int code = http.GET();
+        if (code != HTTP_CODE_OK) {
+            if (usePatch) patchFailed = true;
+            fail(code < 0 ? HTTPClient::errorToString(code).c_str() : "server has no such image");
+            return;
+        }
+        stream = http.getStreamPtr();
+        running = esp_ota_get_running_partition();
+        if (!usePatch && !Update.begin(offered.size)) {
+            fail(Update.errorString());
+            return;
+        }
+        mbedtls_sha256_init(&sha);
+        mbedtls_sha256_starts(&sha, 0);
+        step = usePatch ? STEP_HEADER : STEP_IMAGE;
+        argsLength = 0;
+        received = 0;
+        written = 0;
+        lastDataMs = millis();
+        state = OTA_DOWNLOADING;
+        Serial.printf("[OTA] Downloading firmware %lu as %s (%d bytes)\n", (unsigned long)offered.version,
+                      usePatch ? "a patch" : "a full image", http.getSize());
+    }
+
+    // Pulls from the download and writes the new image, at most
+    // OTA_CHUNK_BYTES of it per call. A patch copies most of the image from
+    // the running partition, so only its ops and new bytes are downloaded.
+    void pump() {
+        size_t budget = OTA_CHUNK_BYTES;
+        while (budget > 0 && state == OTA_DOWNLOADING) {
+            size_t n = 0;
+            switch (step) {
+                case STEP_IMAGE:
+                    n = read(buffer, min(budget, (size_t)(offered.size - written)));
+                    emit(buffer, n);
+                    break;
+                case STEP_HEADER:
+                    if (!collect(OTA_PATCH_HEADER_BYTES)) break;
+                    if (memcmp(args, "HD", 2) != 0 || args[2] != OTA_PATCH_FORMAT || get32(args + 3) != offered.size) {
+                        fail("not a patch for this image");
+                    } else if (!Update.begin(offered.size)) {
+                        fail(Update.errorString());
+                    }
+                    step = STEP_OP;
+                    continue;
+                case STEP_OP:
+                    if (written == offered.size || !collect(1)) break;
+                    if (args[0] == OTA_OP_COPY) {
+                        step = STEP_COPY_ARGS;
+                    } else if (args[0] == OTA_OP_INSERT) {
+                        step = STEP_INSERT_ARGS;
+                    } else {
+                        fail("bad patch op");
+                    }
+                    continue;
+                case STEP_COPY_ARGS:
+                    if (!collect(8)) break;
+                    copyFrom = get32(args);
+                    remaining = get32(args + 4);
+                    if ((uint64_t)copyFrom + remaining > running->size) fail("patch reads past the running image");
+                    step = STEP_COPY;
+                    continue;
+                case STEP_COPY:
+                    n = min(budget, (size_t)remaining);
+                    if (esp_partition_read(running, copyFrom, buffer, n) != ESP_OK) {
+                        fail("flash read failed");
+                        break;
+                    }
+                    copyFrom += n;
+                    remaining -= n;
+                    emit(buffer, n);
+                    if (remaining == 0) step = STEP_OP;
+                    break;
+                case STEP_INSERT_ARGS:
+                    if (!collect(4)) break;
+                    remaining = get32(args);
+                    step = STEP_INSERT;
+                    continue;
+                case STEP_INSERT:
+                    n = read(buffer, min(budget, (size_t)remaining));
+                    remaining -= n;
+                    emit(buffer, n);
+                    if (remaining == 0) step = STEP_OP;
+                    break;
+            }
+            if (n == 0) break; // Waiting for data
+            budget -= n;
+        }
+        if (state != OTA_DOWNLOADING) return;
+
+        if (written == offered.size && (step == STEP_IMAGE || step == STEP_OP)) {
+            finish();
+        } else if (millis() - lastDataMs > OTA_STALL_TIMEOUT_MS) {
+            fail("download stalled");
+        }
+    }
+
+    size_t read(uint8_t* to, size_t max) {
+        int available = stream->available();
+        if (available <= 0 || max == 0) return 0;
+        int n = stream->read(to, min(max, (size_t)available));
+        if (n <= 0) return 0;
+        received += n;
+        lastDataMs = millis();
+        return n;
+    }
+
+    // Gathers the next `length` patch bytes in args; true once they are all there
+    bool collect(size_t length) {
+        argsLength += read(args + argsLength, length - argsLength);
+        if (argsLength < length) return false;
+        argsLength = 0;
+        return true;
+    }
+
+    // Hashes and flashes the next piece of the new image
+    void emit(uint8_t* data, size_t length) {
+        if (length == 0 || state != OTA_DOWNLOADING) return;
+        if (written + length > offered.size) {
+            fail("image larger than offered");
+            return;
+        }
+        mbedtls_sha256_update(&sha, data, length);
+        if (Update.write(data, length) != length) {
+            fail(Update.errorString());
+            return;
+        }
+        written += length;
+    }
+
+    void finish() {
+        uint8_t digest[32];
+        mbedtls_sha256_finish(&sha, digest);
+        mbedtls_sha256_free(&sha);
+        http.end();
+        char hex[65];
+        for (int i = 0; i < 32; i++) sprintf(hex + 2 * i, "%02x", digest[i]);
+        if (strcmp(hex, offered.sha256) != 0) {
+            if (usePatch) patchFailed = true; // The full image next time
+            fail("SHA-256 mismatch");
+            return;
+        }
+        if (!Update.end()) {
+            fail(Update.errorString());
+            return;
+        }
+
+        preferences.begin("ota", false);
+        preferences.putUInt("trial", offered.version);
+        preferences.putUChar("boots", 0);
+        preferences.end();
+        Serial.printf("[OTA] Firmware %lu verified, %lu bytes downloaded for %lu. Restarting.\n",
+                      (unsigned long)offered.version, (unsigned long)received, (unsigned long)written);
+        ESP.restart();
+    }
+
+    void fail(const char* reason) {
+        Serial.printf("[OTA] Update to firmware %lu failed: %s\n", (unsigned long)offered.version, reason);
+        if (state == OTA_DOWNLOADING) mbedtls_sha256_free(&sha);
+        if (Update.isRunning()) Update.abort();
+        http.end();
+        state = OTA_FAILED;
+        failedAtMs = millis();
+    }
+
+    static bool crashed() {
+        switch (esp_reset_reason()) {
+            case ESP_RST_PANIC:
+            case ESP_RST_INT_WDT:
+            case ESP_RST_TASK_WDT:
+            case ESP_RST_WDT:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Adds the time since the last call to the trial while the uplink is up.
+    // A report that cannot get through because WiFi or the server is down
+    // says nothing about the image.
+    void timeTrial() {
+        unsigned long now = millis();
+        if (uplinkUp) trialMs += now - trialCheckedMs;
+        trialCheckedMs = now;
+        if (!cfg.wifiConnected) {
+            uplinkUp = false;
+            probeDue = true;
+        } else if (probeDue || now - probedAtMs >= OTA_PROBE_MS) {
+            WiFiClient probe;
+            uplinkUp = probe.connect(cfg.serverHost().c_str(), cfg.serverPort(), OTA_PROBE_TIMEOUT_MS);
+            probe.stop();
+            probedAtMs = now;
+            probeDue = false;
+        }
+    }
+
+    void confirm() {
+        state = OTA_IDLE;
+        preferences.begin("ota", false);
+        preferences.putUInt("trial", 0);
+        preferences.end();
+        esp_ota_mark_app_valid_cancel_rollback(); // Keeps the bootloader from rolling back, where it would
+        Serial.printf("[OTA] Firmware %d confirmed by a delivered report.\n", FIRMWARE_VERSION);
+    }
+
+    // The previous image is still in the other OTA partition. Its own
+    // checkTrial() records this version as rejected.
+    void rollback(const char* reason) {
+        Serial.printf("[OTA] Rolling back firmware %d: %s\n", FIRMWARE_VERSION, reason);
+        if (esp_ota_check_rollback_is_possible()) esp_ota_mark_app_invalid_rollback_and_reboot();
+        const esp_partition_t* previous = esp_ota_get_next_update_partition(nullptr);
+        if (previous && esp_ota_set_boot_partition(previous) == ESP_OK) ESP.restart();
+        Serial.println("[OTA] No previous image to boot, keeping this one.");
+        confirm();
+    }
+
+    // "http://host:5000/data" -> "http://host:5000"
+    String serverBase() const {
+        int hostAt = cfg.serverUrl.indexOf("://");
+        int pathAt = cfg.serverUrl.indexOf('/', hostAt < 0 ? 0 : hostAt + 3);
+        return pathAt < 0 ? cfg.serverUrl : cfg.serverUrl.substring(0, pathAt);
+    }
+
+    uint32_t reportedVersion() const {
+        return state == OTA_TRIAL ? FIRMWARE_VERSION : offered.version;
+    }
+
+    uint8_t percentDone() const {
+        return offered.size ? (uint64_t)written * 100 / offered.size : 0;
+    }
+
+    static uint32_t get32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    Configuration& cfg;
+    BleManager& ble;
+    HTTPClient http;
+    WiFiClient client;
+    WiFiClient* stream = nullptr;
+    Preferences preferences;
+    const esp_partition_t* running = nullptr;
+    mbedtls_sha256_context sha;
+    Offer offered;
+    OtaState state = OTA_IDLE;
+    bool offerPending = false;
+    bool usePatch = false;
+    bool patchFailed = false;
+    uint32_t rejectedVersion = 0;
+    unsigned long failedAtMs = 0;
+    unsigned long lastDataMs = 0;
+
+    // Trial
+    bool reportDelivered = false;
+    bool uplinkUp = false;
+    bool probeDue = true;
+    unsigned long trialMs = 0;
+    unsigned long trialCheckedMs = 0;
+    unsigned long probedAtMs = 0;
+
+    // Download position
+    Step step = STEP_IMAGE;
+    uint8_t args[8];
+    size_t argsLength = 0;
+    uint32_t copyFrom = 0;
+    uint32_t remaining = 0;
+    uint32_t received = 0;
+    uint32_t written = 0;
+    uint8_t buffer[OTA_CHUNK_BYTES];
+};
+
+#endif // OTA_MANAGER_H
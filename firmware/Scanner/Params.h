@@ -0,0 +1,172 @@
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include "config.h"
+#include "EventManager.h"
+#include "ReportWriter.h"
+#include "JsonWriter.h"
+
+// Runtime-tunable settings. Values are stored in NVS by index, so new
+// parameters go at the end and existing ones are never reordered.
+enum ParamId : uint8_t {
+    PARAM_SCAN_INTERVAL_MS,
+    PARAM_SCAN_DURATION_S,
+    PARAM_BLE_SCAN_INTERVAL,
+    PARAM_BLE_SCAN_WINDOW,
+    PARAM_IMU_INTERVAL_MS,
+    PARAM_URGENT_IMPACT_MG,
+    PARAM_LED_BRIGHTNESS,
+    PARAM_LED_COUNT,
+    PARAM_REPORT_BATCH_SIZE,
+    PARAM_REPORT_KEYFRAME_INTERVAL,
+    PARAM_REPORT_DELTA_HYSTERESIS_DB,
+    PARAM_REPORT_URGENT_RSSI,
+    PARAM_WIFI_ROAM_RSSI,
+    PARAM_WIFI_ROAM_MARGIN_DB,
+    PARAM_COUNT
+};
+
+struct ParamDef {
+    const char* name;
+    int32_t defaultValue; // From config.h
+    int32_t min;
+    int32_t max;
+};
+
+// Owners read a parameter where they use it, or cache it and update the
+// cache on a ConfigChangedEvent with key CONFIG_PARAM
+static const ParamDef PARAM_DEFS[PARAM_COUNT] = {
+    { "scan_interval_ms",           SCAN_INTERVAL_MS,             1000, 600000 }, // Start of one scan to the next
+    { "scan_duration_s",            SCAN_DURATION,                1,    30 },
+    { "ble_scan_interval",          BLE_SCAN_INTERVAL,            16,   10240 },  // In 0.625 ms units, as the BLE stack takes them
+    { "ble_scan_window",            BLE_SCAN_WINDOW,              16,   10240 },
+    { "imu_interval_ms",            IMU_UPDATE_INTERVAL_MS,       10,   1000 },
+    { "urgent_impact_mg",           (int32_t)(URGENT_IMPACT_G * 1000), 1000, 16000 },
+    { "led_brightness",             LED_BRIGHTNESS,               0,    255 },
+    { "led_count",                  LED_COUNT,                    0,    LED_COUNT }, // Pixels driven; LED_COUNT is the capacity
+    { "report_batch_size",          REPORT_BATCH_SIZE,            1,    32 },
+    { "report_keyframe_interval",   REPORT_KEYFRAME_INTERVAL,     1,    100 },
+    { "report_delta_hysteresis_db", REPORT_DELTA_HYSTERESIS_DB,   0,    40 },
+    { "report_urgent_rssi",         REPORT_URGENT_RSSI,           -127, 0 },
+    { "wifi_roam_rssi",             WIFI_ROAM_RSSI,               -127, 0 },
+    { "wifi_roam_margin_db",        WIFI_ROAM_MARGIN_DB,          0,    60 },
+};
+
+// The parameter registry. Starts from the config.h defaults, overlays what
+// was saved in NVS and takes changes from the server response, the serial
+// console or a bulk blob:
+//
+//   {"version": 3, "values": {"scan_interval_ms": 5000, "led_brightness": 64}}
+//
+// Each change that sticks is announced with a ConfigChangedEvent. The version
+// is that of the last blob the server sent; it goes into every report ("cv")
+// so the server knows when to send the current one.
+//
+// get() is safe from any task: values are aligned 32-bit words. set() and
+// apply() must be called from the main loop, where server responses and
+// console commands are handled, so ConfigChangedEvent subscribers run there
+// too.
+class Params {
+public:
+    Params() {
+        for (int i = 0; i < PARAM_COUNT; i++) values[i] = PARAM_DEFS[i].defaultValue;
+    }
+
+    // Saved values of parameters this firmware no longer has are ignored;
+    // parameters added since keep their default
+    void load() {
+        int32_t saved[PARAM_COUNT];
+        preferences.begin("params", true);
+        size_t count = preferences.getBytes("values", saved, sizeof(saved)) / sizeof(int32_t);
+        version = preferences.getUShort("version", 0);
+        preferences.end();
+        for (size_t i = 0; i < count; i++) {
+            if (inRange((ParamId)i, saved[i])) values[i] = saved[i];
+        }
+        Serial.printf("Loaded %u parameters, version %u.\n", (unsigned)count, version);
+    }
+
+    int32_t get(ParamId id) const {
+        return values[id];
+    }
+
+    // PARAM_COUNT if there is no parameter by that name
+    static ParamId find(const char* name) {
+        for (int i = 0; i < PARAM_COUNT; i++) {
+            if (strcmp(PARAM_DEFS[i].name, name) == 0) return (ParamId)i;
+        }
+        return PARAM_COUNT;
+    }
+
+    static bool inRange(ParamId id, int32_t value) {
+        return value >= PARAM_DEFS[id].min && value <= PARAM_DEFS[id].max;
+    }
+
+    // Changes one parameter and tells its owner. Returns false if the value
+    // is out of bounds. Call save() once done changing.
+    bool set(ParamId id, int32_t value, EventManager* events) {
+        if (id >= PARAM_COUNT || !inRange(id, value)) return false;
+        if (values[id] == value) return true;
+        values[id] = value;
+        dirty = true;
+        ConfigChangedEvent event(CONFIG_PARAM, id);
+        events->publish(event);
+        return true;
+    }
+
+    // Applies a blob as shown above, saves and returns the number of values
+    // that were rejected: unknown names, non-numbers and values out of bounds.
+    // Parameters the blob leaves out keep their value.
+    int apply(JsonObjectConst blob, EventManager* events) {
+        int rejected = 0;
+        for (JsonPairConst pair : blob["values"].as<JsonObjectConst>()) {
+            ParamId id = find(pair.key().c_str());
+            JsonVariantConst value = pair.value();
+            if (id == PARAM_COUNT || !(value.is<int32_t>() || value.is<bool>()) || !set(id, value.as<int32_t>(), events)) {
+                Serial.printf("Parameter %s rejected.\n", pair.key().c_str());
+                rejected++;
+            }
+        }
+        if (blob["version"].is<uint16_t>() && blob["version"].as<uint16_t>() != version) {
+            version = blob["version"].as<uint16_t>();
+            dirty = true;
+        }
+        save();
+        return rejected;
+    }
+
+    void save() {
+        if (!dirty) return;
+        dirty = false;
+        preferences.begin("params", false);
+        preferences.putBytes("values", values, sizeof(values));
+        preferences.putUShort("version", version);
+        preferences.end();
+    }
+
+    uint16_t getVersion() const {
+        return version;
+    }
+
+    // "cv": version of the last parameter set received from the server
+    void writeReport(JsonWriter& out) const {
+        out.add("cv", version);
+    }
+
+    void writeReport(ReportWriter& out) const {
+        out.beginSection(SECTION_PARAMS);
+        out.put16(version);
+        out.endSection();
+    }
+
+private:
+    int32_t values[PARAM_COUNT];
+    uint16_t version = 0;
+    bool dirty = false;
+    Preferences preferences;
+};
+
+#endif // PARAMS_H
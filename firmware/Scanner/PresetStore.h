@@ -0,0 +1,150 @@
+#ifndef PRESET_STORE_H
+#define PRESET_STORE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <stddef.h>
+#include "LedBehaviors.h"
+#include "VibrationBehaviors.h"
+#include "ReportWriter.h"
+#include "JsonWriter.h"
+
+#define PRESET_SLOTS 8
+#define PRESET_FORMAT 2 // Layout of Preset in NVS; slots in another layout are dropped and uploaded again
+
+// Behavior presets uploaded by the server, kept in fixed slots and persisted
+// in NVS. Once a preset is on the device, the server only sends its id (plus
+// optional overrides) instead of the full behavior JSON. BehaviorManager
+// parses a preset into behavior params when it arrives, so playing one
+// copies params instead of parsing JSON.
+class PresetStore {
+public:
+    struct LedLayer {
+        uint32_t type;       // nameHash() of the behavior, 0 if the preset leaves the LEDs alone
+        bool alert;          // Plays on the alert layer for durationMs
+        uint32_t durationMs;
+        LedParams params;    // Last, so the Timeline track can be left out in NVS
+    };
+
+    struct VibrationLayer {
+        uint32_t type;       // 0 if the preset leaves the motor alone
+        VibrationParams params;
+    };
+
+    struct Preset {
+        uint8_t id;
+        uint8_t format;
+        uint16_t version;    // 0 = empty slot
+        uint32_t usedAt;     // Stored or played, on a counter; the least recent slot is evicted
+        VibrationLayer vibration;
+        LedLayer led;
+    };
+
+    void load() {
+        preferences.begin("presets", true);
+        for (int i = 0; i < PRESET_SLOTS; i++) {
+            Preset& p = slots[i];
+            size_t size = preferences.getBytes(slotKey(i), &p, sizeof(Preset));
+            if (size < SHORT_BYTES || p.format != PRESET_FORMAT) {
+                p.version = 0;
+                continue;
+            }
+            if (p.usedAt > useClock) useClock = p.usedAt;
+        }
+        preferences.end();
+        Serial.printf("Loaded %d presets.\n", count());
+    }
+
+    // Stores or replaces a preset. Returns false for version 0.
+    bool store(uint8_t id, uint16_t version, const Preset& preset) {
+        if (version == 0) return false;
+
+        int slot = indexOf(id);
+        if (slot < 0) slot = indexOf(0, true);
+        if (slot < 0) slot = leastRecentSlot();
+
+        Preset& p = slots[slot];
+        p = preset;
+        p.id = id;
+        p.format = PRESET_FORMAT;
+        p.version = version;
+        p.usedAt = ++useClock;
+
+        // Only Timeline needs its track; the named behaviors rebuild theirs
+        bool track = p.led.alert || p.led.type == nameHash("Timeline");
+        preferences.begin("presets", false);
+        preferences.putBytes(slotKey(slot), &p, track ? sizeof(Preset) : SHORT_BYTES);
+        preferences.end();
+        return true;
+    }
+
+    // Marks the preset as used for eviction. Only stores update usedAt in
+    // NVS, to spare the flash, so plays are forgotten on a restart.
+    const Preset* find(uint8_t id) {
+        int slot = indexOf(id);
+        if (slot < 0) return nullptr;
+        slots[slot].usedAt = ++useClock;
+        return &slots[slot];
+    }
+
+    // Reported to the server as [[id, version], ...] so it knows what to upload
+    // "pv": [[id, version], ...]
+    void writeVersions(JsonWriter& out) const {
+        out.beginArray("pv");
+        for (const Preset& p : slots) {
+            if (p.version == 0) continue;
+            out.beginArray();
+            out.value(p.id);
+            out.value(p.version);
+            out.endArray();
+        }
+        out.endArray();
+    }
+
+    void writeVersions(ReportWriter& out) const {
+        out.beginSection(SECTION_PRESETS);
+        for (const Preset& p : slots) {
+            if (p.version == 0) continue;
+            out.put8(p.id);
+            out.put16(p.version);
+        }
+        out.endSection();
+    }
+
+    int count() const {
+        int n = 0;
+        for (const Preset& p : slots) n += p.version != 0;
+        return n;
+    }
+
+private:
+    int indexOf(uint8_t id, bool emptySlot = false) const {
+        for (int i = 0; i < PRESET_SLOTS; i++) {
+            bool empty = slots[i].version == 0;
+            if (emptySlot ? empty : (!empty && slots[i].id == id)) return i;
+        }
+        return -1;
+    }
+
+    // With every slot in use, the one stored or played longest ago makes room
+    int leastRecentSlot() const {
+        int oldest = 0;
+        for (int i = 1; i < PRESET_SLOTS; i++) {
+            if (slots[i].usedAt < slots[oldest].usedAt) oldest = i;
+        }
+        return oldest;
+    }
+
+    static const char* slotKey(int slot) {
+        static const char* keys[PRESET_SLOTS] = { "p0", "p1", "p2", "p3", "p4", "p5", "p6", "p7" };
+        return keys[slot];
+    }
+
+    static constexpr size_t SHORT_BYTES = offsetof(Preset, led.params.track);
+
+    Preset slots[PRESET_SLOTS] = {};
+    uint32_t useClock = 0;
+    Preferences preferences;
+};
+
+#endif // PRESET_STORE_H
@@ -0,0 +1,84 @@
+#ifndef REPORT_BATCH_H
+#define REPORT_BATCH_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "ReportWriter.h"
+
+#define REPORT_CONTENT_TYPE_BATCH "application/x-hitloop-batch"
+
+// Format byte for transports without a Content-Type header (stream, MQTT):
+// 0 JSON, 1 binary report, 2 binary batch
+inline uint8_t reportFormat(const char* contentType) {
+    if (strcmp(contentType, REPORT_CONTENT_TYPE_BINARY) == 0) return 1;
+    if (strcmp(contentType, REPORT_CONTENT_TYPE_BATCH) == 0) return 2;
+    return 0;
+}
+
+// Collects several encoded reports to send them in one request.
+//
+// Binary: 'H' 'B' version:u8 count:u8 t0:u32, then per report len:u16 report
+// JSON:   {"batch":[report,report,...],"t0":...}
+//
+// t0 is the send time; each report keeps its own t0 from when it was
+// encoded, so the server can date every report in the batch.
+class ReportBatch {
+public:
+    explicit ReportBatch(bool binaryReports) : binary(binaryReports) { clear(); }
+
+    // Returns false if the report does not fit; flush and add it again
+    bool add(const uint8_t* report, size_t length) {
+        size_t needed = binary ? length + 2 : length + 1;
+        if (length > 0xFFFF || count == 255 || size + needed + BATCH_TRAILER_BYTES > REPORT_BATCH_MAX_BYTES) return false;
+
+        if (count == 0) startedMs = millis();
+        if (binary) {
+            buffer[size++] = length & 0xFF;
+            buffer[size++] = length >> 8;
+        } else if (count > 0) {
+            buffer[size++] = ',';
+        }
+        memcpy(buffer + size, report, length);
+        size += length;
+        count++;
+        return true;
+    }
+
+    // Completes the batch with the send time; data() is valid until clear()
+    void finish(uint32_t t0) {
+        if (binary) {
+            buffer[3] = count;
+            memcpy(buffer + 4, &t0, sizeof(t0)); // Little-endian on the ESP32
+        } else {
+            size += snprintf((char*)buffer + size, BATCH_TRAILER_BYTES, "],\"t0\":%lu}", (unsigned long)t0);
+        }
+    }
+
+    void clear() {
+        count = 0;
+        if (binary) {
+            const uint8_t header[] = { 'H', 'B', REPORT_BINARY_VERSION, 0, 0, 0, 0, 0 };
+            memcpy(buffer, header, sizeof(header));
+            size = sizeof(header);
+        } else {
+            size = strlen(strcpy((char*)buffer, "{\"batch\":["));
+        }
+    }
+
+    int reports() const { return count; }
+    unsigned long ageMs() const { return count ? millis() - startedMs : 0; }
+    const uint8_t* data() const { return buffer; }
+    size_t length() const { return size; }
+    const char* contentType() const { return binary ? REPORT_CONTENT_TYPE_BATCH : REPORT_CONTENT_TYPE_JSON; }
+
+private:
+    static const size_t BATCH_TRAILER_BYTES = 24;
+
+    bool binary;
+    uint8_t buffer[REPORT_BATCH_MAX_BYTES];
+    size_t size = 0;
+    int count = 0;
+    unsigned long startedMs = 0;
+};
+
+#endif // REPORT_BATCH_H
@@ -0,0 +1,138 @@
+#ifndef REPORT_ENCODER_H
+#define REPORT_ENCODER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "JsonWriter.h"
+#include "ReportWriter.h"
+
+// What a scan report carries of its own, next to the sections that other
+// modules (presets, rules, uplink, params, WiFi, boot, OTA) write themselves
+struct ReportContent {
+    const String& scannerId;
+    const String& scannerName;
+    bool delta;          // Only the beacons that changed, plus the ones gone
+    float avgAngleXZ;
+    float avgAngleYZ;
+    float totalMovement;
+    uint32_t intervalMs;
+    uint32_t samples;
+    uint32_t ack;        // Last applied command, 0 for none
+    uint32_t t0;         // Send time, echoed by the server for clock sync
+};
+
+// Writes a scan report as JSON or in the binary layout of ReportWriter.h.
+// DataManager sends what these produce, and firmware/bench/report_bench.cpp
+// times them, so both see the same field order. The callers supply:
+//   forEachBeacon(emit)  calls emit(name, rssi) for each beacon in the report
+//   forEachGone(emit)    calls emit(name) for each beacon gone; it is called
+//                        for a keyframe too, with nothing written
+//   writeSections(out)   the other modules' sections, in order
+template <typename Beacons, typename Gone, typename Sections>
+void encodeReport(JsonWriter& json, const ReportContent& r, Beacons forEachBeacon, Gone forEachGone,
+                  Sections writeSections) {
+    json.begin();
+    json.add("scanner_id", r.scannerId.c_str());
+    json.add("scanner_name", r.scannerName.c_str());
+
+    json.beginArray("beacons");
+    forEachBeacon([&](const char* name, int rssi) {
+        json.beginObject();
+        json.add("name", name);
+        json.add("rssi", rssi);
+        json.endObject();
+    });
+    json.endArray();
+
+    if (r.delta) {
+        json.add("delta", true);
+        json.beginArray("gone");
+        forEachGone([&](const char* name) { json.value(name); });
+        json.endArray();
+    } else {
+        forEachGone([](const char*) {});
+    }
+
+    json.beginObject("movement");
+    json.add("avgAngleXZ", r.avgAngleXZ);
+    json.add("avgAngleYZ", r.avgAngleYZ);
+    json.add("totalMovement", r.totalMovement);
+    json.add("intervalMs", (unsigned long)r.intervalMs);
+    json.add("samples", (unsigned long)r.samples);
+    json.endObject();
+
+    writeSections(json);
+
+    // Lets the server drop the command it was holding for us
+    if (r.ack) json.add("ack", r.ack);
+
+    json.add("t0", (unsigned long)r.t0);
+    json.end();
+}
+
+// Beacon names mostly share BEACON_NAME_PREFIX, which is left out
+inline void putBeaconName(ReportWriter& writer, const char* name) {
+    const size_t prefixLength = strlen(BEACON_NAME_PREFIX);
+    if (strncmp(name, BEACON_NAME_PREFIX, prefixLength) == 0) {
+        writer.putString(name + prefixLength, 0x80);
+    } else {
+        writer.putString(name);
+    }
+}
+
+template <typename Beacons, typename Gone, typename Sections>
+void encodeReport(ReportWriter& writer, const ReportContent& r, Beacons forEachBeacon, Gone forEachGone,
+                  Sections writeSections) {
+    writer.begin(r.scannerId, r.t0);
+
+    writer.beginSection(SECTION_BEACONS);
+    size_t countAt = writer.size();
+    writer.put8(0); // Beacon count, patched below
+    uint8_t count = 0;
+    forEachBeacon([&](const char* name, int rssi) {
+        if (count == 255) return;
+        putBeaconName(writer, name);
+        writer.put8((int8_t)rssi);
+        count++;
+    });
+    if (!writer.overflowed()) writer.patch8(countAt, count);
+    writer.endSection();
+
+    if (r.delta) {
+        writer.beginSection(SECTION_DELTA);
+        countAt = writer.size();
+        writer.put8(0);
+        count = 0;
+        forEachGone([&](const char* name) {
+            if (count == 255) return;
+            putBeaconName(writer, name);
+            count++;
+        });
+        if (!writer.overflowed()) writer.patch8(countAt, count);
+        writer.endSection();
+    } else {
+        forEachGone([](const char*) {});
+    }
+
+    writer.beginSection(SECTION_MOTION);
+    writer.putFloat(r.avgAngleXZ);
+    writer.putFloat(r.avgAngleYZ);
+    writer.putFloat(r.totalMovement);
+    writer.put32(r.intervalMs);
+    writer.put32(r.samples);
+    writer.endSection();
+
+    writeSections(writer);
+
+    if (r.ack) {
+        writer.beginSection(SECTION_ACK);
+        writer.put32(r.ack);
+        writer.endSection();
+    }
+
+    writer.beginSection(SECTION_NAME);
+    for (const char* c = r.scannerName.c_str(); *c; c++) writer.put8(*c);
+    writer.endSection();
+}
+
+#endif // REPORT_ENCODER_H
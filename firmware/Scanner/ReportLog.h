@@ -0,0 +1,240 @@
+#ifndef REPORT_LOG_H
+#define REPORT_LOG_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+#include "Process.h"
+#include "Timer.h"
+#include "EventManager.h"
+#include "Configuration.h"
+#include "ClockSync.h"
+#include "ReportWriter.h"
+#include "ReportBatch.h"
+
+#define LOG_SEGMENT_BYTES 16384
+#define LOG_MAX_SEGMENTS 8          // Upper bound; fewer if the partition is small
+#define LOG_FS_SHARE 2              // Use at most 1/LOG_FS_SHARE of the free space
+#define LOG_RECORD_MAGIC 0x4C52     // "RL"
+#define REPLAY_INTERVAL_MS 2000
+#define REPLAY_BATCH 3
+#define LOG_RECORD_MAX_BYTES (REPORT_BATCH_MAX_BYTES > REPORT_MAX_BYTES ? REPORT_BATCH_MAX_BYTES : REPORT_MAX_BYTES)
+
+// Store-and-forward log for reports that could not be delivered (no WiFi,
+// or the POST failed). Records go to an append-only ring of segment files
+// in LittleFS and are replayed a few at a time once the uplink works again.
+//
+// Each record is a RecordHeader followed by the encoded report. The CRC
+// covers both, so a record torn by a power cut is detected and skipped.
+// Segments are only ever appended to and deleted whole; when the ring is
+// full the oldest segment is dropped. The read position is persisted once
+// per replay batch rather than per record, to spare the flash.
+//
+// Must run after HTTPManager in the process list: it checks
+// DataReadyForHttpEvent::delivered after HTTPManager has tried to send.
+class ReportLog : public Process {
+public:
+    ReportLog(Configuration& config, ClockSync& clockSync)
+        : cfg(config), clock(clockSync), replayTimer(REPLAY_INTERVAL_MS) {}
+
+    void setup(EventManager* em) override {
+        Process::setup(em);
+        eventManager->subscribe(EVT_DATA_READY_FOR_HTTP, this);
+        bootId = esp_random();
+
+        if (!LittleFS.begin(true)) {
+            Serial.println("LittleFS unavailable, reports will not be kept offline.");
+            return;
+        }
+        LittleFS.mkdir("/log");
+
+        preferences.begin("replay", true);
+        headSegment = preferences.getUInt("head", 0);
+        tailSegment = preferences.getUInt("tail", 0);
+        tailOffset = preferences.getUInt("offset", 0);
+        preferences.end();
+        if (tailSegment > headSegment) tailSegment = headSegment;
+
+        // Size the ring from what the partition can spare, so the log never
+        // fills the filesystem and LittleFS keeps room for wear leveling
+        size_t free = LittleFS.totalBytes() - LittleFS.usedBytes() + storedBytes();
+        maxSegments = constrain((int)(free / LOG_FS_SHARE / LOG_SEGMENT_BYTES), 1, LOG_MAX_SEGMENTS);
+
+        ready = true;
+        Serial.printf("Report log: %d segments of %d bytes, %u pending.\n",
+                      maxSegments, LOG_SEGMENT_BYTES, (unsigned)pendingBytes());
+    }
+
+    void onEvent(Event& event) override {
+        if (event.type == EVT_DATA_READY_FOR_HTTP) {
+            DataReadyForHttpEvent& e = static_cast<DataReadyForHttpEvent&>(event);
+            if (e.replay || e.urgent) return; // Urgent events are only worth sending now
+            if (e.queued) return;             // Stored if MqttManager reports it late as not delivered
+            liveDelivered = e.delivered;
+            if (!e.delivered) append(e);
+        }
+    }
+
+    void update() override {
+        // Live reports go first: only replay while they are getting through,
+        // and only a small batch per interval
+        if (!ready || !cfg.wifiConnected || !liveDelivered || !replayTimer.checkAndReset()) return;
+        if (headSegment == tailSegment && tailOffset >= segmentSize(headSegment)) return;
+
+        int sent = 0;
+        while (sent < REPLAY_BATCH && replayNext()) sent++;
+        if (sent > 0) saveCursor();
+    }
+
+    size_t pendingBytes() {
+        return ready ? storedBytes() - tailOffset : 0;
+    }
+
+private:
+    struct RecordHeader {
+        uint16_t magic;
+        uint16_t length;       // Report bytes after the header
+        uint32_t crc;          // Over the header (crc = 0) and the report
+        uint32_t bootId;
+        uint32_t capturedMillis;
+        int64_t capturedAt;    // Server time (ms since the epoch), 0 if the clock was not synced
+        uint8_t format;        // Index into contentTypes()
+        uint8_t reserved[7];
+    };
+
+    void append(DataReadyForHttpEvent& report) {
+        if (!ready || report.length > LOG_RECORD_MAX_BYTES) return;
+
+        RecordHeader h = {};
+        h.magic = LOG_RECORD_MAGIC;
+        h.length = report.length;
+        h.bootId = bootId;
+        h.capturedMillis = millis();
+        h.capturedAt = clock.isSynced() ? clock.nowServer() : 0;
+        h.format = 0;
+        for (uint8_t i = 0; i < CONTENT_TYPES; i++) {
+            if (strcmp(report.contentType, contentTypes()[i]) == 0) h.format = i;
+        }
+        h.crc = crc(h, report.body);
+
+        if (segmentSize(headSegment) + sizeof(h) + h.length > LOG_SEGMENT_BYTES) {
+            headSegment++;
+            // Ring full: the oldest segment makes room
+            if (headSegment - tailSegment >= (uint32_t)maxSegments) {
+                LittleFS.remove(segmentPath(tailSegment));
+                tailSegment++;
+                tailOffset = 0;
+                Serial.println("Report log full, dropped oldest segment.");
+            }
+            saveCursor();
+        }
+
+        File f = LittleFS.open(segmentPath(headSegment), "a");
+        if (!f) return;
+        f.write((const uint8_t*)&h, sizeof(h));
+        f.write(report.body, h.length);
+        f.close();
+        Serial.printf("Report stored offline (%u bytes pending).\n", (unsigned)pendingBytes());
+    }
+
+    // Sends the record at the read position. Returns false when there is
+    // nothing left or the send failed.
+    bool replayNext() {
+        while (tailOffset >= segmentSize(tailSegment)) {
+            if (tailSegment == headSegment) return false;
+            LittleFS.remove(segmentPath(tailSegment));
+            tailSegment++;
+            tailOffset = 0;
+        }
+
+        File f = LittleFS.open(segmentPath(tailSegment), "r");
+        RecordHeader h;
+        if (!f || !f.seek(tailOffset) || f.read((uint8_t*)&h, sizeof(h)) != sizeof(h) ||
+            h.magic != LOG_RECORD_MAGIC || h.length > LOG_RECORD_MAX_BYTES ||
+            f.read(body, h.length) != h.length || crc(h, body) != h.crc) {
+            // Torn or corrupt: the rest of this segment cannot be trusted
+            Serial.println("Corrupt record in report log, skipping segment.");
+            tailOffset = segmentSize(tailSegment);
+            return true;
+        }
+        f.close();
+        tailOffset += sizeof(h) + h.length;
+
+        // Date the report on the server clock; a record from an earlier boot
+        // without a synced clock cannot be placed in time and is dropped
+        int64_t capturedAt = h.capturedAt;
+        if (capturedAt == 0 && h.bootId == bootId && clock.isSynced()) {
+            capturedAt = clock.nowServer() - (int64_t)(millis() - h.capturedMillis);
+        }
+        if (capturedAt == 0) return true;
+
+        DataReadyForHttpEvent e(body, h.length, contentTypes()[h.format < CONTENT_TYPES ? h.format : 0]);
+        e.replay = true;
+        e.capturedAt = capturedAt;
+        eventManager->publish(e);
+        if (!e.delivered) {
+            tailOffset -= sizeof(h) + h.length; // Retry later
+            return false;
+        }
+        return true;
+    }
+
+    static const uint8_t CONTENT_TYPES = 3;
+    static const char* const* contentTypes() {
+        static const char* const types[CONTENT_TYPES] = {
+            REPORT_CONTENT_TYPE_JSON, REPORT_CONTENT_TYPE_BINARY, REPORT_CONTENT_TYPE_BATCH
+        };
+        return types;
+    }
+
+    static uint32_t crc(RecordHeader h, const uint8_t* data) {
+        h.crc = 0;
+        uint32_t c = esp_rom_crc32_le(0, (const uint8_t*)&h, sizeof(h));
+        return esp_rom_crc32_le(c, data, h.length);
+    }
+
+    size_t segmentSize(uint32_t segment) {
+        if (!LittleFS.exists(segmentPath(segment))) return 0;
+        File f = LittleFS.open(path, "r");
+        if (!f) return 0;
+        size_t size = f.size();
+        f.close();
+        return size;
+    }
+
+    size_t storedBytes() {
+        size_t total = 0;
+        for (uint32_t s = tailSegment; s <= headSegment; s++) total += segmentSize(s);
+        return total;
+    }
+
+    const char* segmentPath(uint32_t segment) {
+        snprintf(path, sizeof(path), "/log/%lu.bin", (unsigned long)segment);
+        return path;
+    }
+
+    void saveCursor() {
+        preferences.begin("replay", false);
+        preferences.putUInt("head", headSegment);
+        preferences.putUInt("tail", tailSegment);
+        preferences.putUInt("offset", tailOffset);
+        preferences.end();
+    }
+
+    Configuration& cfg;
+    ClockSync& clock;
+    Timer replayTimer;
+    Preferences preferences;
+    bool ready = false;
+    bool liveDelivered = false;
+    uint32_t bootId = 0;
+    int maxSegments = 1;
+    uint32_t headSegment = 0;
+    uint32_t tailSegment = 0;
+    uint32_t tailOffset = 0;
+    uint8_t body[LOG_RECORD_MAX_BYTES];
+    char path[24];
+};
+
+#endif // REPORT_LOG_H
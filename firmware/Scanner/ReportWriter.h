@@ -0,0 +1,127 @@
+#ifndef REPORT_WRITER_H
+#define REPORT_WRITER_H
+
+#include <Arduino.h>
+
+#define REPORT_CONTENT_TYPE_JSON "application/json"
+#define REPORT_CONTENT_TYPE_BINARY "application/x-hitloop-report"
+#define REPORT_BINARY_VERSION 1
+#define REPORT_MAX_BYTES 1024
+
+// Compact binary report, all integers little-endian:
+//
+//   header:  'H' 'L' version:u8 mac:6 t0:u32
+//   section: type:u8 length:u16 payload[length]  (repeated)
+//
+// Unknown section types are skipped by the server, so sections can be added
+// without bumping the version. Payloads are listed with each section type.
+enum ReportSection : uint8_t {
+    SECTION_BEACONS = 1, // count:u8, then per beacon: nameLen:u8 name rssi:i8
+                         // (bit 7 of nameLen: name had BEACON_NAME_PREFIX, which is left out)
+    SECTION_MOTION = 2,  // avgAngleXZ:f32 avgAngleYZ:f32 totalMovement:f32 intervalMs:u32 samples:u32
+    SECTION_PRESETS = 3, // per preset: id:u8 version:u16
+    SECTION_RULES = 4,   // version:u16, then per firing: rule:u8 preset:u8 rssi:i8 ago:u32 nameLen:u8 name
+    SECTION_LINK = 5,    // ms avg_ms requests reused reconnects failures, all u32
+    SECTION_NAME = 6,    // scanner name
+    SECTION_ACK = 7,     // cmd_seq:u32 of the last applied server command
+    SECTION_DELTA = 8,   // Marks a delta report: count:u8, then the names of beacons gone
+                         // since the last report, encoded as in SECTION_BEACONS
+    SECTION_WIFI = 9,    // boot_ms reconnect_ms reconnects roams, all u32, fast:u8 rssi:i8 channel:u8
+    SECTION_URGENT = 10, // Per event: kind:u8 value:i16 ago:u32 at:i64 nameLen:u8 name
+                         // (at: detection time on the server clock, 0 if not synced)
+    SECTION_PARAMS = 11, // version:u16 of the parameter set last received
+    SECTION_BOOT = 12,   // Boot phase times, u32 ms each, in BootPhase order (BootStats.h)
+    SECTION_FIRMWARE = 13 // fw:u32, then OTA state:u8 version:u32 percent:u8 (OtaManager.h)
+};
+
+// Writes a binary report into a fixed buffer. Writes past the end are
+// dropped and flagged, so callers check overflowed() once at the end.
+class ReportWriter {
+public:
+    void begin(const String& macAddress, uint32_t t0) {
+        length = 0;
+        sectionStart = 0;
+        overflow = false;
+        put8('H');
+        put8('L');
+        put8(REPORT_BINARY_VERSION);
+        putMac(macAddress);
+        put32(t0);
+    }
+
+    void beginSection(ReportSection type) {
+        put8(type);
+        sectionStart = length;
+        put16(0); // Patched in endSection()
+    }
+
+    void endSection() {
+        size_t payload = length - sectionStart - 2;
+        if (overflow) return;
+        buffer[sectionStart] = payload & 0xFF;
+        buffer[sectionStart + 1] = payload >> 8;
+    }
+
+    void put8(uint8_t v) {
+        if (length >= REPORT_MAX_BYTES) {
+            overflow = true;
+            return;
+        }
+        buffer[length++] = v;
+    }
+
+    void put16(uint16_t v) {
+        put8(v);
+        put8(v >> 8);
+    }
+
+    void put32(uint32_t v) {
+        put16(v);
+        put16(v >> 16);
+    }
+
+    void put64(uint64_t v) {
+        put32(v);
+        put32(v >> 32);
+    }
+
+    void putFloat(float v) {
+        uint32_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        put32(bits);
+    }
+
+    void patch8(size_t offset, uint8_t v) {
+        if (offset < length) buffer[offset] = v;
+    }
+
+    // Length-prefixed string, at most 127 bytes. Bit 7 of the length byte
+    // is left for the caller's flags.
+    void putString(const char* s, uint8_t flags = 0) {
+        size_t n = min(strlen(s), (size_t)127);
+        put8(n | flags);
+        for (size_t i = 0; i < n; i++) put8(s[i]);
+    }
+
+    const uint8_t* data() const { return buffer; }
+    size_t size() const { return length; }
+    bool overflowed() const { return overflow; }
+
+private:
+    // "AA:BB:CC:DD:EE:FF" -> 6 bytes
+    void putMac(const String& mac) {
+        const char* p = mac.c_str();
+        for (int i = 0; i < 6; i++) {
+            put8(strtoul(p, nullptr, 16));
+            p = strchr(p, ':');
+            p = p ? p + 1 : "";
+        }
+    }
+
+    uint8_t buffer[REPORT_MAX_BYTES];
+    size_t length = 0;
+    size_t sectionStart = 0;
+    bool overflow = false;
+};
+
+#endif // REPORT_WRITER_H
@@ -0,0 +1,94 @@
+#ifndef RMT_LED_OUTPUT_H
+#define RMT_LED_OUTPUT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// WS2812 timing in RMT ticks at 10 MHz (100 ns per tick)
+#define RMT_LED_TICK_HZ 10000000
+#define RMT_LED_T0H 4  // 0.40 us
+#define RMT_LED_T0L 8  // 0.80 us
+#define RMT_LED_T1H 8  // 0.80 us
+#define RMT_LED_T1L 4  // 0.40 us
+#define RMT_LED_BITS_PER_FRAME (LED_COUNT * 24)
+
+// Sends WS2812 frames through the RMT peripheral instead of bit-banging.
+// A frame is encoded into RMT symbols and transmitted asynchronously, so
+// interrupts stay enabled and the caller returns immediately. Two symbol
+// buffers are used: the next frame is encoded into the idle buffer while
+// the other one may still be on the wire.
+class RmtLedOutput {
+public:
+    RmtLedOutput(int pin) : pin(pin) {}
+
+    bool begin() {
+        ready = rmtInit(pin, RMT_TX_MODE, RMT_MEM_NUM_BLOCKS_1, RMT_LED_TICK_HZ);
+        if (ready) {
+            rmtSetEOT(pin, LOW); // Hold the line low between frames (latch)
+        } else {
+            Serial.println("RMT LED output could not be initialized.");
+        }
+        return ready;
+    }
+
+    bool isReady() const { return ready; }
+
+    bool isBusy() {
+        return inFlight && !rmtTransmitCompleted(pin);
+    }
+
+    // Encodes and starts sending a frame of GRB bytes. Returns false without
+    // sending if the previous frame is still in flight (back-pressure) or the
+    // driver refused it; the caller keeps the frame and offers it again on
+    // the next tick.
+    bool write(const uint8_t* grb, size_t length) {
+        if (!ready) return false;
+        if (isBusy()) {
+            framesDeferred++;
+            return false;
+        }
+
+        int next = active ^ 1;
+        size_t count = encode(grb, length, symbols[next]);
+        if (!rmtWriteAsync(pin, symbols[next], count)) {
+            framesFailed++;
+            return false;
+        }
+        active = next;
+        inFlight = true;
+        framesSent++;
+        return true;
+    }
+
+    uint32_t getFramesSent() const { return framesSent; }
+    uint32_t getFramesDeferred() const { return framesDeferred; }
+    uint32_t getFramesFailed() const { return framesFailed; }
+
+private:
+    static size_t encode(const uint8_t* grb, size_t length, rmt_data_t* out) {
+        if (length > LED_COUNT * 3) length = LED_COUNT * 3;
+        size_t n = 0;
+        for (size_t i = 0; i < length; i++) {
+            for (uint8_t mask = 0x80; mask; mask >>= 1) {
+                bool one = grb[i] & mask;
+                out[n].level0 = 1;
+                out[n].duration0 = one ? RMT_LED_T1H : RMT_LED_T0H;
+                out[n].level1 = 0;
+                out[n].duration1 = one ? RMT_LED_T1L : RMT_LED_T0L;
+                n++;
+            }
+        }
+        return n;
+    }
+
+    int pin;
+    bool ready = false;
+    bool inFlight = false;
+    int active = 0;
+    rmt_data_t symbols[2][RMT_LED_BITS_PER_FRAME];
+    uint32_t framesSent = 0;
+    uint32_t framesDeferred = 0;
+    uint32_t framesFailed = 0;
+};
+
+#endif // RMT_LED_OUTPUT_H
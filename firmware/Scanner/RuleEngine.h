@@ -0,0 +1,230 @@
+#ifndef RULE_ENGINE_H
+#define RULE_ENGINE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include "Process.h"
+#include "EventManager.h"
+#include "BeaconTable.h"
+#include "ReportWriter.h"
+#include "JsonWriter.h"
+#include "Utils.h"
+
+#define RULE_MAX 16
+#define RULE_MAX_BEACONS 8
+#define RULE_SIZE 5           // Bytes per compiled rule
+#define RULE_ANY_BEACON 0xFF
+#define RULE_FIRED_LOG 8      // Firings kept until the next report
+
+// Proximity rules compiled by the server and evaluated on every scan, so a
+// scanner reacts to a beacon without waiting for a server round trip.
+//
+// Each rule is RULE_SIZE bytes:
+//   [beacon] [op] [value] [intervals] [preset]
+// beacon indexes the rule set's beacon name list (RULE_ANY_BEACON = any),
+// value is a signed dBm threshold, and the rule fires once the condition
+// has held for `intervals` consecutive scans. It fires again only after the
+// condition has been false for a scan.
+class RuleEngine : public Process {
+public:
+    RuleEngine(BeaconTable& beaconTable) : beacons(beaconTable) {}
+
+    enum RuleOp : uint8_t {
+        RULE_RSSI_ABOVE = 1, // Filtered RSSI > value
+        RULE_RSSI_BELOW = 2, // Seen, with filtered RSSI < value
+        RULE_ABSENT = 3      // Not seen in the scan
+    };
+
+    void setup(EventManager* em) override {
+        Process::setup(em);
+        eventManager->subscribe(EVT_SCAN_COMPLETE, this);
+        load();
+    }
+
+    void onEvent(Event& event) override {
+        if (event.type == EVT_SCAN_COMPLETE) {
+            ScanCompleteEvent& e = static_cast<ScanCompleteEvent&>(event);
+            beacons.update(e.results);
+            evaluate();
+        }
+    }
+
+    void update() override {
+        // Rules run on scan results only
+    }
+
+    // rules: { "version": 4, "beacons": ["HitloopBeacon_A", ...], "code": "<hex>" }
+    bool install(JsonObject rules) {
+        uint16_t newVersion = rules["version"] | 0;
+        const char* hex = rules["code"] | "";
+        JsonArray names = rules["beacons"];
+
+        size_t hexLength = strlen(hex);
+        if (hexLength % (RULE_SIZE * 2) != 0 || hexLength / 2 > sizeof(code) || names.size() > RULE_MAX_BEACONS) {
+            Serial.println("Rule set rejected: too large or malformed.");
+            return false;
+        }
+        uint8_t compiled[sizeof(code)];
+        for (size_t i = 0; i < hexLength / 2; i++) {
+            int hi = hexNibble(hex[2 * i]), lo = hexNibble(hex[2 * i + 1]);
+            if (hi < 0 || lo < 0) return false;
+            compiled[i] = (hi << 4) | lo;
+        }
+
+        memcpy(code, compiled, hexLength / 2);
+        ruleCount = hexLength / (2 * RULE_SIZE);
+        version = newVersion;
+        memset(beaconNames, 0, sizeof(beaconNames));
+        int b = 0;
+        for (JsonVariant name : names) {
+            strncpy(beaconNames[b++], name | "", BEACON_NAME_LEN - 1);
+        }
+        memset(streak, 0, sizeof(streak));
+        memset(latched, 0, sizeof(latched));
+
+        preferences.begin("rules", false);
+        preferences.putUShort("ver", version);
+        preferences.putBytes("names", beaconNames, sizeof(beaconNames));
+        preferences.putBytes("code", code, ruleCount * RULE_SIZE);
+        preferences.end();
+        Serial.printf("Installed %d rules (v%u).\n", ruleCount, version);
+        return true;
+    }
+
+    // Adds the rule set version and the firings since the last report
+    void writeReport(JsonWriter& out) {
+        out.add("rv", version);
+        if (firedCount == 0) return;
+
+        out.beginArray("fired");
+        unsigned long now = millis();
+        for (int i = 0; i < firedCount; i++) {
+            const Firing& f = firedLog[i];
+            out.beginObject();
+            out.add("rule", f.rule);
+            out.add("preset", f.preset);
+            out.add("beacon", f.beacon);
+            out.add("rssi", f.rssi);
+            out.add("ago", now - f.atMs);
+            out.endObject();
+        }
+        out.endArray();
+        firedCount = 0;
+    }
+
+    void writeReport(ReportWriter& out) {
+        out.beginSection(SECTION_RULES);
+        out.put16(version);
+        unsigned long now = millis();
+        for (int i = 0; i < firedCount; i++) {
+            const Firing& f = firedLog[i];
+            out.put8(f.rule);
+            out.put8(f.preset);
+            out.put8(f.rssi);
+            out.put32(now - f.atMs);
+            out.putString(f.beacon);
+        }
+        out.endSection();
+        firedCount = 0;
+    }
+
+private:
+    struct Firing {
+        uint8_t rule;
+        uint8_t preset;
+        int8_t rssi;
+        char beacon[BEACON_NAME_LEN];
+        unsigned long atMs;
+    };
+
+    void load() {
+        preferences.begin("rules", true);
+        version = preferences.getUShort("ver", 0);
+        preferences.getBytes("names", beaconNames, sizeof(beaconNames));
+        ruleCount = preferences.getBytes("code", code, sizeof(code)) / RULE_SIZE;
+        preferences.end();
+        if (ruleCount > 0) {
+            Serial.printf("Loaded %d rules (v%u).\n", ruleCount, version);
+        }
+    }
+
+    void evaluate() {
+        for (int r = 0; r < ruleCount; r++) {
+            const uint8_t* rule = &code[r * RULE_SIZE];
+            const BeaconTable::Entry* match = nullptr;
+            bool holds = matches(rule, match);
+
+            if (!holds) {
+                streak[r] = 0;
+                latched[r] = false;
+                continue;
+            }
+            if (streak[r] < 0xFF) streak[r]++;
+            if (latched[r] || streak[r] < (rule[3] ? rule[3] : 1)) continue;
+
+            latched[r] = true;
+            logFiring(r, match);
+            RuleFiredEvent event(r, rule[4]);
+            eventManager->publish(event);
+        }
+    }
+
+    // On a match, `match` is the beacon that satisfied the rule (null for RULE_ABSENT)
+    bool matches(const uint8_t* rule, const BeaconTable::Entry*& match) {
+        uint8_t beacon = rule[0];
+        uint8_t op = rule[1];
+        int threshold = (int8_t)rule[2];
+
+        if (beacon != RULE_ANY_BEACON) {
+            if (beacon >= RULE_MAX_BEACONS) return false;
+            const BeaconTable::Entry* e = beacons.find(beaconNames[beacon]);
+            bool seen = e && BeaconTable::seen(*e);
+            if (op == RULE_ABSENT) return !seen;
+            match = e;
+            return seen && compare(op, BeaconTable::filteredRssi(*e), threshold);
+        }
+
+        bool anySeen = false;
+        for (const BeaconTable::Entry& e : beacons) {
+            if (!BeaconTable::seen(e)) continue;
+            anySeen = true;
+            if (op != RULE_ABSENT && compare(op, BeaconTable::filteredRssi(e), threshold)) {
+                match = &e;
+                return true;
+            }
+        }
+        return op == RULE_ABSENT && !anySeen;
+    }
+
+    static bool compare(uint8_t op, int rssi, int threshold) {
+        if (op == RULE_RSSI_ABOVE) return rssi > threshold;
+        if (op == RULE_RSSI_BELOW) return rssi < threshold;
+        return false;
+    }
+
+    void logFiring(int rule, const BeaconTable::Entry* beacon) {
+        if (firedCount == RULE_FIRED_LOG) return; // Report is overdue; keep the oldest
+        Firing& f = firedLog[firedCount++];
+        f.rule = rule;
+        f.preset = code[rule * RULE_SIZE + 4];
+        f.rssi = beacon ? BeaconTable::filteredRssi(*beacon) : 0;
+        strncpy(f.beacon, beacon ? beacon->name : "", BEACON_NAME_LEN);
+        f.atMs = millis();
+    }
+
+    BeaconTable& beacons;
+    uint8_t code[RULE_MAX * RULE_SIZE] = {};
+    char beaconNames[RULE_MAX_BEACONS][BEACON_NAME_LEN] = {};
+    int ruleCount = 0;
+    uint16_t version = 0;
+
+    uint8_t streak[RULE_MAX] = {};
+    bool latched[RULE_MAX] = {};
+
+    Firing firedLog[RULE_FIRED_LOG];
+    int firedCount = 0;
+    Preferences preferences;
+};
+
+#endif // RULE_ENGINE_H
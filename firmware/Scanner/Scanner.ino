@@ -9,6 +9,13 @@ Commands van de server uitvoeren.                         |
 #include <vector>
 #include "config.h"
 #include "Configuration.h"
+#include "Params.h"
+#include "PresetStore.h"
+#include "UplinkStats.h"
+#include "WifiStats.h"
+#include "BootStats.h"
+#include "ClockSync.h"
+#include "BeaconTable.h"
 #include "Timer.h"
 
 // Process classes
@@ -18,14 +25,28 @@ Commands van de server uitvoeren.                         |
 #include "LedManager.h"
 #include "VibrationManager.h"
 #include "BehaviorManager.h"
+#include "MqttManager.h"
+#include "StreamManager.h"
 #include "HTTPManager.h"
+#include "ReportLog.h"
 #include "DataManager.h"
+#include "UrgentManager.h"
+#include "SerialConsole.h"
+#include "OtaManager.h"
 #include "BleManager.h"
+#include "RuleEngine.h"
 #include "EventManager.h"
 #include "Process.h"
 
 // Instantiate configuration and state objects
 Configuration config;
+Params params;
+PresetStore presetStore;
+UplinkStats uplinkStats;
+WifiStats wifiStats;
+BootStats bootStats;
+ClockSync clockSync;
+BeaconTable beaconTable;
 
 // Global pointer for BLE callback
 BleManager* g_bleManager = nullptr;
@@ -34,35 +55,63 @@ EventManager eventManager;
 
 // Instantiate managers
 SystemManager systemManager(config);
-WifiManager wifiManager(config);
-LedManager ledManager;
+WifiManager wifiManager(config, params, wifiStats, bootStats);
+LedManager ledManager(params, bootStats);
 VibrationManager vibrationManager;
-IMUManager imuManager;
-BleManager bleManager(&imuManager);
-DataManager dataManager(config);
-HTTPManager httpManager(config);
-BehaviorManager behaviorManager(&ledManager, &vibrationManager);
+IMUManager imuManager(params, bootStats);
+BleManager bleManager(&imuManager, params, bootStats);
+RuleEngine ruleEngine(beaconTable);
+OtaManager otaManager(config, bleManager);
+DataManager dataManager(config, params, presetStore, ruleEngine, uplinkStats, wifiStats, bootStats, otaManager, beaconTable);
+#if UPLINK_MQTT
+MqttManager mqttManager(config, uplinkStats);
+#endif
+StreamManager streamManager(config, uplinkStats);
+HTTPManager httpManager(config, uplinkStats);
+ReportLog reportLog(config, clockSync);
+UrgentManager urgentManager(config, clockSync);
+SerialConsole serialConsole(config, params, uplinkStats, wifiStats, beaconTable, clockSync, reportLog, ledManager);
+BehaviorManager behaviorManager(&ledManager, &vibrationManager, presetStore, ruleEngine, clockSync, params, otaManager);
 
 Process* processes[] = {
+    &wifiManager,   // First: association runs on the WiFi task while the others set up
     &systemManager,
-    &wifiManager,
     &ledManager,
     &vibrationManager,
     &imuManager,
     &bleManager,
+    &ruleEngine, // Before dataManager: updates beaconTable, and a scan's firings go out in its own report
     &dataManager,
+    &urgentManager, // Sends urgent events between reports
+#if UPLINK_MQTT
+    &mqttManager,   // First pick of the reports; the stream and HTTP get what it cannot queue
+#endif
+    &streamManager, // Before httpManager, which only sends what the stream did not
     &httpManager,
-    &behaviorManager
+    &reportLog, // After httpManager, so it sees whether a report was delivered
+    &otaManager, // Likewise: a delivered report confirms a new image
+    &behaviorManager,
+    &serialConsole // Last, so it traces reports after the transports have tried them
 };
 
+// A new OTA image stays on trial until OtaManager confirms it, instead of
+// being marked valid by the Arduino core at startup
+bool verifyRollbackLater() {
+  return true;
+}
+
 void setup() {
   Serial.begin(SERIAL_BAUD_RATE);
+  otaManager.checkTrial(); // Before anything that could crash a bad image
   config.loadConfig();
+  params.load(); // Before the processes, which take their settings from it
+  bootStats.mark(BOOT_CONFIG);
 
   // Initialize all processes and pass them the event manager
   for (auto process : processes) {
     process->setup(&eventManager);
   }
+  bootStats.mark(BOOT_READY);
 }
 
 void loop() {
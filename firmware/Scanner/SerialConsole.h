@@ -0,0 +1,346 @@
+#ifndef SERIAL_CONSOLE_H
+#define SERIAL_CONSOLE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <stdarg.h>
+#include "Process.h"
+#include "EventManager.h"
+#include "Configuration.h"
+#include "Params.h"
+#include "UplinkStats.h"
+#include "WifiStats.h"
+#include "BeaconTable.h"
+#include "ClockSync.h"
+#include "ReportLog.h"
+#include "LedManager.h"
+
+#define CONSOLE_LINE_MAX 256 // Room for a parameter blob
+#define CONSOLE_MAX_ARGS 4
+#define CONSOLE_TRACE_LEN 16
+#define CONSOLE_TRACE_TEXT 48
+
+// Line-oriented configuration console on the USB serial port. update()
+// only takes the bytes that have arrived, so scanning and reporting keep
+// running while someone types. Settings are saved to NVS and applied
+// through a ConfigChangedEvent, without a restart. Besides the server URL
+// and networks, every parameter in Params.h is a setting.
+//
+//   help                          this list
+//   get [name]                    one or all settings
+//   set <name> <value>            change a setting
+//   load <json>                   set parameters in bulk: {"values": {"led_brightness": 64, ...}}
+//   wifi                          list the networks
+//   wifi <slot> <ssid> [password] set a network; "wifi <slot> -" removes it
+//   stats                         uplink, WiFi, clock, report log, LED frames and beacon table
+//   trace                         the last events: reports, rules, commands, connections
+//   reboot | erase                restart, or clear the configuration and restart
+//
+// Arguments with spaces go in double quotes. The older form from the
+// configuration web page, "c" followed by SSID, password and server URL on
+// separate lines, sets network 0 and the server; "e" erases.
+class SerialConsole : public Process {
+public:
+    SerialConsole(Configuration& config, Params& parameters, UplinkStats& uplinkStats, WifiStats& wifiStats,
+                  BeaconTable& beaconTable, ClockSync& clockSync, ReportLog& reportLog, LedManager& ledManager)
+        : cfg(config), params(parameters), link(uplinkStats), wifi(wifiStats), beacons(beaconTable), clock(clockSync), log(reportLog),
+          leds(ledManager) {}
+
+    void setup(EventManager* em) override {
+        Process::setup(em);
+        // Subscribed last, so the transports have set `delivered` by the time we see a report
+        eventManager->subscribe(EVT_DATA_READY_FOR_HTTP, this);
+        eventManager->subscribe(EVT_RULE_FIRED, this);
+        eventManager->subscribe(EVT_URGENT, this);
+        eventManager->subscribe(EVT_COMMAND_APPLIED, this);
+        eventManager->subscribe(EVT_WIFI_CONNECTED, this);
+        eventManager->subscribe(EVT_SERVER_DISCONNECTED, this);
+        eventManager->subscribe(EVT_CONFIG_CHANGED, this);
+        Serial.println("Serial console ready, type 'help'.");
+    }
+
+    void update() override {
+        while (Serial.available()) {
+            char c = Serial.read();
+            if (c == '\r') continue;
+            if (c != '\n') {
+                if (length < CONSOLE_LINE_MAX - 1) line[length++] = c;
+                continue;
+            }
+            line[length] = '\0';
+            length = 0;
+            handleLine(line);
+        }
+    }
+
+    // Events are published on the main loop, like the console itself
+    void onEvent(Event& event) override {
+        switch (event.type) {
+            case EVT_DATA_READY_FOR_HTTP: {
+                DataReadyForHttpEvent& e = static_cast<DataReadyForHttpEvent&>(event);
+                trace("%s %u B %s%s", e.urgent ? "urgent" : e.replay ? "replay" : "report", (unsigned)e.length,
+                      e.delivered ? "delivered" : e.queued ? "queued" : "not delivered", e.late ? " (late)" : "");
+                break;
+            }
+            case EVT_RULE_FIRED: {
+                RuleFiredEvent& e = static_cast<RuleFiredEvent&>(event);
+                trace("rule %u fired, preset %u", e.rule, e.presetId);
+                break;
+            }
+            case EVT_URGENT: {
+                UrgentEvent& e = static_cast<UrgentEvent&>(event);
+                trace("urgent %s %s %d", e.kind == URGENT_IMPACT ? "impact" : "beacon", e.name, e.value);
+                break;
+            }
+            case EVT_COMMAND_APPLIED:
+                trace("command %lu applied", (unsigned long)static_cast<CommandAppliedEvent&>(event).seq);
+                break;
+            case EVT_WIFI_CONNECTED:
+                trace("wifi connected");
+                break;
+            case EVT_SERVER_DISCONNECTED:
+                trace("server unreachable");
+                break;
+            case EVT_CONFIG_CHANGED: {
+                ConfigChangedEvent& e = static_cast<ConfigChangedEvent&>(event);
+                trace("config changed (%s)", e.key == CONFIG_WIFI ? "wifi" : e.key == CONFIG_SERVER ? "server" : PARAM_DEFS[e.param].name);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+private:
+    struct TraceEntry {
+        unsigned long atMs;
+        char text[CONSOLE_TRACE_TEXT];
+    };
+
+    void handleLine(char* text) {
+        // Lines after "c": SSID, password, server URL
+        if (legacyStep > 0) {
+            legacyValues[legacyStep - 1] = text;
+            legacyValues[legacyStep - 1].trim();
+            if (++legacyStep <= 3) return;
+            legacyStep = 0;
+            cfg.setNetwork(0, legacyValues[0], legacyValues[1]);
+            cfg.setServerUrl(legacyValues[2]);
+            Serial.println("Configuration saved.");
+            publishChange(CONFIG_SERVER);
+            publishChange(CONFIG_WIFI);
+            return;
+        }
+
+        // The blob has its own quotes and spaces
+        if (strncmp(text, "load ", 5) == 0) {
+            loadParams(text + 5);
+            return;
+        }
+
+        char* argv[CONSOLE_MAX_ARGS];
+        int argc = tokenize(text, argv);
+        if (argc == 0) return;
+        const char* cmd = argv[0];
+
+        if (strcmp(cmd, "c") == 0) {
+            legacyStep = 1;
+        } else if (strcmp(cmd, "e") == 0 || strcmp(cmd, "erase") == 0) {
+            cfg.clearConfig();
+        } else if (strcmp(cmd, "help") == 0) {
+            printHelp();
+        } else if (strcmp(cmd, "get") == 0) {
+            if (argc < 2) {
+                printSetting("server_url");
+                printSetting("scanner_name");
+                printSetting("mac");
+                for (int i = 0; i < PARAM_COUNT; i++) printSetting(PARAM_DEFS[i].name);
+            } else {
+                printSetting(argv[1]);
+            }
+        } else if (strcmp(cmd, "set") == 0) {
+            if (argc == 3) {
+                setSetting(argv[1], argv[2]);
+            } else {
+                Serial.println("Usage: set <name> <value>");
+            }
+        } else if (strcmp(cmd, "wifi") == 0) {
+            if (argc == 1) {
+                printNetworks();
+            } else {
+                setNetwork(argv[1], argc > 2 ? argv[2] : "", argc > 3 ? argv[3] : "");
+            }
+        } else if (strcmp(cmd, "stats") == 0) {
+            printStats();
+        } else if (strcmp(cmd, "trace") == 0) {
+            printTrace();
+        } else if (strcmp(cmd, "reboot") == 0) {
+            ESP.restart();
+        } else {
+            Serial.printf("Unknown command '%s', type 'help'.\n", cmd);
+        }
+    }
+
+    // Splits the line in place on spaces; "quoted text" is one argument
+    int tokenize(char* p, char* argv[]) {
+        int argc = 0;
+        while (*p && argc < CONSOLE_MAX_ARGS) {
+            while (*p == ' ') p++;
+            if (!*p) break;
+            char end = ' ';
+            if (*p == '"') {
+                end = '"';
+                p++;
+            }
+            argv[argc++] = p;
+            while (*p && *p != end) p++;
+            if (*p) *p++ = '\0';
+        }
+        return argc;
+    }
+
+    void printHelp() {
+        Serial.println("help                          this list");
+        Serial.println("get [name]                    one or all settings");
+        Serial.println("set <name> <value>            change a setting");
+        Serial.println("load <json>                   set parameters in bulk: {\"values\": {\"name\": value, ...}}");
+        Serial.println("wifi                          list the networks");
+        Serial.println("wifi <slot> <ssid> [password] set a network; 'wifi <slot> -' removes it");
+        Serial.println("stats                         uplink, WiFi, clock, report log, LED frames and beacons");
+        Serial.println("trace                         the last events");
+        Serial.println("reboot | erase                restart, or clear the configuration and restart");
+    }
+
+    void printSetting(const char* name) {
+        if (strcmp(name, "server_url") == 0) {
+            Serial.printf("server_url = %s\n", cfg.serverUrl.c_str());
+        } else if (strcmp(name, "scanner_name") == 0) {
+            Serial.printf("scanner_name = %s (read-only)\n", cfg.scannerName.c_str());
+        } else if (strcmp(name, "mac") == 0) {
+            Serial.printf("mac = %s (read-only)\n", cfg.macAddress.c_str());
+        } else if (Params::find(name) != PARAM_COUNT) {
+            ParamId id = Params::find(name);
+            const ParamDef& def = PARAM_DEFS[id];
+            Serial.printf("%s = %ld (default %ld, %ld to %ld)\n", name, (long)params.get(id),
+                          (long)def.defaultValue, (long)def.min, (long)def.max);
+        } else {
+            Serial.printf("No setting '%s'.\n", name);
+        }
+    }
+
+    void setSetting(const char* name, const char* value) {
+        if (strcmp(name, "server_url") == 0) {
+            cfg.setServerUrl(value);
+            publishChange(CONFIG_SERVER);
+            printSetting(name);
+        } else if (Params::find(name) != PARAM_COUNT) {
+            char* end;
+            long number = strtol(value, &end, 10);
+            if (*end || !params.set(Params::find(name), number, eventManager)) {
+                Serial.printf("Invalid value '%s'.\n", value);
+            }
+            params.save();
+            printSetting(name);
+        } else {
+            Serial.printf("Setting '%s' cannot be changed.\n", name);
+        }
+    }
+
+    // Changes made here keep the parameter set version, so they last until
+    // the server sends a newer set
+    void loadParams(const char* json) {
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, json);
+        if (error || !doc["values"].is<JsonObject>()) {
+            Serial.println("Usage: load {\"values\": {\"name\": value, ...}}");
+            return;
+        }
+        doc.remove("version");
+        int rejected = params.apply(doc.as<JsonObject>(), eventManager);
+        Serial.printf("Parameters loaded, %d rejected.\n", rejected);
+    }
+
+    void printNetworks() {
+        if (cfg.networkCount == 0) Serial.println("No networks configured.");
+        for (int i = 0; i < cfg.networkCount; i++) {
+            Serial.printf("%d: %s\n", cfg.networks[i].slot, cfg.networks[i].ssid.c_str());
+        }
+    }
+
+    void setNetwork(const char* slotText, const char* ssid, const char* password) {
+        int slot = atoi(slotText);
+        if (slot < 0 || slot >= WIFI_MAX_NETWORKS || !*ssid) {
+            Serial.printf("Usage: wifi <0-%d> <ssid> [password]\n", WIFI_MAX_NETWORKS - 1);
+            return;
+        }
+        cfg.setNetwork(slot, strcmp(ssid, "-") == 0 ? "" : ssid, password);
+        printNetworks();
+        publishChange(CONFIG_WIFI);
+    }
+
+    void printStats() {
+        Serial.printf("uptime %lu s, free heap %u B\n", millis() / 1000, (unsigned)ESP.getFreeHeap());
+        Serial.printf("uplink: %lu requests, %lu reused, %lu reconnects, %lu failures, rtt %lu ms (avg %lu)\n",
+                      (unsigned long)link.requests, (unsigned long)link.reused, (unsigned long)link.reconnects,
+                      (unsigned long)link.failures, (unsigned long)link.lastRoundTripMs, (unsigned long)link.avgRoundTripMs);
+        Serial.printf("wifi: %s, boot %lu ms, last outage %lu ms, %lu reconnects, %lu roams, %d dBm, channel %u\n",
+                      cfg.wifiConnected ? "connected" : "disconnected", (unsigned long)wifi.bootMs,
+                      (unsigned long)wifi.reconnectMs, (unsigned long)wifi.reconnects, (unsigned long)wifi.roams,
+                      (int)wifi.rssi, (unsigned)wifi.channel);
+        if (clock.isSynced()) {
+            Serial.printf("clock: offset %lld ms, delay %lu ms\n", (long long)clock.getOffset(), clock.getDelay());
+        } else {
+            Serial.println("clock: not synced");
+        }
+        Serial.printf("report log: %u bytes pending\n", (unsigned)log.pendingBytes());
+        Serial.printf("leds: %lu frames pushed, %lu skipped (unchanged), %lu deferred, %lu failed\n",
+                      (unsigned long)leds.getFramesPushed(), (unsigned long)leds.getFramesSkipped(),
+                      (unsigned long)leds.getFramesDeferred(), (unsigned long)leds.getFramesFailed());
+        Serial.println("beacons: name, filtered rssi, last rssi, scans missed");
+        for (const BeaconTable::Entry& e : beacons) {
+            if (!e.used) continue;
+            Serial.printf("  %s %d %d %u\n", e.name, BeaconTable::filteredRssi(e), (int)e.lastRssi, (unsigned)e.missed);
+        }
+    }
+
+    void printTrace() {
+        uint32_t end = traceNext;
+        uint32_t start = end > CONSOLE_TRACE_LEN ? end - CONSOLE_TRACE_LEN : 0;
+        if (start == end) Serial.println("Nothing traced yet.");
+        for (uint32_t i = start; i < end; i++) {
+            const TraceEntry& t = traceLog[i % CONSOLE_TRACE_LEN];
+            Serial.printf("%10lu %s\n", t.atMs, t.text);
+        }
+    }
+
+    void trace(const char* format, ...) {
+        TraceEntry& t = traceLog[traceNext++ % CONSOLE_TRACE_LEN];
+        t.atMs = millis();
+        va_list args;
+        va_start(args, format);
+        vsnprintf(t.text, CONSOLE_TRACE_TEXT, format, args);
+        va_end(args);
+    }
+
+    void publishChange(ConfigKey key) {
+        ConfigChangedEvent event(key);
+        eventManager->publish(event);
+    }
+
+    Configuration& cfg;
+    Params& params;
+    UplinkStats& link;
+    WifiStats& wifi;
+    BeaconTable& beacons;
+    ClockSync& clock;
+    ReportLog& log;
+    LedManager& leds;
+    char line[CONSOLE_LINE_MAX];
+    size_t length = 0;
+    int legacyStep = 0;
+    String legacyValues[3];
+    TraceEntry traceLog[CONSOLE_TRACE_LEN] = {};
+    uint32_t traceNext = 0;
+};
+
+#endif // SERIAL_CONSOLE_H
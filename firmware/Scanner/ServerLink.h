@@ -0,0 +1,112 @@
+#ifndef SERVER_LINK_H
+#define SERVER_LINK_H
+
+#include <WiFi.h>
+#include "Process.h"
+#include "Timer.h"
+#include "Configuration.h"
+#include "EventManager.h"
+#include "UplinkStats.h"
+
+// A persistent TCP connection to a port on the server host, kept open from
+// the main loop: it reconnects while WiFi is up, backs off exponentially
+// when the server does not answer, and starts over when the server
+// changes. StreamManager and MqttManager build their protocols on it.
+//
+// Subclasses call maintain() at the top of update(), pass their events
+// through ServerLink::onEvent(), and implement handshake(), which runs
+// right after the TCP connect.
+class ServerLink : public Process {
+public:
+    ServerLink(Configuration& config, UplinkStats& uplinkStats, const char* name, uint16_t port,
+               unsigned long connectTimeoutMs, unsigned long retryMinMs, unsigned long retryMaxMs)
+        : cfg(config), stats(uplinkStats), retryTimer(0), name(name), port(port),
+          connectTimeoutMs(connectTimeoutMs), retryMinMs(retryMinMs), retryMaxMs(retryMaxMs) {}
+
+    void setup(EventManager* em) override {
+        Process::setup(em);
+        eventManager->subscribe(EVT_CONFIG_CHANGED, this);
+    }
+
+    // Reconnect to the new server on the next update
+    void onEvent(Event& event) override {
+        if (event.type == EVT_CONFIG_CHANGED && static_cast<ConfigChangedEvent&>(event).key == CONFIG_SERVER) {
+            serverChanged = true;
+        }
+    }
+
+    bool isOpen() { return open && client.connected(); }
+
+protected:
+    // True when the connection is open and can be served
+    bool maintain() {
+        if (serverChanged) {
+            serverChanged = false;
+            close();
+            retryTimer.interval = 0;
+        }
+        if (!cfg.wifiConnected) {
+            close();
+            return false;
+        }
+        if (!client.connected()) {
+            close();
+            if (retryTimer.checkAndReset()) connect();
+            return false;
+        }
+        return true;
+    }
+
+    // Sends whatever opens the protocol. False if the server refused it.
+    virtual bool handshake() = 0;
+    // The connection is gone; called once per open connection
+    virtual void onClosed() {}
+
+    void close() {
+        client.stop();
+        if (!open) return;
+        open = false;
+        onClosed();
+        Serial.printf("%s closed.\n", name);
+    }
+
+    Configuration& cfg;
+    UplinkStats& stats;
+    WiFiClient client;
+
+private:
+    void connect() {
+        String host = cfg.serverHost();
+        if (!client.connect(host.c_str(), port, connectTimeoutMs)) {
+            backOff();
+            return;
+        }
+        client.setNoDelay(true);
+        if (!handshake()) {
+            client.stop();
+            backOff();
+            return;
+        }
+        if (everOpened) stats.reconnects++;
+        open = everOpened = true;
+        retryTimer.interval = retryMinMs;
+        Serial.printf("%s open to %s:%d\n", name, host.c_str(), port);
+    }
+
+    // Doubles up to the maximum, so a server without this port costs almost nothing
+    void backOff() {
+        retryTimer.interval = retryTimer.interval == 0 ? retryMinMs : min(retryTimer.interval * 2, retryMaxMs);
+    }
+
+    Timer retryTimer;
+    const char* name;
+    uint16_t port;
+    unsigned long connectTimeoutMs;
+    unsigned long retryMinMs;
+    unsigned long retryMaxMs;
+    bool open = false;
+    bool everOpened = false;
+    bool serverChanged = false;
+};
+
+#endif // SERVER_LINK_H
@@ -0,0 +1,187 @@
+#ifndef STREAM_MANAGER_H
+#define STREAM_MANAGER_H
+
+#include "ServerLink.h"
+#include "ReportWriter.h"
+#include "ReportBatch.h"
+
+#define STREAM_RESPONSE_TIMEOUT_MS 3000
+#define STREAM_CONNECT_TIMEOUT_MS 1000
+#define STREAM_RETRY_MIN_MS 2000
+#define STREAM_RETRY_MAX_MS 60000
+#define STREAM_MAX_FRAME (2 + HTTP_RESPONSE_MAX_BYTES) // A RESPONSE: status, then the answer
+
+// Persistent TCP link to the server (see Webserver/app/stream.py for the
+// framing). Reports go up over it, and the server pushes commands down as
+// soon as they are configured instead of waiting for the next report.
+//
+// Must run before HTTPManager in the process list: a report it delivers is
+// marked as such, and HTTPManager only sends what is left, so HTTP is the
+// fallback whenever the stream is down.
+//
+// Everything here runs on the main loop, so the socket has one reader:
+// sendReport() while it waits for the answer to a report, update() in
+// between. A response that comes too late is never read, as the timeout
+// closes the connection. A frame larger than rx is skipped, not read.
+class StreamManager : public ServerLink {
+public:
+    enum FrameType : uint8_t {
+        FRAME_HELLO = 1,
+        FRAME_REPORT = 2,
+        FRAME_RESPONSE = 3,
+        FRAME_COMMAND = 4,
+        FRAME_ACK = 5
+    };
+
+    StreamManager(Configuration& config, UplinkStats& uplinkStats)
+        : ServerLink(config, uplinkStats, "Stream", STREAM_PORT, STREAM_CONNECT_TIMEOUT_MS,
+                     STREAM_RETRY_MIN_MS, STREAM_RETRY_MAX_MS) {}
+
+    void setup(EventManager* em) override {
+        ServerLink::setup(em);
+        eventManager->subscribe(EVT_DATA_READY_FOR_HTTP, this);
+        eventManager->subscribe(EVT_COMMAND_APPLIED, this);
+    }
+
+    void onEvent(Event& event) override {
+        ServerLink::onEvent(event);
+        if (event.type == EVT_DATA_READY_FOR_HTTP) {
+            DataReadyForHttpEvent& e = static_cast<DataReadyForHttpEvent&>(event);
+            if (e.pending() && client.connected()) sendReport(e);
+        }
+        if (event.type == EVT_COMMAND_APPLIED && client.connected()) {
+            CommandAppliedEvent& e = static_cast<CommandAppliedEvent&>(event);
+            uint8_t seq[4] = { (uint8_t)e.seq, (uint8_t)(e.seq >> 8), (uint8_t)(e.seq >> 16), (uint8_t)(e.seq >> 24) };
+            writeFrame(FRAME_ACK, seq, sizeof(seq));
+        }
+    }
+
+    void update() override {
+        if (!maintain()) return;
+
+        // Commands pushed by the server
+        uint8_t type;
+        size_t length;
+        while (client.available() >= 3 && readFrame(type, length, STREAM_RESPONSE_TIMEOUT_MS)) {
+            handleFrame(type, length);
+        }
+    }
+
+private:
+    bool handshake() override {
+        return writeFrame(FRAME_HELLO, (const uint8_t*)cfg.macAddress.c_str(), cfg.macAddress.length());
+    }
+
+    void sendReport(DataReadyForHttpEvent& report) {
+        if (report.length + 9 > 0xFFFF) return;
+
+        // format:u8 captured_at:i64, then the report itself
+        uint8_t header[3 + 9];
+        uint16_t length = report.length + 9;
+        header[0] = FRAME_REPORT;
+        header[1] = length & 0xFF;
+        header[2] = length >> 8;
+        header[3] = reportFormat(report.contentType);
+        int64_t capturedAt = report.replay ? report.capturedAt : 0;
+        for (int i = 0; i < 8; i++) header[4 + i] = (uint8_t)(capturedAt >> (8 * i));
+
+        unsigned long sentAtMs = millis();
+        if (client.write(header, sizeof(header)) != sizeof(header) ||
+            client.write(report.body, report.length) != report.length) {
+            close();
+            return;
+        }
+
+        // Wait for the response; pushed commands may arrive in between
+        uint8_t type;
+        size_t frameLength;
+        while (readFrame(type, frameLength, STREAM_RESPONSE_TIMEOUT_MS)) {
+            if (type != FRAME_RESPONSE) {
+                handleFrame(type, frameLength);
+                continue;
+            }
+            if (frameLength < 2) break;
+            unsigned long receivedAtMs = millis();
+            // The server has the report; only its answer is lost
+            bool skipped = frameLength > STREAM_MAX_FRAME;
+            uint16_t status = rx[0] | (rx[1] << 8);
+            stats.requests++;
+            stats.reused++;
+            if (status != 200) {
+                stats.failures++;
+                return; // Left for HTTPManager, which reports the failure
+            }
+            stats.recordRoundTrip(receivedAtMs - sentAtMs);
+            report.delivered = true;
+            if (skipped) {
+                Serial.println("Stream response too large, ignored.");
+                return;
+            }
+            HttpResponseEvent responseEvent((const char*)rx + 2, frameLength - 2, receivedAtMs);
+            eventManager->publish(responseEvent);
+            return;
+        }
+        // No response in time: the link is not trustworthy anymore
+        close();
+    }
+
+    void handleFrame(uint8_t type, size_t length) {
+        if (type == FRAME_COMMAND && length > STREAM_MAX_FRAME) {
+            Serial.println("Stream command too large, ignored.");
+        } else if (type == FRAME_COMMAND) {
+            // Same JSON as a /data response, so BehaviorManager handles both
+            Serial.printf("Command pushed: %s\n", (const char*)rx);
+            HttpResponseEvent commandEvent((const char*)rx, length, millis());
+            eventManager->publish(commandEvent);
+        } else if (type == FRAME_RESPONSE) {
+            // Every report waits for its own response, so the server is out of step
+            Serial.println("Stream response without a report.");
+            close();
+        }
+    }
+
+    // Reads one frame into rx (NUL-terminated). A frame larger than rx keeps
+    // its first STREAM_MAX_FRAME bytes there and the rest is read and
+    // dropped, so the link stays in step; `length` is the full length. False
+    // on timeout or error, after which the connection is closed.
+    bool readFrame(uint8_t& type, size_t& length, unsigned long timeoutMs) {
+        uint8_t header[3];
+        client.setTimeout(timeoutMs);
+        if (client.readBytes(header, 3) != 3) {
+            if (!client.connected()) close();
+            return false;
+        }
+        type = header[0];
+        length = header[1] | (header[2] << 8);
+        size_t kept = min(length, (size_t)STREAM_MAX_FRAME);
+        if (client.readBytes(rx, kept) != kept || !skip(length - kept)) {
+            close();
+            return false;
+        }
+        rx[kept] = '\0';
+        return true;
+    }
+
+    bool skip(size_t length) {
+        uint8_t scratch[64];
+        while (length > 0) {
+            size_t n = min(length, sizeof(scratch));
+            if (client.readBytes(scratch, n) != n) return false;
+            length -= n;
+        }
+        return true;
+    }
+
+    bool writeFrame(uint8_t type, const uint8_t* payload, size_t length) {
+        uint8_t header[3] = { type, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8) };
+        if (client.write(header, 3) != 3 || client.write(payload, length) != length) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    uint8_t rx[STREAM_MAX_FRAME + 1];
+};
+
+#endif // STREAM_MANAGER_H
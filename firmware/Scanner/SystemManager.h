@@ -44,10 +44,9 @@ public:
             if (reading != currentButtonState) {
                 currentButtonState = reading;
 
-                // If the new stable state is pressed (LOW)
+                // Configuration goes through SerialConsole, which always listens
                 if (currentButtonState == LOW) {
-                    Serial.println("Entering config mode due to button press...");
-                    cfg.enterSerialConfig(); // This will block and restart
+                    Serial.println("Serial console ready, type 'help'.");
                 }
             }
         }
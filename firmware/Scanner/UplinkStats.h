@@ -0,0 +1,46 @@
+#ifndef UPLINK_STATS_H
+#define UPLINK_STATS_H
+
+#include <Arduino.h>
+#include "ReportWriter.h"
+#include "JsonWriter.h"
+
+// Counters kept by the uplink transport and sent with the next report, so
+// the server can follow connection reuse and round-trip times per scanner.
+struct UplinkStats {
+    uint32_t requests = 0;
+    uint32_t reused = 0;      // Requests sent over an already open connection
+    uint32_t reconnects = 0;  // Connections opened after the first one
+    uint32_t failures = 0;
+    uint32_t lastRoundTripMs = 0;
+    uint32_t avgRoundTripMs = 0; // Moving average, alpha 1/8
+
+    void recordRoundTrip(uint32_t ms) {
+        lastRoundTripMs = ms;
+        avgRoundTripMs = avgRoundTripMs == 0 ? ms : avgRoundTripMs + ((int32_t)ms - (int32_t)avgRoundTripMs) / 8;
+    }
+
+    void writeReport(JsonWriter& out) const {
+        out.beginObject("link");
+        out.add("ms", lastRoundTripMs);
+        out.add("avg_ms", avgRoundTripMs);
+        out.add("requests", requests);
+        out.add("reused", reused);
+        out.add("reconnects", reconnects);
+        out.add("failures", failures);
+        out.endObject();
+    }
+
+    void writeReport(ReportWriter& out) const {
+        out.beginSection(SECTION_LINK);
+        out.put32(lastRoundTripMs);
+        out.put32(avgRoundTripMs);
+        out.put32(requests);
+        out.put32(reused);
+        out.put32(reconnects);
+        out.put32(failures);
+        out.endSection();
+    }
+};
+
+#endif // UPLINK_STATS_H
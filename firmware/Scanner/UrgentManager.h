@@ -0,0 +1,208 @@
+#ifndef URGENT_MANAGER_H
+#define URGENT_MANAGER_H
+
+#include "Process.h"
+#include "EventManager.h"
+#include "Configuration.h"
+#include "ClockSync.h"
+#include "BeaconTable.h"
+#include "ReportWriter.h"
+#include "JsonWriter.h"
+#include "Utils.h"
+
+#define URGENT_QUEUE_LEN 4
+#define URGENT_DEDUP_SLOTS 8
+#define URGENT_DEDUP_MS 30000 // An event seen again within this time of its last sighting is dropped
+#define URGENT_BURST 3        // Urgent messages that may go out back to back
+#define URGENT_REFILL_MS 5000 // After that, one more per interval
+
+// Sends UrgentEvents out of band, without waiting for the next scan report.
+//
+// Events wait in a small queue ordered by kind, so an impact goes before a
+// beacon. update() sends everything queued in one message over the normal
+// transports, as soon as WiFi is up and the rate limit allows it. Reports
+// are sent from the main loop too, so the two never share a transport
+// mid-send. The limit is a token bucket of URGENT_BURST messages, refilled
+// one every URGENT_REFILL_MS. An event is deduplicated by kind and beacon
+// name: it is dropped while the same event was already seen in the last
+// URGENT_DEDUP_MS, so a beacon that stays close is reported once when it
+// arrives.
+//
+// Every event carries its detection time on the server clock, from which
+// the server measures the end-to-end latency. The time from detection to the
+// answer is logged here as well.
+class UrgentManager : public Process {
+public:
+    UrgentManager(Configuration& config, ClockSync& clockSync)
+        : cfg(config), clock(clockSync) {}
+
+    void setup(EventManager* em) override {
+        Process::setup(em);
+        eventManager->subscribe(EVT_URGENT, this);
+        tokens = URGENT_BURST;
+        refilledAtMs = millis();
+    }
+
+    void onEvent(Event& event) override {
+        if (event.type == EVT_URGENT) {
+            enqueue(static_cast<UrgentEvent&>(event));
+        }
+    }
+
+    void update() override {
+        if (tokens < URGENT_BURST && millis() - refilledAtMs >= URGENT_REFILL_MS) {
+            tokens++;
+            refilledAtMs = millis();
+        }
+        if (queued == 0 || tokens == 0 || !cfg.wifiConnected) return;
+        if (tokens == URGENT_BURST) refilledAtMs = millis(); // Refill counts from the first send
+        tokens--;
+        send();
+    }
+
+private:
+    struct Entry {
+        UrgentKind kind;
+        int16_t value;
+        unsigned long atMs;
+        char name[BEACON_NAME_LEN];
+    };
+
+    struct Sighting {
+        uint32_t key;
+        unsigned long lastMs;
+    };
+
+    void enqueue(const UrgentEvent& e) {
+        uint32_t key = nameHash(e.name) ^ e.kind;
+        if (isDuplicate(key, e.atMs)) {
+            deduped++;
+            return;
+        }
+
+        // Kept sorted by kind, highest first; within a kind, oldest first
+        int at = queued;
+        while (at > 0 && queue[at - 1].kind < e.kind) at--;
+        if (at == URGENT_QUEUE_LEN) {
+            dropped++;
+            return;
+        }
+        if (queued == URGENT_QUEUE_LEN) {
+            dropped++; // The last entry, of the lowest kind, makes room
+            queued--;
+        }
+        memmove(&queue[at + 1], &queue[at], (queued - at) * sizeof(Entry));
+        Entry& entry = queue[at];
+        entry.kind = e.kind;
+        entry.value = e.value;
+        entry.atMs = e.atMs;
+        strncpy(entry.name, e.name, BEACON_NAME_LEN - 1);
+        entry.name[BEACON_NAME_LEN - 1] = '\0';
+        queued++;
+    }
+
+    // Remembers when each event was last seen. A sighting refreshes the
+    // window, so the event only goes out again after a quiet period.
+    bool isDuplicate(uint32_t key, unsigned long nowMs) {
+        Sighting* slot = &sightings[0];
+        for (Sighting& s : sightings) {
+            if (s.key == key && s.lastMs) {
+                bool recent = nowMs - s.lastMs < URGENT_DEDUP_MS;
+                s.lastMs = nowMs;
+                return recent;
+            }
+            if (s.lastMs < slot->lastMs) slot = &s; // Oldest or unused
+        }
+        slot->key = key;
+        slot->lastMs = nowMs ? nowMs : 1;
+        return false;
+    }
+
+    void send() {
+        unsigned long oldestAtMs = queue[0].atMs;
+        for (int i = 1; i < queued; i++) {
+            if ((long)(queue[i].atMs - oldestAtMs) < 0) oldestAtMs = queue[i].atMs;
+        }
+
+#if REPORT_BINARY
+        encodeBinary();
+        DataReadyForHttpEvent event(writer.data(), writer.size(), REPORT_CONTENT_TYPE_BINARY);
+#else
+        encodeJson();
+        DataReadyForHttpEvent event(json.data(), json.size(), REPORT_CONTENT_TYPE_JSON);
+#endif
+        event.urgent = true;
+        Serial.printf("[Urgent] Sending %d event(s)\n", queued);
+        eventManager->publish(event);
+
+        if (event.delivered) {
+            // All transports answer synchronously, so this is detection to answer
+            Serial.printf("[Urgent] Delivered, %lu ms after detection (%u deduplicated, %u dropped so far)\n",
+                          millis() - oldestAtMs, (unsigned)deduped, (unsigned)dropped);
+            queued = 0;
+        } else {
+            Serial.println("[Urgent] Not delivered, retrying.");
+        }
+    }
+
+    // Detection time on the server clock, 0 while the clock is not synced
+    int64_t serverTime(unsigned long atMs) const {
+        return clock.isSynced() ? clock.nowServer() - (int64_t)(millis() - atMs) : 0;
+    }
+
+#if !REPORT_BINARY
+    // {"scanner_id": ..., "urgent": [{"kind": "beacon", "name": ..., "value": -45, "ago": 12, "at": ...}], "t0": ...}
+    void encodeJson() {
+        unsigned long now = millis();
+        json.begin();
+        json.add("scanner_id", cfg.macAddress.c_str());
+        json.beginArray("urgent");
+        for (int i = 0; i < queued; i++) {
+            const Entry& e = queue[i];
+            json.beginObject();
+            json.add("kind", e.kind == URGENT_IMPACT ? "impact" : "beacon");
+            if (e.name[0]) json.add("name", e.name);
+            json.add("value", (int)e.value);
+            json.add("ago", now - e.atMs);
+            int64_t at = serverTime(e.atMs);
+            if (at) json.add("at", (long long)at);
+            json.endObject();
+        }
+        json.endArray();
+        json.add("t0", now);
+        json.end();
+    }
+#else
+    void encodeBinary() {
+        unsigned long now = millis();
+        writer.begin(cfg.macAddress, now);
+        writer.beginSection(SECTION_URGENT);
+        for (int i = 0; i < queued; i++) {
+            const Entry& e = queue[i];
+            writer.put8(e.kind);
+            writer.put16(e.value);
+            writer.put32(now - e.atMs);
+            writer.put64(serverTime(e.atMs));
+            writer.putString(e.name);
+        }
+        writer.endSection();
+    }
+#endif
+
+    Configuration& cfg;
+    ClockSync& clock;
+    Entry queue[URGENT_QUEUE_LEN];
+    int queued = 0;
+    Sighting sightings[URGENT_DEDUP_SLOTS] = {};
+    int tokens = 0;
+    unsigned long refilledAtMs = 0;
+    uint32_t deduped = 0;
+    uint32_t dropped = 0;
+#if REPORT_BINARY
+    ReportWriter writer;
+#else
+    JsonWriter json;
+#endif
+};
+
+#endif // URGENT_MANAGER_H
@@ -3,11 +3,30 @@
 
 #include <Arduino.h>
 
-static uint32_t hexToColor(String hex) {
-    if (hex.startsWith("#")) {
-        hex = hex.substring(1);
+static int hexNibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// "#RRGGBB" or "RRGGBB" -> 0xRRGGBB, parsed in place. Stops at the first
+// character that is not a hex digit, like strtol.
+static uint32_t hexToColor(const char* hex) {
+    if (!hex) return 0;
+    if (*hex == '#') hex++;
+    uint32_t color = 0;
+    for (int digit; (digit = hexNibble(*hex)) >= 0; hex++) {
+        color = (color << 4) | digit;
     }
-    return (uint32_t)strtol(("0x" + hex).c_str(), NULL, 16);
+    return color;
+}
+
+// FNV-1a. constexpr, so names can be hashed into case labels and a switch
+// dispatches on them without building strings; the compiler rejects two
+// names with the same hash as duplicate case labels.
+constexpr uint32_t nameHash(const char* s, uint32_t hash = 2166136261u) {
+    return *s ? nameHash(s + 1, (hash ^ (uint8_t)*s) * 16777619u) : hash;
 }
 
-#endif // UTILS_H 
\ No newline at end of file
+#endif // UTILS_H
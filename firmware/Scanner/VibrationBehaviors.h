@@ -2,23 +2,59 @@
 #define VIBRATION_BEHAVIORS_H
 
 #include "Arduino.h"
-#include "Timer.h"
 #include "config.h"
 #include <ArduinoJson.h>
+#include "HapticSequencer.h"
+
+// A behavior's parameters in binary form, as presets keep them
+struct VibrationParams {
+    uint8_t intensity = 0;
+    uint32_t frequency = 0;
+    HapticWaveform waveform; // Waveform: the uploaded steps
+};
 
 // --- Vibration Behavior Base Class ---
+// A behavior describes its pattern as a waveform; the HapticSequencer in
+// VibrationManager plays it in the background.
 class VibrationBehavior {
 public:
     const char* type;
     virtual ~VibrationBehavior() {}
-    virtual void setup() {
-        pinMode(VIBRATION_MOTOR_PIN, OUTPUT);
+    const HapticWaveform& getWaveform() const { return waveform; }
+
+    // Params a command leaves out keep their current values
+    void updateParams(JsonObject& params) {
+        VibrationParams p;
+        saveParams(p);
+        if (parseParams(params, p)) loadParams(p);
     }
-    virtual void update() = 0;
-    virtual void updateParams(JsonObject& params) {}
+    virtual void saveParams(VibrationParams& p) const { p.waveform = waveform; }
+    // Merges the JSON params over p; false if they are invalid
+    virtual bool parseParams(JsonObject& params, VibrationParams& p) const { return true; }
+    virtual void loadParams(const VibrationParams& p) { waveform = p.waveform; }
 
 protected:
     VibrationBehavior(const char* type) : type(type) {}
+    HapticWaveform waveform;
+
+    // Square wave that toggles every 1000 / frequency ms
+    void buildToggle(uint8_t intensity, unsigned long frequency) {
+        waveform.clear();
+        uint16_t half = frequency > 0 ? 1000 / frequency : 0;
+        if (half == 0) {
+            waveform.add(0, 0);
+            return;
+        }
+        waveform.add(intensity, half);
+        waveform.add(0, half);
+        waveform.loop = true;
+    }
+
+    static bool parseToggle(JsonObject& params, VibrationParams& p) {
+        if (params.containsKey("intensity")) p.intensity = params["intensity"].as<uint8_t>();
+        if (params.containsKey("frequency")) p.frequency = params["frequency"].as<unsigned long>();
+        return true;
+    }
 };
 
 // --- Concrete Vibration Behaviors ---
@@ -26,13 +62,8 @@ protected:
 // 1. MotorOffBehavior
 class MotorOffBehavior : public VibrationBehavior {
 public:
-    MotorOffBehavior() : VibrationBehavior("Off") {}
-    void setup() override {
-        VibrationBehavior::setup();
-        analogWrite(VIBRATION_MOTOR_PIN, 0);
-    }
-    void update() override {
-        // Do nothing, motor is off
+    MotorOffBehavior() : VibrationBehavior("Off") {
+        waveform.add(0, 0);
     }
 };
 
@@ -40,82 +71,97 @@ public:
 class ConstantVibrationBehavior : public VibrationBehavior {
 public:
     uint8_t intensity;
-    ConstantVibrationBehavior(uint8_t intensity) : VibrationBehavior("Constant"), intensity(intensity) {}
-    
-    void updateParams(JsonObject& params) override {
-        intensity = params["intensity"].as<uint8_t>();
+    ConstantVibrationBehavior(uint8_t intensity) : VibrationBehavior("Constant"), intensity(intensity) {
+        build();
+    }
+
+    void saveParams(VibrationParams& p) const override { p.intensity = intensity; }
+
+    bool parseParams(JsonObject& params, VibrationParams& p) const override {
+        if (params.containsKey("intensity")) p.intensity = params["intensity"].as<uint8_t>();
+        return true;
     }
 
-    void setup() override {
-        VibrationBehavior::setup();
-        analogWrite(VIBRATION_MOTOR_PIN, intensity);
+    void loadParams(const VibrationParams& p) override {
+        intensity = p.intensity;
+        build();
     }
-    
-    void update() override {
-        // Do nothing, motor is at constant vibration
+
+private:
+    void build() {
+        waveform.clear();
+        waveform.add(intensity, 0);
     }
 };
 
 // 3. BurstVibrationBehavior
+// Hard on/off edges
 class BurstVibrationBehavior : public VibrationBehavior {
 public:
     uint8_t intensity;
     unsigned long frequency;
-    BurstVibrationBehavior(uint8_t intensity, unsigned long frequency) 
-        : VibrationBehavior("Burst"), intensity(intensity), frequency(frequency), burstTimer(frequency > 0 ? 1000 / frequency : 0), motorOn(false) {}
+    BurstVibrationBehavior(uint8_t intensity, unsigned long frequency, const char* type = "Burst")
+        : VibrationBehavior(type), intensity(intensity), frequency(frequency) {
+        buildToggle(intensity, frequency);
+    }
 
-    void updateParams(JsonObject& params) override {
-        intensity = params["intensity"].as<uint8_t>();
-        frequency = params["frequency"].as<unsigned long>();
-        burstTimer.interval = frequency > 0 ? 1000 / frequency : 0;
+    void saveParams(VibrationParams& p) const override {
+        p.intensity = intensity;
+        p.frequency = frequency;
     }
 
-    void setup() override {
-        VibrationBehavior::setup();
-        burstTimer.reset();
-        analogWrite(VIBRATION_MOTOR_PIN, 0); // Start in off state
+    bool parseParams(JsonObject& params, VibrationParams& p) const override {
+        return parseToggle(params, p);
     }
-    
-    void update() override {
-        if (burstTimer.interval > 0 && burstTimer.checkAndReset()) {
-            motorOn = !motorOn;
-            analogWrite(VIBRATION_MOTOR_PIN, motorOn ? intensity : 0);
-        }
+
+    void loadParams(const VibrationParams& p) override {
+        intensity = p.intensity;
+        frequency = p.frequency;
+        buildToggle(intensity, frequency);
     }
-private:
-    Timer burstTimer;
-    bool motorOn;
 };
 
 // 4. PulseVibrationBehavior
-class PulseVibrationBehavior : public VibrationBehavior {
+// Has always played the same square wave as Burst; kept as its own name
+// for the servers and presets that select it
+class PulseVibrationBehavior : public BurstVibrationBehavior {
 public:
-    uint8_t intensity;
-    unsigned long frequency;
-    PulseVibrationBehavior(uint8_t intensity = 0, unsigned long frequency = 0) 
-        : VibrationBehavior("Pulse"), intensity(intensity), frequency(frequency), pulseTimer(frequency > 0 ? 1000 / frequency : 0), motorOn(false) {}
+    PulseVibrationBehavior(uint8_t intensity = 0, unsigned long frequency = 0)
+        : BurstVibrationBehavior(intensity, frequency, "Pulse") {}
+};
 
-    void updateParams(JsonObject& params) override {
-        intensity = params["intensity"].as<uint8_t>();
-        frequency = params["frequency"].as<unsigned long>();
-        pulseTimer.interval = frequency > 0 ? 1000 / frequency : 0;
+// 5. WaveformVibrationBehavior
+// Plays a pattern uploaded by the server.
+class WaveformVibrationBehavior : public VibrationBehavior {
+public:
+    WaveformVibrationBehavior() : VibrationBehavior("Waveform") {
+        waveform.add(0, 0);
     }
 
-    void setup() override {
-        VibrationBehavior::setup();
-        pulseTimer.reset();
-        analogWrite(VIBRATION_MOTOR_PIN, 0);
-    }
-    
-    void update() override {
-        if (pulseTimer.interval > 0 && pulseTimer.checkAndReset()) {
-            motorOn = !motorOn;
-            analogWrite(VIBRATION_MOTOR_PIN, motorOn ? intensity : 0);
+    // params: { "loop": true, "steps": [[intensity, duration_ms, ramp_ms], ...] }
+    bool parseParams(JsonObject& params, VibrationParams& p) const override {
+        if (params.containsKey("steps")) {
+            HapticWaveform uploaded;
+            JsonArray steps = params["steps"];
+            for (JsonVariant step : steps) {
+                unsigned long durationMs = step[1].as<unsigned long>();
+                unsigned long rampMs = step[2] | 0UL;
+                if (durationMs > HAPTIC_MAX_STEP_MS || rampMs > HAPTIC_MAX_STEP_MS) {
+                    Serial.printf("Waveform rejected: durations and ramps are at most %d ms.\n", HAPTIC_MAX_STEP_MS);
+                    return false;
+                }
+                if (!uploaded.add(step[0].as<uint8_t>(), durationMs, rampMs)) {
+                    Serial.printf("Waveform rejected: at most %d steps.\n", HAPTIC_MAX_STEPS);
+                    return false;
+                }
+            }
+            if (uploaded.count == 0) return false;
+            p.waveform = uploaded;
+            p.waveform.loop = false;
         }
+        if (params.containsKey("loop")) p.waveform.loop = params["loop"].as<bool>();
+        return true;
     }
-private:
-    Timer pulseTimer;
-    bool motorOn;
 };
 
-#endif // VIBRATION_BEHAVIORS_H 
\ No newline at end of file
+#endif // VIBRATION_BEHAVIORS_H
@@ -5,36 +5,43 @@
 #include "Process.h"
 #include "config.h"
 #include "VibrationBehaviors.h"
+#include "HapticSequencer.h"
 
 class VibrationManager : public Process {
 public:
-    VibrationManager() : Process(), currentBehavior(nullptr) {
+    VibrationManager() : Process(), currentBehavior(nullptr), sequencer(VIBRATION_MOTOR_PIN) {
     }
 
     ~VibrationManager() {
+        sequencer.stop();
     }
 
     void setBehavior(VibrationBehavior* newBehavior) {
+        setBehaviorAt(newBehavior, millis());
+    }
+
+    // Starts the behavior at a given millis(), e.g. a fleet-wide start time.
+    // The sequencer's timer makes the switch, so a loop blocked on HTTP does
+    // not delay it.
+    void setBehaviorAt(VibrationBehavior* newBehavior, unsigned long startAtMs) {
+        long wait = (long)(startAtMs - millis());
         currentBehavior = newBehavior;
-        if (currentBehavior) {
-            currentBehavior->setup();
-        }
+        sequencer.play(newBehavior ? newBehavior->getWaveform() : HapticWaveform(), wait > 0 ? wait : 0);
     }
 
     void setup(EventManager* em) override {
         Process::setup(em);
+        sequencer.begin();
     }
 
     void update() override {
-        if (currentBehavior) {
-            currentBehavior->update();
-        }
+        // Patterns are started and played by the sequencer's timers
     }
 
     VibrationBehavior* currentBehavior;
 
 private:
-    // No private members
+    HapticSequencer sequencer;
 };
 
-#endif // VIBRATION_MANAGER_H 
\ No newline at end of file
+#endif // VIBRATION_MANAGER_H
@@ -4,21 +4,46 @@
 #include "Process.h"
 #include "Timer.h"
 #include "Configuration.h"
+#include "WifiStats.h"
+#include "BootStats.h"
+#include "Params.h"
+#include "Utils.h"
+#include <Preferences.h>
 #include <WiFi.h>
 
-class WifiManager : public Process {
-private:
-    Timer wifiCheckTimer;
-    Configuration& cfg;
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000
+#define WIFI_JOIN_TIMEOUT_MS 10000
+#define WIFI_SCAN_RETRY_MS 5000
+#define WIFI_ROAM_CHECK_MS 10000
 
+// Connects to the strongest configured network and keeps the connection up.
+//
+// The access point (BSSID and channel) of the last connection is cached in
+// NVS. At boot and after a drop it is joined directly, which skips the
+// scan; the address still comes from DHCP. If that does not connect within WIFI_FAST_CONNECT_TIMEOUT_MS, the manager
+// scans and joins the configured network with the best signal. While
+// connected, a signal below wifi_roam_rssi triggers a background scan, and
+// the scanner moves to an access point that is wifi_roam_margin_db stronger.
+// All of this runs from update() without blocking; the stack's own
+// reconnect is turned off so the two do not compete.
+class WifiManager : public Process {
 public:
-    WifiManager(Configuration& config) 
-        : wifiCheckTimer(500), cfg(config) {}
+    WifiManager(Configuration& config, Params& parameters, WifiStats& wifiStats, BootStats& bootStats)
+        : cfg(config), params(parameters), stats(wifiStats), boot(bootStats), dotTimer(500), roamTimer(WIFI_ROAM_CHECK_MS) {}
 
     void setup(EventManager* em) override {
         Process::setup(em);
-        WiFi.begin(cfg.ssid.c_str(), cfg.password.c_str());
+        WiFi.persistent(false); // The SDK's own credential store would write flash on every connect
+        WiFi.setAutoReconnect(false);
+        eventManager->subscribe(EVT_CONFIG_CHANGED, this);
+        loadCache();
+        if (cfg.networkCount == 0) {
+            Serial.println("No WiFi network configured.");
+            return;
+        }
         Serial.println("Connecting to WiFi...");
+        if (!joinCached()) startScan();
+        boot.mark(BOOT_WIFI_STARTED);
     }
 
     void update() override {
@@ -27,17 +52,55 @@ public:
         if (isConnected != cfg.wifiConnected) {
             cfg.wifiConnected = isConnected;
             if (isConnected) {
-                Serial.println("\nConnected to WiFi");
-                WifiConnectedEvent event;
-                eventManager->publish(event);
+                onConnected();
+            } else {
+                onDisconnected();
             }
         }
 
-        if (!isConnected) {
-            if (wifiCheckTimer.checkAndReset()) {
-                Serial.print(".");
-            }
+        switch (state) {
+            case FAST_JOINING:
+                if (!isConnected && millis() - stateStartMs > WIFI_FAST_CONNECT_TIMEOUT_MS) {
+                    Serial.println("[WiFi] Cached access point not reachable, scanning.");
+                    WiFi.disconnect();
+                    startScan();
+                }
+                break;
+            case JOINING:
+                if (!isConnected && millis() - stateStartMs > WIFI_JOIN_TIMEOUT_MS) {
+                    Serial.println("[WiFi] Join timed out, scanning again.");
+                    WiFi.disconnect();
+                    startScan();
+                }
+                break;
+            case SCANNING:
+            case ROAM_SCANNING:
+                checkScan();
+                break;
+            case SCAN_WAIT:
+                if (millis() - stateStartMs > WIFI_SCAN_RETRY_MS) startScan();
+                break;
+            case ONLINE:
+                if (roamTimer.checkAndReset()) checkSignal();
+                break;
+            case IDLE:
+                break;
         }
+
+        if (!isConnected && cfg.networkCount > 0 && dotTimer.checkAndReset()) {
+            Serial.print(".");
+        }
+    }
+
+    // Networks changed at runtime: start over with the new list
+    void onEvent(Event& event) override {
+        if (event.type != EVT_CONFIG_CHANGED || static_cast<ConfigChangedEvent&>(event).key != CONFIG_WIFI) return;
+        WiFi.scanDelete();
+        WiFi.disconnect();
+        setState(IDLE);
+        if (cfg.networkCount == 0) return;
+        Serial.println("[WiFi] Networks changed, reconnecting.");
+        if (!joinCached()) startScan();
     }
 
     bool isConnected() const {
@@ -47,6 +110,166 @@ public:
     String getMacAddress() const {
         return WiFi.macAddress();
     }
+
+private:
+    enum State { IDLE, FAST_JOINING, SCANNING, SCAN_WAIT, JOINING, ONLINE, ROAM_SCANNING };
+
+    // The last good connection, as stored in NVS
+    struct Cache {
+        uint32_t ssidHash; // nameHash() of the SSID, so a reconfigured network is not joined blind
+        uint8_t bssid[6];
+        uint8_t channel;
+    };
+
+    void onConnected() {
+        unsigned long took;
+        if (!everConnected) {
+            took = stats.bootMs = millis();
+            everConnected = true;
+            boot.mark(BOOT_WIFI_CONNECTED);
+        } else {
+            took = stats.reconnectMs = millis() - disconnectedAtMs;
+            stats.reconnects++;
+        }
+        stats.fast = (state == FAST_JOINING);
+        stats.rssi = WiFi.RSSI();
+        stats.channel = WiFi.channel();
+        Serial.printf("\nConnected to WiFi %s (%s, channel %d, %d dBm) after %lu ms%s\n",
+                      WiFi.SSID().c_str(), WiFi.BSSIDstr().c_str(), (int)stats.channel, (int)stats.rssi,
+                      took, stats.fast ? ", fast" : "");
+
+        setState(ONLINE);
+        roamTimer.reset();
+        saveCache();
+
+        WifiConnectedEvent event;
+        eventManager->publish(event);
+    }
+
+    void onDisconnected() {
+        disconnectedAtMs = millis();
+        // Lost during a roam scan: let the scan finish and join the best
+        if (state == ROAM_SCANNING) state = SCANNING;
+        // A roam drops the old access point on purpose and is already joining
+        if (state != ONLINE) return;
+        Serial.println("[WiFi] Connection lost, reconnecting.");
+        if (!joinCached()) startScan();
+    }
+
+    // Joins the cached access point directly. Returns false without a usable cache.
+    bool joinCached() {
+        const WifiNetwork* network = cacheValid ? findNetwork(cache.ssidHash) : nullptr;
+        if (!network) return false;
+        WiFi.begin(network->ssid.c_str(), network->password.c_str(), cache.channel, cache.bssid);
+        setState(FAST_JOINING);
+        return true;
+    }
+
+    void startScan() {
+        if (WiFi.scanNetworks(true) == WIFI_SCAN_FAILED) {
+            setState(SCAN_WAIT);
+            return;
+        }
+        setState(state == ONLINE ? ROAM_SCANNING : SCANNING);
+    }
+
+    // Picks the strongest access point of any configured network from a
+    // finished scan and joins it. When roaming, only a clearly stronger one
+    // than the current access point is worth the reconnect.
+    void checkScan() {
+        int16_t found = WiFi.scanComplete();
+        if (found == WIFI_SCAN_RUNNING) return;
+
+        int best = -1;
+        const WifiNetwork* bestNetwork = nullptr;
+        for (int i = 0; i < found; i++) {
+            const WifiNetwork* network = findNetwork(nameHash(WiFi.SSID(i).c_str()));
+            if (network && (best < 0 || WiFi.RSSI(i) > WiFi.RSSI(best))) {
+                best = i;
+                bestNetwork = network;
+            }
+        }
+
+        if (state == ROAM_SCANNING) {
+            bool stronger = best >= 0 && memcmp(WiFi.BSSID(best), WiFi.BSSID(), 6) != 0
+                            && WiFi.RSSI(best) >= WiFi.RSSI() + params.get(PARAM_WIFI_ROAM_MARGIN_DB);
+            if (!stronger) {
+                WiFi.scanDelete();
+                setState(ONLINE);
+                return;
+            }
+            Serial.printf("[WiFi] Roaming to %s (%d dBm, was %d dBm)\n",
+                          WiFi.BSSIDstr(best).c_str(), (int)WiFi.RSSI(best), (int)WiFi.RSSI());
+            stats.roams++;
+        } else if (best < 0) {
+            // Nothing in range, or a hidden network: try the first one blind
+            Serial.println("[WiFi] No configured network found, trying the first one.");
+            WiFi.scanDelete();
+            WiFi.begin(cfg.networks[0].ssid.c_str(), cfg.networks[0].password.c_str());
+            setState(JOINING);
+            return;
+        }
+
+        uint8_t bssid[6];
+        memcpy(bssid, WiFi.BSSID(best), 6);
+        int32_t channel = WiFi.channel(best);
+        WiFi.scanDelete();
+        WiFi.begin(bestNetwork->ssid.c_str(), bestNetwork->password.c_str(), channel, bssid);
+        setState(JOINING);
+    }
+
+    void checkSignal() {
+        stats.rssi = WiFi.RSSI();
+        if (stats.rssi < params.get(PARAM_WIFI_ROAM_RSSI)) startScan();
+    }
+
+    const WifiNetwork* findNetwork(uint32_t ssidHash) const {
+        for (int i = 0; i < cfg.networkCount; i++) {
+            if (nameHash(cfg.networks[i].ssid.c_str()) == ssidHash) return &cfg.networks[i];
+        }
+        return nullptr;
+    }
+
+    void loadCache() {
+        preferences.begin("wifi", true);
+        cacheValid = preferences.getBytes("cache", &cache, sizeof(cache)) == sizeof(cache);
+        preferences.end();
+    }
+
+    // Written only when something changed, to spare the flash
+    void saveCache() {
+        Cache current;
+        memset(&current, 0, sizeof(current)); // Padding too, for the memcmp below
+        current.ssidHash = nameHash(WiFi.SSID().c_str());
+        memcpy(current.bssid, WiFi.BSSID(), 6);
+        current.channel = WiFi.channel();
+        if (cacheValid && memcmp(&current, &cache, sizeof(cache)) == 0) return;
+
+        cache = current;
+        cacheValid = true;
+        preferences.begin("wifi", false);
+        preferences.putBytes("cache", &cache, sizeof(cache));
+        preferences.end();
+    }
+
+    void setState(State s) {
+        state = s;
+        stateStartMs = millis();
+    }
+
+    Configuration& cfg;
+    Params& params;
+    WifiStats& stats;
+    BootStats& boot;
+    Preferences preferences;
+    Timer dotTimer;
+    Timer roamTimer;
+    Cache cache;
+    bool cacheValid = false;
+    State state = IDLE;
+    unsigned long stateStartMs = 0;
+    unsigned long disconnectedAtMs = 0;
+    bool everConnected = false;
 };
 
-#endif // WIFI_MANAGER_H 
\ No newline at end of file
+#endif // WIFI_MANAGER_H
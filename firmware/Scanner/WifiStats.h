@@ -0,0 +1,45 @@
+#ifndef WIFI_STATS_H
+#define WIFI_STATS_H
+
+#include <Arduino.h>
+#include "ReportWriter.h"
+#include "JsonWriter.h"
+
+// Connection timings kept by WifiManager and sent with every report, so the
+// server can see how long scanners take to get online and how often they
+// drop off or move between access points.
+struct WifiStats {
+    uint32_t bootMs = 0;      // Boot to first connection
+    uint32_t reconnectMs = 0; // Length of the last outage, disconnect to connected
+    uint32_t reconnects = 0;
+    uint32_t roams = 0;       // Moves to a stronger access point
+    bool fast = false;        // Last connection used the cached access point
+    int8_t rssi = 0;
+    uint8_t channel = 0;
+
+    void writeReport(JsonWriter& out) const {
+        out.beginObject("wifi");
+        out.add("boot_ms", bootMs);
+        out.add("reconnect_ms", reconnectMs);
+        out.add("reconnects", reconnects);
+        out.add("roams", roams);
+        out.add("fast", fast);
+        out.add("rssi", (int)rssi);
+        out.add("channel", (int)channel);
+        out.endObject();
+    }
+
+    void writeReport(ReportWriter& out) const {
+        out.beginSection(SECTION_WIFI);
+        out.put32(bootMs);
+        out.put32(reconnectMs);
+        out.put32(reconnects);
+        out.put32(roams);
+        out.put8(fast);
+        out.put8((uint8_t)rssi);
+        out.put8(channel);
+        out.endSection();
+    }
+};
+
+#endif // WIFI_STATS_H
@@ -1,30 +1,53 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+// Build-time settings. Those marked [param] are only defaults: they can be
+// changed at runtime and are kept in NVS, see Params.h.
+
 #define POST_ENDPOINT "/data"
 #define DEFAULT_PORT 5000
+#define STREAM_PORT 5001 // Persistent report/command stream; HTTP is the fallback
+#define UPLINK_MQTT 0 // Publish reports to an MQTT broker on the server host (MqttManager.h)
+#define MQTT_PORT 1883
+#define MQTT_REPORT_QOS 1 // 0: fire and forget, 1: resend until the broker acknowledges
+
+#define FIRMWARE_VERSION 1 // Build number, reported as "fw"; bump it for every image put on the server for OTA
 
 #define SCANNER_NAME "Scanner"
 #define BEACON_NAME_PREFIX "HitloopBeacon"
-#define BLE_SCAN_INTERVAL 100
-#define BLE_SCAN_WINDOW 50
+#define BLE_SCAN_INTERVAL 100 // [param]
+#define BLE_SCAN_WINDOW 50 // [param]
 #define WIFI_CONNECT_DELAY 500
+#define WIFI_MAX_NETWORKS 3 // Configured SSIDs; the strongest one in range is joined
+#define WIFI_ROAM_RSSI -75 // [param] Below this signal, look for a stronger access point
+#define WIFI_ROAM_MARGIN_DB 8 // [param] and move to it if it is this much stronger
 #define WIFI_SEND_DELAY 3000
 #define SERIAL_BAUD_RATE 115200
 #define SETUP_DELAY 1000
-#define SCAN_DURATION 2 // Scan for 2 seconds
-#define SCAN_INTERVAL_MS (10000 - (SCAN_DURATION * 1000)) // Interval between scans
+#define SCAN_DURATION 2 // [param] Scan for 2 seconds
+#define SCAN_INTERVAL_MS (10000 - (SCAN_DURATION * 1000)) // [param] Interval between scans
 
 // The service UUID of the beacons to scan for
 #define BEACON_SERVICE_UUID "19b10000-e8f2-537e-4f6c-d104768a1214"
 
+#define REPORT_BINARY 1 // Send reports in the binary format (ReportWriter.h) instead of JSON
+#define REPORT_BATCH_SIZE 1 // [param] Reports per request; 1 sends every report right away
+#define REPORT_BATCH_MAX_AGE_MS 60000 // Send a batch once its oldest report is this old
+#define REPORT_BATCH_MAX_BYTES 4096
+#define REPORT_URGENT_RSSI -50 // [param] A beacon heard this close is reported at once (UrgentManager.h) and sends the batch
+#define REPORT_KEYFRAME_INTERVAL 6 // [param] Full beacon list every N reports, only changes in between; 1 always sends the full list
+#define REPORT_DELTA_HYSTERESIS_DB 3 // [param] Between keyframes, a beacon is resent once its filtered RSSI moves this far
+
 #define BOOT_BUTTON_PIN 9
 
-#define IMU_UPDATE_INTERVAL_MS 10
+#define IMU_UPDATE_INTERVAL_MS 100 // [param]
 #define NUM_ANGLE_SAMPLES 10
+#define URGENT_IMPACT_G 2.5 // [param] An acceleration above this is reported at once as an impact
 
 #define LED_PIN D1
-#define LED_COUNT 6
+#define LED_COUNT 6 // Pixels the buffers are sized for; [param] led_count may drive fewer
+#define LED_BRIGHTNESS 127 // [param] Not too high, to limit the current draw
+#define LED_OUTPUT_RMT 1 // Send LED frames asynchronously over RMT instead of bit-banging
 
 #define VIBRATION_MOTOR_PIN D0
 
@@ -0,0 +1,23 @@
+// The part of the Arduino core the report writers use, so the benchmarks
+// can include them on the host. Not used by the firmware build.
+#ifndef BENCH_ARDUINO_H
+#define BENCH_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+using std::min;
+
+class String {
+public:
+    String(const char* s = "") : s(s) {}
+    const char* c_str() const { return s.c_str(); }
+
+private:
+    std::string s;
+};
+
+#endif // BENCH_ARDUINO_H
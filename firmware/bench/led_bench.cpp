@@ -0,0 +1,189 @@
+// Host benchmark for the LED animation math. Not part of the firmware build;
+// from this directory:
+//
+//   g++ -std=gnu++17 -O2 -I../Scanner led_bench.cpp -o /tmp/led_bench && /tmp/led_bench
+//
+// Times one frame of Breathing and HeartBeat computed three ways: with
+// floating-point sin() and a division per frame (the original behaviors),
+// with the LedMath tables, and by the LedTimeline keyframe engine the
+// behaviors play today. Every variant draws into the same LedCanvas and
+// advances the clock by one LED tick (20 ms) per frame, so the numbers
+// compare. They are x86 numbers; the ESP32-C3 has no FPU, so sin() costs
+// far more there.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include "LedMath.h"
+#include "LedCanvas.h"
+#include "LedTimeline.h"
+
+static const int FRAMES = 10000000;
+static const int RUNS = 7;
+static const unsigned long TICK_MS = 20;
+static const uint32_t COLOR = 0xFF2040;
+// The behaviors read their color from a member; a constant would let the
+// compiler fold the color math away
+static uint32_t color = 0;
+
+static uint32_t divideScale(uint32_t color, uint8_t b) {
+    uint8_t r = ((color >> 16) & 0xFF) * b / 255;
+    uint8_t g = ((color >> 8) & 0xFF) * b / 255;
+    uint8_t bl = (color & 0xFF) * b / 255;
+    return ((uint32_t)r << 16) | ((uint32_t)g << 8) | bl;
+}
+
+// --- Breathing, 4 s period ---
+
+static void breathingFloat(LedCanvas& canvas, unsigned long now) {
+    float wave = sin(now * 2.0 * M_PI / 4000.0);
+    canvas.fill(divideScale(color, (uint8_t)(((wave + 1.0) / 2.0) * 255.0)));
+}
+
+static void breathingTable(LedCanvas& canvas, unsigned long now) {
+    uint16_t phase = (uint16_t)(((now % 4000) << 16) / 4000);
+    canvas.fill(LedMath::scaleColor(color, LedMath::sine16(phase)));
+}
+
+// --- HeartBeat, 770 ms beat every 2 s: the state machine the behavior used
+// before the timeline engine, with the fade either divided per frame or
+// read from a LedMath::Ramp ---
+
+template <bool useRamp>
+struct HeartBeatMachine {
+    enum State { IDLE, FADE_IN_1, FADE_OUT_1, PAUSE, FADE_IN_2, FADE_OUT_2 };
+    State state = IDLE;
+    unsigned long beatStart = 0, phaseStart = 0, phaseLength = 0;
+    LedMath::Ramp ramp;
+
+    void startPhase(State s, unsigned long length, unsigned long now) {
+        state = s;
+        phaseStart = now;
+        phaseLength = length;
+        ramp.begin(length);
+    }
+
+    uint8_t fade(unsigned long elapsed) const {
+        return useRamp ? ramp.at(elapsed) : (uint8_t)(elapsed * 255 / phaseLength);
+    }
+
+    void update(LedCanvas& canvas, unsigned long now) {
+        unsigned long elapsed = now - phaseStart;
+        switch (state) {
+            case IDLE:
+                if (now - beatStart >= 2000) {
+                    beatStart = now;
+                    startPhase(FADE_IN_1, 60, now);
+                }
+                break;
+            case FADE_IN_1:
+            case FADE_IN_2:
+                if (elapsed >= phaseLength) {
+                    canvas.fill(color);
+                    if (state == FADE_IN_1) startPhase(FADE_OUT_1, 150, now);
+                    else startPhase(FADE_OUT_2, 400, now);
+                } else {
+                    canvas.fill(divideOrScale(fade(elapsed)));
+                }
+                break;
+            case FADE_OUT_1:
+            case FADE_OUT_2:
+                if (elapsed >= phaseLength) {
+                    canvas.fill(0);
+                    if (state == FADE_OUT_1) {
+                        startPhase(PAUSE, 100, now);
+                    } else {
+                        state = IDLE;
+                    }
+                } else {
+                    canvas.fill(divideOrScale(255 - fade(elapsed)));
+                }
+                break;
+            case PAUSE:
+                if (elapsed > phaseLength) startPhase(FADE_IN_2, 60, now);
+                break;
+        }
+    }
+
+    static uint32_t divideOrScale(uint8_t b) {
+        return useRamp ? LedMath::scaleColor(color, b) : divideScale(color, b);
+    }
+};
+
+// The same shapes as BreathingBehavior and HeartBeatBehavior build them
+static LedTimeline breathingTrack() {
+    LedTimeline track;
+    track.addKeyframe(0, EASE_SINE, 0);
+    track.addKeyframe(2000, EASE_SINE, COLOR);
+    track.setDuration(4000);
+    track.finalize();
+    return track;
+}
+
+static LedTimeline heartBeatTrack() {
+    LedTimeline track;
+    unsigned long t = 2000 - 770;
+    track.addKeyframe(0, EASE_STEP, 0);
+    track.addKeyframe(t, EASE_LINEAR, 0);
+    track.addKeyframe(t += 60, EASE_LINEAR, COLOR);
+    track.addKeyframe(t += 150, EASE_STEP, 0);
+    track.addKeyframe(t += 100, EASE_LINEAR, 0);
+    track.addKeyframe(t += 60, EASE_LINEAR, COLOR);
+    track.setDuration(2000);
+    track.finalize();
+    return track;
+}
+
+// Behaviors are called through LedBehavior's virtual update(), so each
+// variant is too; that keeps the compiler from folding one into the loop
+struct Frame {
+    virtual void draw(LedCanvas& canvas, unsigned long now) = 0;
+};
+
+template <typename F>
+struct FrameOf : Frame {
+    F f;
+    explicit FrameOf(F f) : f(f) {}
+    void draw(LedCanvas& canvas, unsigned long now) override { f(canvas, now); }
+};
+
+static Frame* volatile current;
+static volatile uint8_t sink;
+
+// Best of RUNS, which filters out the noise of a shared machine
+template <typename F>
+static double time(const char* name, F f) {
+    FrameOf<F> frame(f);
+    current = &frame;
+    double best = 1e9;
+    for (int run = 0; run < RUNS; run++) {
+        LedCanvas canvas;
+        Frame* variant = current;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < FRAMES; i++) {
+            variant->draw(canvas, (unsigned long)i * TICK_MS);
+            sink = canvas.rgb[0][0];
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / FRAMES;
+        if (ns < best) best = ns;
+    }
+    printf("  %-28s %6.2f ns/frame\n", name, best);
+    return best;
+}
+
+int main() {
+    color = COLOR;
+    printf("Breathing\n");
+    time("sin() + divide", [](LedCanvas& c, unsigned long now) { breathingFloat(c, now); });
+    time("LedMath tables", [](LedCanvas& c, unsigned long now) { breathingTable(c, now); });
+    LedTimeline breathing = breathingTrack();
+    time("LedTimeline", [&](LedCanvas& c, unsigned long now) { breathing.render(now, c); });
+
+    printf("HeartBeat\n");
+    HeartBeatMachine<false> divided;
+    time("state machine + divide", [&](LedCanvas& c, unsigned long now) { divided.update(c, now); });
+    HeartBeatMachine<true> ramped;
+    time("state machine + Ramp", [&](LedCanvas& c, unsigned long now) { ramped.update(c, now); });
+    LedTimeline heartBeat = heartBeatTrack();
+    time("LedTimeline", [&](LedCanvas& c, unsigned long now) { heartBeat.render(now, c); });
+    return 0;
+}
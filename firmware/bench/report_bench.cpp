@@ -0,0 +1,108 @@
+// Host benchmark for the scan report encodings. Not part of the firmware
+// build; from this directory:
+//
+//   g++ -std=gnu++17 -O2 -I. -I../Scanner report_bench.cpp -o /tmp/report_bench && /tmp/report_bench
+//
+// Encodes the same report, 8 beacons with motion, preset versions, link and
+// WiFi stats, through the encoders DataManager uses (ReportEncoder.h): as
+// JSON through JsonWriter and in the binary layout of ReportWriter.h. Prints
+// the time per report and the payload size of each. They are x86 numbers;
+// the ESP32-C3 formats numbers in software, so the JSON gap is wider there.
+#include <chrono>
+#include <cstdio>
+#include "config.h"
+#include "ReportEncoder.h"
+#include "UplinkStats.h"
+#include "WifiStats.h"
+
+static const int REPORTS = 1000000;
+static const int RUNS = 7;
+
+// What DataManager reads from the scan and the other modules
+struct Report {
+    String mac = "24:EC:4A:01:02:03";
+    String name = "Scanner-010203";
+    const char* beacons[8] = {"HitloopBeacon_01", "HitloopBeacon_02", "HitloopBeacon_03", "HitloopBeacon_04",
+                              "HitloopBeacon_05", "HitloopBeacon_06", "HitloopBeacon_07", "HitloopBeacon_08"};
+    int rssi[8] = {-48, -52, -57, -61, -66, -70, -75, -81};
+    uint8_t presetIds[2] = {3, 7};
+    uint16_t presetVersions[2] = {2, 1};
+    UplinkStats link;
+    WifiStats wifi;
+};
+
+// What PresetStore::writeVersions() writes; PresetStore needs NVS and the behaviors
+static void writePresetVersions(const Report& r, JsonWriter& json) {
+    json.beginArray("pv");
+    for (int i = 0; i < 2; i++) {
+        json.beginArray();
+        json.value((unsigned int)r.presetIds[i]);
+        json.value((unsigned int)r.presetVersions[i]);
+        json.endArray();
+    }
+    json.endArray();
+}
+
+static void writePresetVersions(const Report& r, ReportWriter& writer) {
+    writer.beginSection(SECTION_PRESETS);
+    for (int i = 0; i < 2; i++) {
+        writer.put8(r.presetIds[i]);
+        writer.put16(r.presetVersions[i]);
+    }
+    writer.endSection();
+}
+
+template <typename W>
+static void encode(const Report& r, W& out) {
+    ReportContent content = { r.mac, r.name, false, 12.5f, -3.25f, 34.75f, 10012, 98, 0, 123456 };
+    encodeReport(out, content,
+                 [&](auto emit) {
+                     for (int i = 0; i < 8; i++) emit(r.beacons[i], r.rssi[i]);
+                 },
+                 [](auto) {},
+                 [&](W& w) {
+                     writePresetVersions(r, w);
+                     r.link.writeReport(w);
+                     r.wifi.writeReport(w);
+                 });
+}
+
+static volatile uint8_t sink;
+
+// Best of RUNS, which filters out the noise of a shared machine
+template <typename W>
+static void time(const char* name, const Report& report, W& writer, void (*encode)(const Report&, W&)) {
+    void (*volatile encoder)(const Report&, W&) = encode;
+    double best = 1e9;
+    for (int run = 0; run < RUNS; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < REPORTS; i++) {
+            encoder(report, writer);
+            sink = writer.data()[writer.size() - 1];
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / REPORTS;
+        if (ns < best) best = ns;
+    }
+    printf("  %-8s %7.1f ns/report %5zu bytes%s\n", name, best, writer.size(),
+           writer.overflowed() ? " (overflowed)" : "");
+}
+
+static JsonWriter json;
+static ReportWriter binary;
+
+int main() {
+    Report report;
+    report.link.requests = 412;
+    report.link.reused = 409;
+    report.link.reconnects = 3;
+    report.link.lastRoundTripMs = 27;
+    report.link.avgRoundTripMs = 31;
+    report.wifi.bootMs = 2140;
+    report.wifi.fast = true;
+    report.wifi.rssi = -58;
+    report.wifi.channel = 6;
+    printf("Scan report, 8 beacons\n");
+    time("JSON", report, json, encode<JsonWriter>);
+    time("binary", report, binary, encode<ReportWriter>);
+    return 0;
+}